@@ -0,0 +1,526 @@
+#include "minic.h"
+
+// An image is a header followed by the token buffer, the AST
+// and the table of identifiers the file uses,
+// each array exactly as it’s laid out in memory
+// and padded so the next one is 8-byte aligned.
+// Images are mapped and used in place, and, like the identifier cache,
+// are only ever read back on the machine that wrote them.
+// Each file has one image, named after its path,
+// which is replaced whenever the file is saved again.
+typedef struct astCacheHeader {
+	u32 magic;
+	u32 version;
+	u64 content_hash;
+	u64 content_length;
+
+	// the identifier cache generation the table’s IDs belong to
+	u64 identifier_generation;
+
+	// Nodes and tokens refer to each other by index,
+	// so rather than check every index we check the arrays
+	// are exactly as they were written.
+	u64 body_checksum;
+
+	u64 token_count;
+	u64 long_span_count;
+	u64 identifier_count;
+	u64 literal_count;
+	u64 newline_count;
+
+	u64 function_count;
+	u64 statement_count;
+	u64 expression_count;
+
+	// identifiers used by the file, with their IDs when it was cached
+	u64 table_count;
+	u64 table_string_bytes;
+} astCacheHeader;
+
+enum {
+	AST_CACHE_MAGIC = 0x5441434d, // “MCAT”
+
+	// Bump this whenever the layout of tokens or nodes changes.
+	AST_CACHE_VERSION = 4,
+
+	// Counts are checked against this before any sizes are worked out
+	// so that a damaged header can’t make them overflow.
+	MAX_AST_CACHE_COUNT = 1u << 30,
+};
+
+// A cursor through the arrays of an image.
+typedef struct astCacheReader {
+	u8 *top;
+	usize offset;
+} astCacheReader;
+
+static usize padded(usize size)
+{
+	return (size + 7) & ~(usize)7;
+}
+
+static void *readArray(astCacheReader *r, usize size)
+{
+	void *p = r->top + r->offset;
+	r->offset += padded(size);
+	return p;
+}
+
+static bool writeArray(int fd, void *p, usize size)
+{
+	u8 padding[8] = { 0 };
+	usize padding_size = padded(size) - size;
+	return write(fd, p, size) == (isize)size &&
+	       write(fd, padding, padding_size) == (isize)padding_size;
+}
+
+// The table of identifiers an image was saved with.
+typedef struct astCacheTable {
+	identifierId *ids;
+	u64 *hashes;
+	internedString *strings;
+	char *pool;
+	usize count;
+	usize string_bytes;
+} astCacheTable;
+
+typedef struct astCacheArray {
+	void *p;
+	usize size;
+} astCacheArray;
+
+enum { AST_CACHE_ARRAY_COUNT = 21 };
+
+// Lists every array after the header, in the order they’re laid out.
+static void astCacheArrays(astCacheArray *arrays, tokenBuffer tokens,
+			   astRoot ast, astCacheTable table)
+{
+	astCacheArray list[AST_CACHE_ARRAY_COUNT] = {
+		{ tokens.kinds, tokens.count * sizeof(tokenKind) },
+		{ tokens.span_starts, tokens.count * sizeof(u32) },
+		{ tokens.span_lengths, tokens.count * sizeof(u8) },
+		{ tokens.long_spans,
+		  tokens.long_span_count * sizeof(tokenLongSpan) },
+		{ tokens.identifier_ids, tokens.count * sizeof(identifierId) },
+		{ tokens.identifier_hashes,
+		  tokens.identifier_count * sizeof(u64) },
+		{ tokens.literal_tokens, tokens.literal_count * sizeof(u32) },
+		{ tokens.literal_values, tokens.literal_count * sizeof(u64) },
+		{ tokens.lines.newlines, tokens.lines.count * sizeof(u32) },
+		{ tokens.newline_identifier_counts,
+		  tokens.lines.count * sizeof(u32) },
+		{ ast.functions, ast.function_count * sizeof(astFunction) },
+		{ ast.statements,
+		  ast.statement_count * sizeof(astStatementData) },
+		{ ast.statement_kinds,
+		  ast.statement_count * sizeof(astStatementKind) },
+		{ ast.statement_spans, ast.statement_count * sizeof(span) },
+		{ ast.expressions,
+		  ast.expression_count * sizeof(astExpressionData) },
+		{ ast.expression_kinds,
+		  ast.expression_count * sizeof(astExpressionKind) },
+		{ ast.expression_spans, ast.expression_count * sizeof(span) },
+		{ table.ids, table.count * sizeof(identifierId) },
+		{ table.hashes, table.count * sizeof(u64) },
+		{ table.strings, table.count * sizeof(internedString) },
+		{ table.pool, table.string_bytes },
+	};
+	memcpy(arrays, list, sizeof(list));
+}
+
+static u64 astCacheChecksum(astCacheArray *arrays)
+{
+	u64 checksum = 0;
+	for (usize i = 0; i < AST_CACHE_ARRAY_COUNT; i++)
+		checksum = rotl(checksum, 5) ^
+			   wyhash(arrays[i].p, arrays[i].size);
+	return checksum;
+}
+
+static usize astCacheSize(astCacheHeader header)
+{
+	return padded(sizeof(header)) +
+	       padded(header.token_count * sizeof(tokenKind)) +
+	       padded(header.token_count * sizeof(u32)) +
+	       padded(header.token_count * sizeof(u8)) +
+	       padded(header.long_span_count * sizeof(tokenLongSpan)) +
+	       padded(header.token_count * sizeof(identifierId)) +
+	       padded(header.identifier_count * sizeof(u64)) +
+	       padded(header.literal_count * sizeof(u32)) +
+	       padded(header.literal_count * sizeof(u64)) +
+	       padded(header.newline_count * sizeof(u32)) +
+	       padded(header.newline_count * sizeof(u32)) +
+	       padded(header.function_count * sizeof(astFunction)) +
+	       padded(header.statement_count * sizeof(astStatementData)) +
+	       padded(header.statement_count * sizeof(astStatementKind)) +
+	       padded(header.statement_count * sizeof(span)) +
+	       padded(header.expression_count * sizeof(astExpressionData)) +
+	       padded(header.expression_count * sizeof(astExpressionKind)) +
+	       padded(header.expression_count * sizeof(span)) +
+	       padded(header.table_count * sizeof(identifierId)) +
+	       padded(header.table_count * sizeof(u64)) +
+	       padded(header.table_count * sizeof(internedString)) +
+	       padded(header.table_string_bytes);
+}
+
+static char *astCachePath(const char *dir, const char *name, bump *b)
+{
+	u64 name_hash = wyhash((u8 *)name, strlen(name));
+	return bumpPrintf(b, "%s/%016llx.ast", dir,
+			  (unsigned long long)name_hash);
+}
+
+// Images from an older identifier generation are turned away here,
+// before any of their identifiers can be inserted.
+static bool astCacheHeaderValid(astCacheHeader header, usize file_size,
+				u64 content_hash, usize content_length,
+				u64 identifier_generation)
+{
+	if (header.magic != AST_CACHE_MAGIC ||
+	    header.version != AST_CACHE_VERSION ||
+	    header.content_hash != content_hash ||
+	    header.content_length != content_length ||
+	    header.identifier_generation != identifier_generation)
+		return false;
+
+	u64 counts[] = {
+		header.token_count,	 header.long_span_count,
+		header.identifier_count, header.literal_count,
+		header.newline_count,	 header.function_count,
+		header.statement_count,	 header.expression_count,
+		header.table_count,	 header.table_string_bytes,
+	};
+	for (usize i = 0; i < sizeof(counts) / sizeof(counts[0]); i++)
+		if (counts[i] > MAX_AST_CACHE_COUNT)
+			return false;
+
+	return file_size == astCacheSize(header);
+}
+
+// Every identifier in the image is inserted into the interner
+// as the lexer would have done.
+// The image can only be used if each one gets the ID it had before,
+// which is nearly always the case once the generations match,
+// since the identifier cache keeps IDs the same from one run to the next.
+static bool astCacheAddIdentifiers(astCacheTable table, growableInterner *gi)
+{
+	for (usize i = 0; i < table.count; i++) {
+		internedString s = table.strings[i];
+		if ((u64)s.offset + s.length >= table.string_bytes)
+			return false;
+
+		identifierId id = growableInternerInsert(
+			gi, table.pool + s.offset, s.length, table.hashes[i]);
+		if (id.raw != table.ids[i].raw)
+			return false;
+	}
+
+	return true;
+}
+
+bool astCacheLoad(cachedAst *cached, const char *dir, const char *name,
+		  char *content, usize length, growableInterner *identifiers,
+		  bump *b)
+{
+	u64 content_hash = wyhash((u8 *)content, length);
+
+	bumpMark mark = bumpCreateMark(b);
+	int fd = open(astCachePath(dir, name, b), O_RDONLY);
+	bumpClearToMark(b, mark);
+	if (fd == -1)
+		return false;
+
+	struct stat stat;
+	if (fstat(fd, &stat) == -1 ||
+	    (usize)stat.st_size < sizeof(astCacheHeader)) {
+		close(fd);
+		return false;
+	}
+	usize size = stat.st_size;
+
+	// Nodes refer to each other by index rather than by pointer,
+	// so the arrays are used straight out of the mapping.
+	u8 *file = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (file == MAP_FAILED)
+		return false;
+
+	astCacheHeader header = { 0 };
+	memcpy(&header, file, sizeof(header));
+	if (!astCacheHeaderValid(header, size, content_hash, length,
+				 identifiers->generation)) {
+		munmap(file, size);
+		return false;
+	}
+
+	astCacheReader r = { .top = file, .offset = padded(sizeof(header)) };
+
+	tokenBuffer tokens = {
+		.count = header.token_count,
+		.long_span_count = header.long_span_count,
+		.identifier_count = header.identifier_count,
+		.literal_count = header.literal_count,
+	};
+	tokens.kinds = readArray(&r, tokens.count * sizeof(tokenKind));
+	tokens.span_starts = readArray(&r, tokens.count * sizeof(u32));
+	tokens.span_lengths = readArray(&r, tokens.count * sizeof(u8));
+	tokens.long_spans = readArray(
+		&r, tokens.long_span_count * sizeof(tokenLongSpan));
+	tokens.identifier_ids =
+		readArray(&r, tokens.count * sizeof(identifierId));
+	tokens.identifier_hashes =
+		readArray(&r, tokens.identifier_count * sizeof(u64));
+	tokens.literal_tokens =
+		readArray(&r, tokens.literal_count * sizeof(u32));
+	tokens.literal_values =
+		readArray(&r, tokens.literal_count * sizeof(u64));
+	tokens.lines.count = header.newline_count;
+	tokens.lines.newlines =
+		readArray(&r, tokens.lines.count * sizeof(u32));
+	tokens.newline_identifier_counts =
+		readArray(&r, tokens.lines.count * sizeof(u32));
+
+	astRoot ast = {
+		.function_count = header.function_count,
+		.statement_count = header.statement_count,
+		.expression_count = header.expression_count,
+	};
+	ast.functions = readArray(&r, ast.function_count * sizeof(astFunction));
+	ast.statements =
+		readArray(&r, ast.statement_count * sizeof(astStatementData));
+	ast.statement_kinds =
+		readArray(&r, ast.statement_count * sizeof(astStatementKind));
+	ast.statement_spans = readArray(&r, ast.statement_count * sizeof(span));
+	ast.expressions = readArray(
+		&r, ast.expression_count * sizeof(astExpressionData));
+	ast.expression_kinds = readArray(
+		&r, ast.expression_count * sizeof(astExpressionKind));
+	ast.expression_spans =
+		readArray(&r, ast.expression_count * sizeof(span));
+
+	astCacheTable table = {
+		.count = header.table_count,
+		.string_bytes = header.table_string_bytes,
+	};
+	table.ids = readArray(&r, table.count * sizeof(identifierId));
+	table.hashes = readArray(&r, table.count * sizeof(u64));
+	table.strings = readArray(&r, table.count * sizeof(internedString));
+	table.pool = readArray(&r, table.string_bytes);
+	assert(r.offset == size);
+
+	astCacheArray arrays[AST_CACHE_ARRAY_COUNT];
+	astCacheArrays(arrays, tokens, ast, table);
+	if (astCacheChecksum(arrays) != header.body_checksum ||
+	    !astCacheAddIdentifiers(table, identifiers)) {
+		munmap(file, size);
+		return false;
+	}
+
+	*cached = (cachedAst){
+		.tokens = tokens,
+		.ast = ast,
+		.image = file,
+		.image_size = size,
+	};
+	return true;
+}
+
+void astCacheUnmap(cachedAst cached)
+{
+	munmap(cached.image, cached.image_size);
+}
+
+// The tokens must refer to IDs in the growable interner.
+void astCacheSave(const char *dir, const char *name, char *content,
+		  usize length, tokenBuffer tokens, astRoot ast,
+		  growableInterner *identifiers, bump *b)
+{
+	bumpMark mark = bumpCreateMark(b);
+	interner interner = growableInternerView(identifiers);
+	u64 *hashes = identifiers->hashes.top;
+
+	// Each identifier is saved once, in the order it first appears.
+	bool *seen = bumpAllocateArray(bool, b, interner.count);
+	memset(seen, 0, interner.count * sizeof(bool));
+	astCacheTable table = {
+		.ids = bumpAllocateArray(identifierId, b, tokens.count),
+	};
+
+	for (usize i = 0; i < tokens.count; i++) {
+		if (tokens.kinds[i] != TOK_IDENTIFIER)
+			continue;
+
+		identifierId id = tokens.identifier_ids[i];
+		assert(id.raw < interner.count);
+		if (seen[id.raw])
+			continue;
+
+		seen[id.raw] = true;
+		table.ids[table.count++] = id;
+		table.string_bytes += internerLookupLength(interner, id) + 1;
+	}
+
+	table.hashes = bumpAllocateArray(u64, b, table.count);
+	table.strings = bumpAllocateArray(internedString, b, table.count);
+	table.pool = bumpAllocateArray(char, b, table.string_bytes);
+	u32 offset = 0;
+
+	for (usize i = 0; i < table.count; i++) {
+		identifierId id = table.ids[i];
+		u32 id_length = internerLookupLength(interner, id);
+		table.hashes[i] = hashes[id.raw];
+		table.strings[i] = (internedString){
+			.offset = offset,
+			.length = id_length,
+		};
+		memcpy(table.pool + offset, internerLookup(interner, id),
+		       id_length + 1);
+		offset += id_length + 1;
+	}
+
+	astCacheArray arrays[AST_CACHE_ARRAY_COUNT];
+	astCacheArrays(arrays, tokens, ast, table);
+
+	astCacheHeader header = {
+		.magic = AST_CACHE_MAGIC,
+		.version = AST_CACHE_VERSION,
+		.content_hash = wyhash((u8 *)content, length),
+		.content_length = length,
+		.identifier_generation = identifiers->generation,
+		.body_checksum = astCacheChecksum(arrays),
+		.token_count = tokens.count,
+		.long_span_count = tokens.long_span_count,
+		.identifier_count = tokens.identifier_count,
+		.literal_count = tokens.literal_count,
+		.newline_count = tokens.lines.count,
+		.function_count = ast.function_count,
+		.statement_count = ast.statement_count,
+		.expression_count = ast.expression_count,
+		.table_count = table.count,
+		.table_string_bytes = table.string_bytes,
+	};
+
+	// As with the identifier cache, we write to a temporary file
+	// and rename it into place so a run that’s interrupted
+	// can’t leave a torn image behind.
+	// Renaming over the file’s previous image also gets rid of it.
+	char *path = astCachePath(dir, name, b);
+	char *temporary_path = bumpPrintf(b, "%s.tmp", path);
+
+	int fd = open(temporary_path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if (fd == -1) {
+		bumpClearToMark(b, mark);
+		return;
+	}
+
+	bool written = writeArray(fd, &header, sizeof(header));
+	for (usize i = 0; written && i < AST_CACHE_ARRAY_COUNT; i++)
+		written = writeArray(fd, arrays[i].p, arrays[i].size);
+	close(fd);
+
+	if (written)
+		rename(temporary_path, path);
+	else
+		unlink(temporary_path);
+	bumpClearToMark(b, mark);
+}
+
+// Lists the images in an AST cache directory,
+// deleting them all if asked to.
+static usize astCacheImageCount(const char *dir, bool delete, bump *b)
+{
+	usize count = 0;
+	DIR *d = opendir(dir);
+	assert(d != NULL);
+	for (;;) {
+		struct dirent *entry = readdir(d);
+		if (entry == NULL)
+			break;
+		if (entry->d_type != DT_REG)
+			continue;
+
+		count++;
+		if (delete) {
+			bumpMark mark = bumpCreateMark(b);
+			unlink(bumpPrintf(b, "%s/%s", dir, entry->d_name));
+			bumpClearToMark(b, mark);
+		}
+	}
+	closedir(d);
+	return count;
+}
+
+// Saves the file’s tokens and AST to the cache and then loads them
+// into a fresh interner started from the identifier cache,
+// as the next run would, printing the AST that comes back.
+// Saving twice must leave one image rather than two,
+// and once the identifier cache has been compacted
+// the image must be turned away without inserting anything.
+char *astCacheTests(char *input, usize length, memory *m)
+{
+	char dir[] = "/tmp/minic-ast-cache-XXXXXX";
+	char *made = mkdtemp(dir);
+	assert(made != NULL);
+	char *identifier_cache_path =
+		bumpPrintf(&m->general, "%s.identifiers", dir);
+
+	diagnosticsStorage diagnostics = diagnosticsStorageCreate(&m->temp);
+	growableInterner *saved_identifiers =
+		growableInternerCreate(&m->general);
+	tokenBuffer tokens = lex(input, length, &diagnostics, m);
+	internFile(&tokens, input, m);
+	growableInternerAddFile(saved_identifiers, &tokens, input, 1, m);
+	astRoot ast = parse(tokens, &diagnostics, m);
+
+	for (u32 i = 0; i < 2; i++)
+		astCacheSave(dir, "test.mc", input, length, tokens, ast,
+			     saved_identifiers, &m->temp);
+	assert(astCacheImageCount(dir, false, &m->temp) == 1);
+	growableInternerSave(saved_identifiers, identifier_cache_path,
+			     &m->temp);
+
+	growableInterner *loaded_identifiers =
+		growableInternerCreate(&m->general);
+	assert(growableInternerLoad(loaded_identifiers,
+				    identifier_cache_path));
+	cachedAst cached = { 0 };
+	bool loaded = astCacheLoad(&cached, dir, "test.mc", input, length,
+				   loaded_identifiers, &m->temp);
+	assert(loaded);
+	assert(tokenBuffersEqual(cached.tokens, tokens));
+
+	stringBuilder sb = stringBuilderCreate(&m->temp);
+	astDebug(cached.ast, growableInternerView(loaded_identifiers), &sb);
+	char *result = stringBuilderFinish(sb);
+
+	// Nothing is inserted into an interner that has just been loaded,
+	// so saving it again drops every identifier.
+	growableInterner *unused_identifiers =
+		growableInternerCreate(&m->general);
+	assert(growableInternerLoad(unused_identifiers,
+				    identifier_cache_path));
+	growableInternerSave(unused_identifiers, identifier_cache_path,
+			     &m->temp);
+
+	growableInterner *compacted_identifiers =
+		growableInternerCreate(&m->general);
+	assert(growableInternerLoad(compacted_identifiers,
+				    identifier_cache_path));
+	assert(compacted_identifiers->generation ==
+	       saved_identifiers->generation + 1);
+	cachedAst stale = { 0 };
+	loaded = astCacheLoad(&stale, dir, "test.mc", input, length,
+			      compacted_identifiers, &m->temp);
+	assert(!loaded);
+	assert(compacted_identifiers->count == 0);
+
+	astCacheUnmap(cached);
+	growableInternerDestroy(compacted_identifiers);
+	growableInternerDestroy(unused_identifiers);
+	growableInternerDestroy(loaded_identifiers);
+	growableInternerDestroy(saved_identifiers);
+	astCacheImageCount(dir, true, &m->temp);
+	rmdir(dir);
+	unlink(identifier_cache_path);
+	return result;
+}
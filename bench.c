@@ -0,0 +1,717 @@
+#include "minic.h"
+
+enum {
+	// Each benchmark is run once to warm up caches and page tables,
+	// and then this many more times for real.
+	BENCH_RUN_COUNT = 11,
+
+	// Benchmarks get memory of their own
+	// so they aren’t limited by the sizes the compiler itself runs with.
+	// Pages are only committed once touched,
+	// so most of this is never actually used.
+	BENCH_MEMORY_SIZE = 1024 * 1024 * 1024,
+
+	BUMP_CHURN_COUNT = 1024 * 1024,
+	ARRAY_PUSH_COUNT = 4 * 1024 * 1024,
+	HASHED_IDENTIFIER_COUNT = 64 * 1024,
+	INTERN_TOKEN_COUNT = 1024 * 1024,
+	INTERN_VOCABULARY_SIZE = 4096,
+	LEX_FUNCTION_COUNT = 32 * 1024,
+	LEX_LONG_FUNCTION_COUNT = 24 * 1024,
+
+	// Most source files are small,
+	// so it’s the fixed costs of parsing and lowering one we care about.
+	SMALL_FILE_FUNCTION_COUNT = 8,
+	SMALL_FILE_REPEAT_COUNT = 4096,
+
+	// Machine-generated code can nest far deeper than anyone would write.
+	DEEP_FILE_NESTING_DEPTH = 2000,
+	DEEP_FILE_REPEAT_COUNT = 64,
+
+	// what an editor asks for as the cursor moves around a file
+	SPAN_LOOKUP_COUNT = 1024 * 1024,
+};
+
+// Everything the benchmarks run on is generated up front
+// so that generating it isn’t part of what gets measured.
+typedef struct benchInputs {
+	char *identifiers;
+	u32 *identifier_starts;
+	u8 *identifier_lengths;
+	usize identifier_bytes;
+
+	char *intern_source;
+	usize intern_source_length;
+	tokenBuffer intern_tokens;
+
+	char *lex_source;
+	usize lex_source_length;
+	tokenBuffer lex_tokens;
+	astRoot lex_ast;
+	astSpanIndex lex_span_index;
+	u32 worker_count;
+
+	// long generated identifiers indented with spaces,
+	// where most of the bytes are in runs the SIMD kernels skip
+	char *lex_long_source;
+	usize lex_long_source_length;
+
+	char *edited_source;
+	usize edited_source_length;
+	tokenBuffer edited_tokens;
+
+	// where the edited source has the lex source’s extra statement
+	u32 edit_start;
+	u32 edit_length;
+
+	// An incremental parse takes over the arrays of the AST it starts from,
+	// so the incremental benchmark keeps its own AST
+	// in memory that outlives each run.
+	memory incremental_memory;
+	astRoot incremental_ast;
+	astRangeTable incremental_ranges;
+
+	char *small_source;
+	usize small_source_length;
+	tokenBuffer small_tokens;
+	astRoot small_ast;
+	hirRoot small_hir;
+	interner small_interner;
+
+	char *deep_source;
+	usize deep_source_length;
+	tokenBuffer deep_tokens;
+	astRoot deep_ast;
+	hirRoot deep_hir;
+	interner deep_interner;
+	hirSpanIndex deep_span_index;
+
+	diagnosticsStorage diagnostics;
+} benchInputs;
+
+// how much work a single run of a benchmark did
+typedef struct benchWork {
+	usize ops;
+	usize bytes;
+} benchWork;
+
+typedef benchWork (*benchmark)(benchInputs *in, memory *m);
+
+// Results are written here so the compiler can’t throw the work away.
+static volatile u64 bench_sink;
+
+// xorshift64, so that inputs are the same from one run to the next
+static u64 benchRandom(u64 *state)
+{
+	u64 x = *state;
+	x ^= x << 13;
+	x ^= x >> 7;
+	x ^= x << 17;
+	*state = x;
+	return x;
+}
+
+static benchWork benchBumpChurn(benchInputs *in, memory *m)
+{
+	(void)in;
+
+	usize bytes = 0;
+	for (u32 i = 0; i < BUMP_CHURN_COUNT; i++) {
+		bumpMark mark = bumpCreateMark(&m->temp);
+		usize count = 1 + i % 16;
+		u64 *values = bumpAllocateArray(u64, &m->temp, count);
+		values[0] = i;
+		bumpClearToMark(&m->temp, mark);
+		bytes += count * sizeof(u64);
+	}
+
+	return (benchWork){ .ops = BUMP_CHURN_COUNT, .bytes = bytes };
+}
+
+static benchWork benchArrayBuilderPush(benchInputs *in, memory *m)
+{
+	(void)in;
+
+	arrayBuilder builder = bumpStartArrayBuilder(&m->temp, sizeof(u32));
+	for (u32 i = 0; i < ARRAY_PUSH_COUNT; i++)
+		arrayBuilderPush(&builder, &i);
+	u32 *values = bumpFinishArrayBuilder(&m->temp, &builder);
+	bench_sink = values[ARRAY_PUSH_COUNT - 1];
+
+	return (benchWork){
+		.ops = ARRAY_PUSH_COUNT,
+		.bytes = ARRAY_PUSH_COUNT * sizeof(u32),
+	};
+}
+
+static benchWork benchFxhash(benchInputs *in, memory *m)
+{
+	(void)m;
+
+	u64 combined = 0;
+	for (usize i = 0; i < HASHED_IDENTIFIER_COUNT; i++) {
+		u8 *identifier =
+			(u8 *)in->identifiers + in->identifier_starts[i];
+		combined ^= fxhash(identifier, in->identifier_lengths[i]);
+	}
+	bench_sink = combined;
+
+	return (benchWork){
+		.ops = HASHED_IDENTIFIER_COUNT,
+		.bytes = in->identifier_bytes,
+	};
+}
+
+static benchWork benchWyhash(benchInputs *in, memory *m)
+{
+	(void)m;
+
+	u64 combined = 0;
+	for (usize i = 0; i < HASHED_IDENTIFIER_COUNT; i++) {
+		u8 *identifier =
+			(u8 *)in->identifiers + in->identifier_starts[i];
+		combined ^= wyhash(identifier, in->identifier_lengths[i]);
+	}
+	bench_sink = combined;
+
+	return (benchWork){
+		.ops = HASHED_IDENTIFIER_COUNT,
+		.bytes = in->identifier_bytes,
+	};
+}
+
+static benchWork benchIntern(benchInputs *in, memory *m)
+{
+	// internFile() expects tokens which haven’t been assigned IDs yet.
+	// Resetting them is cheap next to the interning itself.
+	tokenBuffer *tokens = &in->intern_tokens;
+	memset(tokens->identifier_ids, -1,
+	       tokens->count * sizeof(identifierId));
+
+	internFile(tokens, in->intern_source, m);
+	interner interner = intern(tokens, &in->intern_source, 1, m);
+	bench_sink = interner.count;
+
+	return (benchWork){
+		.ops = in->intern_tokens.count,
+		.bytes = in->intern_source_length,
+	};
+}
+
+static benchWork benchLex(benchInputs *in, memory *m)
+{
+	in->diagnostics.count = 0;
+	in->diagnostics.all_messages.bytes_used = 0;
+
+	tokenBuffer tokens = lex(in->lex_source, in->lex_source_length,
+				 &in->diagnostics, m);
+	assert(in->diagnostics.count == 0);
+
+	return (benchWork){
+		.ops = tokens.count,
+		.bytes = in->lex_source_length,
+	};
+}
+
+static benchWork benchLexLongIdentifiers(benchInputs *in, memory *m)
+{
+	in->diagnostics.count = 0;
+	in->diagnostics.all_messages.bytes_used = 0;
+
+	tokenBuffer tokens = lex(in->lex_long_source,
+				 in->lex_long_source_length, &in->diagnostics,
+				 m);
+	assert(in->diagnostics.count == 0);
+
+	return (benchWork){
+		.ops = tokens.count,
+		.bytes = in->lex_long_source_length,
+	};
+}
+
+static benchWork benchParse(benchInputs *in, memory *m)
+{
+	astRoot ast = parse(in->lex_tokens, &in->diagnostics, m);
+	bench_sink = ast.expression_count;
+
+	return (benchWork){
+		.ops = in->lex_tokens.count,
+		.bytes = in->lex_source_length,
+	};
+}
+
+static benchWork benchParseParallel(benchInputs *in, memory *m)
+{
+	astRoot ast = parseParallel(in->lex_tokens, in->worker_count,
+				    &in->diagnostics, m);
+	bench_sink = ast.expression_count;
+
+	return (benchWork){
+		.ops = in->lex_tokens.count,
+		.bytes = in->lex_source_length,
+	};
+}
+
+// Makes the edit and then undoes it,
+// each time parsing from the AST the previous parse left behind.
+static benchWork benchParseIncremental(benchInputs *in, memory *m)
+{
+	(void)m;
+
+	memory *incremental = &in->incremental_memory;
+	span insertion = { .start = in->edit_start, .end = in->edit_start };
+	span deletion = {
+		.start = in->edit_start,
+		.end = in->edit_start + in->edit_length,
+	};
+
+	astRangeTable edited_ranges = { 0 };
+	astRoot edited = parseIncremental(
+		in->edited_tokens, in->incremental_ast, in->incremental_ranges,
+		insertion, in->edit_length, &edited_ranges, &in->diagnostics,
+		incremental);
+	in->incremental_ast = parseIncremental(
+		in->lex_tokens, edited, edited_ranges, deletion, 0,
+		&in->incremental_ranges, &in->diagnostics, incremental);
+	bench_sink = in->incremental_ast.expression_count;
+
+	return (benchWork){
+		.ops = in->edited_tokens.count + in->lex_tokens.count,
+		.bytes = in->edited_source_length + in->lex_source_length,
+	};
+}
+
+static benchWork benchParseFile(tokenBuffer tokens, u32 repeat_count,
+				usize source_length, benchInputs *in,
+				memory *m)
+{
+	for (u32 i = 0; i < repeat_count; i++) {
+		bumpMark mark = bumpCreateMark(&m->general);
+		astRoot ast = parse(tokens, &in->diagnostics, m);
+		bench_sink = ast.expression_count;
+		bumpClearToMark(&m->general, mark);
+	}
+
+	return (benchWork){
+		.ops = repeat_count,
+		.bytes = repeat_count * source_length,
+	};
+}
+
+static benchWork benchLowerFile(astRoot ast, u32 repeat_count,
+				usize source_length, benchInputs *in,
+				memory *m)
+{
+	for (u32 i = 0; i < repeat_count; i++) {
+		bumpMark mark = bumpCreateMark(&m->general);
+		in->diagnostics.count = 0;
+		in->diagnostics.all_messages.bytes_used = 0;
+		hirRoot hir = lower(ast, &in->diagnostics, m);
+		bench_sink = hir.node_count;
+		bumpClearToMark(&m->general, mark);
+	}
+
+	return (benchWork){
+		.ops = repeat_count,
+		.bytes = repeat_count * source_length,
+	};
+}
+
+static benchWork benchCodegenFile(hirRoot hir, interner interner,
+				  u32 repeat_count, usize source_length,
+				  benchInputs *in, memory *m)
+{
+	for (u32 i = 0; i < repeat_count; i++) {
+		bumpMark mark = bumpCreateMark(&m->general);
+		stringBuilder assembly = stringBuilderCreate(&m->general);
+		codegen(hir, interner, &assembly, &in->diagnostics, m);
+		bench_sink = *stringBuilderFinish(assembly);
+		bumpClearToMark(&m->general, mark);
+	}
+
+	return (benchWork){
+		.ops = repeat_count,
+		.bytes = repeat_count * source_length,
+	};
+}
+
+static benchWork benchParseSmallFile(benchInputs *in, memory *m)
+{
+	return benchParseFile(in->small_tokens, SMALL_FILE_REPEAT_COUNT,
+			      in->small_source_length, in, m);
+}
+
+static benchWork benchLowerSmallFile(benchInputs *in, memory *m)
+{
+	return benchLowerFile(in->small_ast, SMALL_FILE_REPEAT_COUNT,
+			      in->small_source_length, in, m);
+}
+
+static benchWork benchCodegenSmallFile(benchInputs *in, memory *m)
+{
+	return benchCodegenFile(in->small_hir, in->small_interner,
+				SMALL_FILE_REPEAT_COUNT,
+				in->small_source_length, in, m);
+}
+
+static benchWork benchParseDeepFile(benchInputs *in, memory *m)
+{
+	return benchParseFile(in->deep_tokens, DEEP_FILE_REPEAT_COUNT,
+			      in->deep_source_length, in, m);
+}
+
+static benchWork benchLowerDeepFile(benchInputs *in, memory *m)
+{
+	return benchLowerFile(in->deep_ast, DEEP_FILE_REPEAT_COUNT,
+			      in->deep_source_length, in, m);
+}
+
+static benchWork benchCodegenDeepFile(benchInputs *in, memory *m)
+{
+	return benchCodegenFile(in->deep_hir, in->deep_interner,
+				DEEP_FILE_REPEAT_COUNT, in->deep_source_length,
+				in, m);
+}
+
+static benchWork benchSpanIndexBuild(benchInputs *in, memory *m)
+{
+	astSpanIndex index = astSpanIndexBuild(in->lex_ast, m);
+	bench_sink = index.expressions.count;
+
+	return (benchWork){ .ops = 1, .bytes = in->lex_source_length };
+}
+
+static benchWork benchSpanLookup(benchInputs *in, memory *m)
+{
+	(void)m;
+
+	u64 random = 0x9e3779b97f4a7c15;
+	u64 found = 0;
+	for (u32 i = 0; i < SPAN_LOOKUP_COUNT; i++) {
+		u32 offset = benchRandom(&random) % in->lex_source_length;
+		astExpression expression = { 0 };
+		if (astExpressionAt(in->lex_span_index, offset, &expression))
+			found += expression.index;
+	}
+	bench_sink = found;
+
+	return (benchWork){ .ops = SPAN_LOOKUP_COUNT, .bytes = 0 };
+}
+
+static benchWork benchSpanLookupDeepFile(benchInputs *in, memory *m)
+{
+	(void)m;
+
+	u64 random = 0x9e3779b97f4a7c15;
+	u64 found = 0;
+	for (u32 i = 0; i < SPAN_LOOKUP_COUNT; i++) {
+		u32 offset = benchRandom(&random) % in->deep_source_length;
+		hirNode node = { 0 };
+		if (hirNodeAt(in->deep_span_index, offset, &node))
+			found += node.index;
+	}
+	bench_sink = found;
+
+	return (benchWork){ .ops = SPAN_LOOKUP_COUNT, .bytes = 0 };
+}
+
+static void generateIdentifiers(benchInputs *in, u64 *random, bump *b)
+{
+	enum { MAX_LENGTH = 24 };
+
+	in->identifiers = bumpAllocateArray(
+		char, b, HASHED_IDENTIFIER_COUNT * MAX_LENGTH);
+	in->identifier_starts =
+		bumpAllocateArray(u32, b, HASHED_IDENTIFIER_COUNT);
+	in->identifier_lengths =
+		bumpAllocateArray(u8, b, HASHED_IDENTIFIER_COUNT);
+	in->identifier_bytes = 0;
+
+	// Lengths between 2 and 24 bytes cover most real identifiers.
+	for (usize i = 0; i < HASHED_IDENTIFIER_COUNT; i++) {
+		u8 length = 2 + benchRandom(random) % (MAX_LENGTH - 1);
+		in->identifier_starts[i] = in->identifier_bytes;
+		in->identifier_lengths[i] = length;
+
+		for (u8 j = 0; j < length; j++)
+			in->identifiers[in->identifier_bytes + j] =
+				'a' + benchRandom(random) % 26;
+		in->identifier_bytes += length;
+	}
+}
+
+static void generateInternSource(benchInputs *in, u64 *random, memory *m)
+{
+	stringBuilder sb = stringBuilderCreate(&m->general);
+	for (usize i = 0; i < INTERN_TOKEN_COUNT; i++) {
+		u64 name = benchRandom(random) % INTERN_VOCABULARY_SIZE;
+		stringBuilderPrintf(&sb, "name_%llu\n",
+				    (unsigned long long)name);
+	}
+	in->intern_source = stringBuilderFinish(sb);
+	in->intern_source_length = strlen(in->intern_source);
+
+	in->intern_tokens = lex(in->intern_source, in->intern_source_length,
+				&in->diagnostics, m);
+	assert(in->diagnostics.count == 0);
+}
+
+// roughly what a generated function with provenance comments looks like
+static void appendLexFunction(stringBuilder *sb, u32 i, u32 a, u32 c,
+			      bool edited)
+{
+	stringBuilderPrintf(sb, "// generated from entry %u\n", i);
+	stringBuilderPrintf(sb, "func function_%u {\n", i);
+	stringBuilderPrintf(sb, "\tcounter := %u\n", a);
+	if (edited)
+		stringBuilderPrintf(sb, "\tset counter = counter - 1\n");
+	stringBuilderPrintf(sb, "\tvalues := [%u, %u, counter]\n", a, c);
+	stringBuilderPrintf(sb, "\twhile counter != %u {\n", c);
+	stringBuilderPrintf(sb, "\t\tset counter = counter + 1 "
+				"// keep going\n");
+	stringBuilderPrintf(sb, "\t\tif counter >= values[1] "
+				"{ return counter * 2 }\n");
+	stringBuilderPrintf(sb, "\t}\n\treturn values[0]\n}\n\n");
+}
+
+// The edited source is the same as the lex source,
+// except for one extra statement in the function in the middle.
+static void generateLexSource(benchInputs *in, u64 *random, memory *m)
+{
+	bumpMark mark = bumpCreateMark(&m->temp);
+	stringBuilder sb = stringBuilderCreate(&m->general);
+	stringBuilder edited_sb = stringBuilderCreate(&m->temp);
+	for (u32 i = 0; i < LEX_FUNCTION_COUNT; i++) {
+		u32 a = benchRandom(random) % 1000;
+		u32 c = benchRandom(random) % 1000;
+		appendLexFunction(&sb, i, a, c, false);
+		appendLexFunction(&edited_sb, i, a, c,
+				  i == LEX_FUNCTION_COUNT / 2);
+	}
+	in->lex_source = stringBuilderFinish(sb);
+	in->lex_source_length = strlen(in->lex_source);
+
+	char *edited_source = stringBuilderFinish(edited_sb);
+	usize edited_source_length = strlen(edited_source);
+	in->edited_source = bumpCopyArray(char, &m->general, edited_source,
+					  edited_source_length + 1);
+	in->edited_source_length = edited_source_length;
+	bumpClearToMark(&m->temp, mark);
+
+	in->lex_tokens = lex(in->lex_source, in->lex_source_length,
+			     &in->diagnostics, m);
+	in->edited_tokens = lex(in->edited_source, in->edited_source_length,
+				&in->diagnostics, m);
+	assert(in->diagnostics.count == 0);
+
+	// Both files have to share identifier IDs
+	// for their functions to be recognized as the same.
+	internFile(&in->lex_tokens, in->lex_source, m);
+	internFile(&in->edited_tokens, in->edited_source, m);
+	tokenBuffer buffers[] = { in->lex_tokens, in->edited_tokens };
+	char *contents[] = { in->lex_source, in->edited_source };
+	intern(buffers, contents, 2, m);
+
+	in->lex_ast = parse(in->lex_tokens, &in->diagnostics, m);
+	assert(in->diagnostics.count == 0);
+	in->lex_span_index = astSpanIndexBuild(in->lex_ast, m);
+
+	u32 edit_start = 0;
+	while (in->lex_source[edit_start] == in->edited_source[edit_start])
+		edit_start++;
+	in->edit_start = edit_start;
+	in->edit_length = in->edited_source_length - in->lex_source_length;
+
+	in->incremental_memory = (memory){
+		.temp = allocateFromOs(BENCH_MEMORY_SIZE),
+		.general = allocateFromOs(BENCH_MEMORY_SIZE),
+	};
+	astRangeTable none = { 0 };
+	in->incremental_ast = parseIncremental(
+		in->lex_tokens, (astRoot){ 0 }, none, (span){ 0 }, 0,
+		&in->incremental_ranges, &in->diagnostics,
+		&in->incremental_memory);
+}
+
+// what a schema compiler emits,
+// with names spelled out in full and four spaces of indentation
+static void generateLexLongSource(benchInputs *in, u64 *random, memory *m)
+{
+	stringBuilder sb = stringBuilderCreate(&m->general);
+	for (u32 i = 0; i < LEX_LONG_FUNCTION_COUNT; i++) {
+		u32 a = benchRandom(random) % 1000;
+		stringBuilderPrintf(&sb, "func generated_function_%u {\n", i);
+		stringBuilderPrintf(&sb,
+				    "    generated_accumulator_%u := "
+				    "generated_input_value_%u\n",
+				    a, a);
+		stringBuilderPrintf(&sb,
+				    "    while generated_accumulator_%u != "
+				    "generated_upper_bound_%u {\n",
+				    a, a);
+		stringBuilderPrintf(&sb,
+				    "        set generated_accumulator_%u = "
+				    "generated_accumulator_%u + "
+				    "generated_step_size_%u\n",
+				    a, a, a);
+		stringBuilderPrintf(&sb,
+				    "    }\n    return generated_accumulator_%u"
+				    "\n}\n\n",
+				    a);
+	}
+	in->lex_long_source = stringBuilderFinish(sb);
+	in->lex_long_source_length = strlen(in->lex_long_source);
+}
+
+static void generateSmallFile(benchInputs *in, u64 *random, memory *m)
+{
+	stringBuilder sb = stringBuilderCreate(&m->general);
+	for (u32 i = 0; i < SMALL_FILE_FUNCTION_COUNT; i++) {
+		u32 a = benchRandom(random) % 1000;
+		stringBuilderPrintf(&sb, "func function_%u {\n", i);
+		stringBuilderPrintf(&sb, "\tcounter := %u\n", a);
+		stringBuilderPrintf(&sb,
+				    "\tvalues := [counter, counter + 1]\n");
+		stringBuilderPrintf(&sb, "\twhile counter != %u {\n", a * 2);
+		stringBuilderPrintf(&sb, "\t\tset counter = counter + 1\n");
+		stringBuilderPrintf(&sb, "\t\tif counter >= values[1] "
+					 "{ return counter * 2 }\n");
+		stringBuilderPrintf(&sb, "\t}\n\treturn values[0]\n}\n\n");
+	}
+	in->small_source = stringBuilderFinish(sb);
+	in->small_source_length = strlen(in->small_source);
+
+	in->small_tokens = lex(in->small_source, in->small_source_length,
+			       &in->diagnostics, m);
+	internFile(&in->small_tokens, in->small_source, m);
+	in->small_interner = intern(&in->small_tokens, &in->small_source, 1, m);
+	in->small_ast = parse(in->small_tokens, &in->diagnostics, m);
+	in->small_hir = lower(in->small_ast, &in->diagnostics, m);
+	assert(in->diagnostics.count == 0);
+}
+
+// blocks nested inside blocks, around an expression
+// nested just as deeply inside parentheses
+static void generateDeepFile(benchInputs *in, memory *m)
+{
+	stringBuilder sb = stringBuilderCreate(&m->general);
+	stringBuilderPrintf(&sb, "func deep {\n\tcounter := 0\n");
+	for (u32 i = 0; i < DEEP_FILE_NESTING_DEPTH; i++)
+		stringBuilderPrintf(&sb, "while counter != %u { ", i);
+	stringBuilderPrintf(&sb, "set counter = ");
+	for (u32 i = 0; i < DEEP_FILE_NESTING_DEPTH; i++)
+		stringBuilderPrintf(&sb, "(%u + ", i);
+	stringBuilderPrintf(&sb, "counter");
+	for (u32 i = 0; i < DEEP_FILE_NESTING_DEPTH; i++)
+		stringBuilderPrintf(&sb, ")");
+	for (u32 i = 0; i < DEEP_FILE_NESTING_DEPTH; i++)
+		stringBuilderPrintf(&sb, " }");
+	stringBuilderPrintf(&sb, "\n\treturn counter\n}\n");
+	in->deep_source = stringBuilderFinish(sb);
+	in->deep_source_length = strlen(in->deep_source);
+
+	in->deep_tokens = lex(in->deep_source, in->deep_source_length,
+			      &in->diagnostics, m);
+	internFile(&in->deep_tokens, in->deep_source, m);
+	in->deep_interner = intern(&in->deep_tokens, &in->deep_source, 1, m);
+	in->deep_ast = parse(in->deep_tokens, &in->diagnostics, m);
+	in->deep_hir = lower(in->deep_ast, &in->diagnostics, m);
+	assert(in->diagnostics.count == 0);
+	in->deep_span_index = hirSpanIndexBuild(in->deep_hir, m);
+}
+
+static void sortTimes(u64 *times, usize count)
+{
+	for (usize i = 1; i < count; i++) {
+		u64 time = times[i];
+		usize j = i;
+		for (; j > 0 && times[j - 1] > time; j--)
+			times[j] = times[j - 1];
+		times[j] = time;
+	}
+}
+
+static void runBenchmark(const char *name, benchmark f, benchInputs *in,
+			 memory *m)
+{
+	u64 times[BENCH_RUN_COUNT];
+	benchWork work = { 0 };
+
+	for (usize i = 0; i < BENCH_RUN_COUNT + 1; i++) {
+		bumpMark temp_mark = bumpCreateMark(&m->temp);
+		bumpMark general_mark = bumpCreateMark(&m->general);
+
+		u64 start = nowNanoseconds();
+		work = f(in, m);
+		u64 end = nowNanoseconds();
+
+		bumpClearToMark(&m->general, general_mark);
+		bumpClearToMark(&m->temp, temp_mark);
+
+		if (i > 0)
+			times[i - 1] = end - start;
+	}
+
+	sortTimes(times, BENCH_RUN_COUNT);
+	double min = (double)times[0];
+	double median = (double)times[BENCH_RUN_COUNT / 2];
+
+	// bytes per nanosecond is GB/s, so scale it up to MB/s
+	printf("%-20s %10.2f %10.2f %10.1f %10.1f\n", name, min / work.ops,
+	       median / work.ops, work.bytes / min * 1000,
+	       work.bytes / median * 1000);
+}
+
+void runBenchmarks(void)
+{
+	memory m = {
+		.temp = allocateFromOs(BENCH_MEMORY_SIZE),
+		.general = allocateFromOs(BENCH_MEMORY_SIZE),
+	};
+
+	projectSpec project = { 0 };
+	setCurrentProject(project);
+	setCurrentFile(0);
+
+	benchInputs in = { 0 };
+	in.diagnostics = diagnosticsStorageCreate(&m.general);
+	in.worker_count = numCpus();
+
+	u64 random = 0x9e3779b97f4a7c15;
+	generateIdentifiers(&in, &random, &m.general);
+	generateInternSource(&in, &random, &m);
+	generateLexSource(&in, &random, &m);
+	generateLexLongSource(&in, &random, &m);
+	generateSmallFile(&in, &random, &m);
+	generateDeepFile(&in, &m);
+
+	printf("%-20s %10s %10s %10s %10s\n", "", "min", "median", "max",
+	       "median");
+	printf("%-20s %10s %10s %10s %10s\n", "", "ns/op", "ns/op", "MB/s",
+	       "MB/s");
+
+	runBenchmark("bump churn", benchBumpChurn, &in, &m);
+	runBenchmark("arrayBuilderPush", benchArrayBuilderPush, &in, &m);
+	runBenchmark("fxhash", benchFxhash, &in, &m);
+	runBenchmark("wyhash", benchWyhash, &in, &m);
+	runBenchmark("intern", benchIntern, &in, &m);
+	runBenchmark("lex", benchLex, &in, &m);
+	runBenchmark("lex (long names)", benchLexLongIdentifiers, &in, &m);
+	runBenchmark("parse", benchParse, &in, &m);
+	runBenchmark("parse (parallel)", benchParseParallel, &in, &m);
+	runBenchmark("parse (incremental)", benchParseIncremental, &in, &m);
+	runBenchmark("parse (small file)", benchParseSmallFile, &in, &m);
+	runBenchmark("lower (small file)", benchLowerSmallFile, &in, &m);
+	runBenchmark("codegen (small file)", benchCodegenSmallFile, &in, &m);
+	runBenchmark("parse (deep file)", benchParseDeepFile, &in, &m);
+	runBenchmark("lower (deep file)", benchLowerDeepFile, &in, &m);
+	runBenchmark("codegen (deep file)", benchCodegenDeepFile, &in, &m);
+	runBenchmark("span index build", benchSpanIndexBuild, &in, &m);
+	runBenchmark("span lookup", benchSpanLookup, &in, &m);
+	runBenchmark("span lookup (deep)", benchSpanLookupDeepFile, &in, &m);
+
+	freeToOs(in.incremental_memory.temp);
+	freeToOs(in.incremental_memory.general);
+	freeToOs(m.temp);
+	freeToOs(m.general);
+}
@@ -92,6 +92,19 @@ void *bumpCopyArray_(bump *b, void *buffer, usize count, usize element_size)
 	return ptr;
 }
 
+void *bumpGrowArray_(bump *b, void *buffer, usize count, usize new_count,
+		     usize element_size)
+{
+	assert(new_count >= count);
+	void *ptr = bumpAllocateArray_(b, new_count, element_size);
+
+	// Arrays which haven’t been allocated yet may be null.
+	if (count > 0)
+		memcpy(ptr, buffer, element_size * count);
+
+	return ptr;
+}
+
 bump bumpCreateSubBump(bump *b, usize size)
 {
 	assert(b->array_builder_nesting_level == 0);
@@ -131,6 +144,12 @@ char *bumpPrintfV(bump *b, const char *fmt, va_list ap)
 
 arrayBuilder bumpStartArrayBuilder(bump *b, usize element_size)
 {
+	// As with bumpAllocateArray, we align to the element size.
+	// We can only do this for the outermost builder, though,
+	// since padding would otherwise end up inside the enclosing array.
+	if (b->array_builder_nesting_level == 0)
+		bumpAlignTo(b, element_size);
+
 	b->array_builder_nesting_level++;
 	return (arrayBuilder){
 		.b = b,
@@ -145,6 +164,18 @@ void arrayBuilderPush(arrayBuilder *ab, void *element)
 	memcpy(ptr, element, ab->element_size);
 }
 
+// Returns space for count more elements, which the caller fills in.
+void *arrayBuilderExtend(arrayBuilder *ab, usize count)
+{
+	return bumpConsumeSpace(ab->b, ab->element_size * count);
+}
+
+void arrayBuilderPushArray(arrayBuilder *ab, void *elements, usize count)
+{
+	void *ptr = bumpConsumeSpace(ab->b, ab->element_size * count);
+	memcpy(ptr, elements, ab->element_size * count);
+}
+
 void *bumpFinishArrayBuilder(bump *b, arrayBuilder *ab)
 {
 	assert(b == ab->b);
@@ -1,5 +1,42 @@
 #include "minic.h"
 
+enum { MIN_WORK_CAPACITY = 64 };
+
+// What’s left to do for a node.
+// Nodes are walked with an explicit stack of these
+// rather than by recursion, so that deeply nested code
+// can’t overflow the C stack.
+typedef enum codegenStep {
+	STEP_ALLOCATE_TEMPORARIES,
+	STEP_ALLOCATE_ARRAY_TEMPORARY,
+
+	STEP_GEN,
+	STEP_GEN_ADDRESS,
+	STEP_PUSH,
+	STEP_LOAD,
+	STEP_STORE,
+	STEP_BINARY_OPERATION,
+	STEP_INDEX_ADDRESS,
+	STEP_ARRAY_ELEMENT_ADDRESS,
+	STEP_ARRAY_ADDRESS,
+	STEP_IF_CONDITION,
+	STEP_IF_ELSE,
+	STEP_IF_END,
+	STEP_WHILE_CONDITION,
+	STEP_WHILE_END,
+	STEP_RETURN,
+} codegenStep;
+
+typedef struct codegenWork {
+	hirNode node;
+
+	// an array element’s index, a type for STEP_STORE,
+	// or the ID of an if statement’s or while loop’s labels
+	u32 value;
+
+	codegenStep step;
+} codegenWork;
+
 typedef struct ctx {
 	hirRoot hir;
 	u32 id;
@@ -8,8 +45,36 @@ typedef struct ctx {
 	diagnosticsStorage *diagnostics;
 	u32 *local_offsets;
 	u32 *temporary_offsets;
+
+	// The work stack is moved to a larger allocation if it fills up.
+	bump *temp;
+	codegenWork *work;
+	u32 work_count;
+	u32 work_capacity;
 } ctx;
 
+static void pushWork(ctx *c, codegenStep step, hirNode node, u32 value)
+{
+	if (c->work_count == c->work_capacity) {
+		u32 capacity = c->work_capacity * 2;
+		c->work = bumpGrowArray(codegenWork, c->temp, c->work,
+					c->work_count, capacity);
+		c->work_capacity = capacity;
+	}
+
+	c->work[c->work_count++] = (codegenWork){
+		.node = node,
+		.value = value,
+		.step = step,
+	};
+}
+
+static codegenWork popWork(ctx *c)
+{
+	assert(c->work_count > 0);
+	return c->work[--c->work_count];
+}
+
 static u32 roundUpTo(u32 x, u32 multiple_of)
 {
 	return ((x + multiple_of - 1) / multiple_of) * multiple_of;
@@ -17,7 +82,7 @@ static u32 roundUpTo(u32 x, u32 multiple_of)
 
 static void allocateLocals(ctx *c, u32 *offset, hirFunction function)
 {
-	for (u16 i = 0; i < function.locals_count; i++) {
+	for (u32 i = 0; i < function.locals_count; i++) {
 		hirLocal local = hirLocalMake(function.locals_start.index + i);
 		hirType type = hirGetLocalType(c->hir, local);
 
@@ -33,10 +98,9 @@ static void allocateLocals(ctx *c, u32 *offset, hirFunction function)
 	}
 }
 
-static void allocateTemporaries(ctx *c, u32 *offset, hirNode node)
+// Children are pushed in reverse so that they’re visited in order.
+static void pushChildTemporaries(ctx *c, hirNode node)
 {
-	c->temporary_offsets[node.index] = -1;
-
 	switch (hirGetNodeKind(c->hir, node)) {
 	case HIR_MISSING:
 	case HIR_INT_LITERAL:
@@ -46,28 +110,28 @@ static void allocateTemporaries(ctx *c, u32 *offset, hirNode node)
 	case HIR_BINARY_OPERATION: {
 		hirBinaryOperation binary_operation =
 			hirGetNode(c->hir, node).binary_operation;
-		allocateTemporaries(c, offset, binary_operation.lhs);
-		allocateTemporaries(c, offset, binary_operation.rhs);
+		pushWork(c, STEP_ALLOCATE_TEMPORARIES, binary_operation.rhs, 0);
+		pushWork(c, STEP_ALLOCATE_TEMPORARIES, binary_operation.lhs, 0);
 		break;
 	}
 
 	case HIR_ADDRESS_OF: {
 		hirAddressOf address_of = hirGetNode(c->hir, node).address_of;
-		allocateTemporaries(c, offset, address_of.value);
+		pushWork(c, STEP_ALLOCATE_TEMPORARIES, address_of.value, 0);
 		break;
 	}
 
 	case HIR_DEREFERENCE: {
 		hirDereference dereference =
 			hirGetNode(c->hir, node).dereference;
-		allocateTemporaries(c, offset, dereference.value);
+		pushWork(c, STEP_ALLOCATE_TEMPORARIES, dereference.value, 0);
 		break;
 	}
 
 	case HIR_INDEX: {
 		hirIndex index = hirGetNode(c->hir, node).index;
-		allocateTemporaries(c, offset, index.index);
-		allocateTemporaries(c, offset, index.array);
+		pushWork(c, STEP_ALLOCATE_TEMPORARIES, index.array, 0);
+		pushWork(c, STEP_ALLOCATE_TEMPORARIES, index.index, 0);
 		break;
 	}
 
@@ -75,66 +139,87 @@ static void allocateTemporaries(ctx *c, u32 *offset, hirNode node)
 		hirArrayLiteral array_literal =
 			hirGetNode(c->hir, node).array_literal;
 
-		for (u16 i = 0; i < array_literal.count; i++) {
-			hirNode n = hirNodeMake(array_literal.start.index + i);
-			allocateTemporaries(c, offset, n);
+		// The array itself comes after all of its elements.
+		pushWork(c, STEP_ALLOCATE_ARRAY_TEMPORARY, node, 0);
+		for (u32 i = array_literal.count; i > 0; i--) {
+			hirNode n = hirNodeMake(array_literal.start.index + i -
+						1);
+			pushWork(c, STEP_ALLOCATE_TEMPORARIES, n, 0);
 		}
-
-		hirType type = hirGetNodeType(c->hir, node);
-
-		*offset = roundUpTo(*offset, hirTypeAlign(c->hir, type));
-
-		// We step forward by the size of the type
-		// *before* storing this local’s offset
-		// because the offset is actually negative
-		// (from the stack top).
-		*offset += hirTypeSize(c->hir, type);
-
-		c->temporary_offsets[node.index] = *offset;
-
 		break;
 	}
 
 	case HIR_ASSIGN: {
 		hirAssign assign = hirGetNode(c->hir, node).assign;
-		allocateTemporaries(c, offset, assign.lhs);
-		allocateTemporaries(c, offset, assign.rhs);
+		pushWork(c, STEP_ALLOCATE_TEMPORARIES, assign.rhs, 0);
+		pushWork(c, STEP_ALLOCATE_TEMPORARIES, assign.lhs, 0);
 		break;
 	}
 
 	case HIR_IF: {
 		hirIf if_ = hirGetNode(c->hir, node).if_;
-		allocateTemporaries(c, offset, if_.condition);
-		allocateTemporaries(c, offset, if_.true_block);
-		if (if_.false_block.index != (u16)-1)
-			allocateTemporaries(c, offset, if_.false_block);
+		if (if_.false_block.index != (u32)-1)
+			pushWork(c, STEP_ALLOCATE_TEMPORARIES, if_.false_block,
+				 0);
+		pushWork(c, STEP_ALLOCATE_TEMPORARIES, if_.true_block, 0);
+		pushWork(c, STEP_ALLOCATE_TEMPORARIES, if_.condition, 0);
 		break;
 	}
 
 	case HIR_WHILE: {
 		hirWhile while_ = hirGetNode(c->hir, node).while_;
-		allocateTemporaries(c, offset, while_.condition);
-		allocateTemporaries(c, offset, while_.true_block);
+		pushWork(c, STEP_ALLOCATE_TEMPORARIES, while_.true_block, 0);
+		pushWork(c, STEP_ALLOCATE_TEMPORARIES, while_.condition, 0);
 		break;
 	}
 
 	case HIR_RETURN: {
 		hirReturn retrn = hirGetNode(c->hir, node).retrn;
-		allocateTemporaries(c, offset, retrn.value);
+		pushWork(c, STEP_ALLOCATE_TEMPORARIES, retrn.value, 0);
 		break;
 	}
 
 	case HIR_BLOCK: {
 		hirBlock block = hirGetNode(c->hir, node).block;
-		for (u16 i = 0; i < block.count; i++) {
-			hirNode n = hirNodeMake(block.start.index + i);
-			allocateTemporaries(c, offset, n);
+		for (u32 i = block.count; i > 0; i--) {
+			hirNode n = hirNodeMake(block.start.index + i - 1);
+			pushWork(c, STEP_ALLOCATE_TEMPORARIES, n, 0);
 		}
 		break;
 	}
 	}
 }
 
+static void allocateTemporaries(ctx *c, u32 *offset, hirNode root)
+{
+	u32 base = c->work_count;
+	pushWork(c, STEP_ALLOCATE_TEMPORARIES, root, 0);
+
+	while (c->work_count > base) {
+		codegenWork work = popWork(c);
+		hirNode node = work.node;
+
+		if (work.step == STEP_ALLOCATE_TEMPORARIES) {
+			c->temporary_offsets[node.index] = -1;
+			pushChildTemporaries(c, node);
+			continue;
+		}
+
+		assert(work.step == STEP_ALLOCATE_ARRAY_TEMPORARY);
+		hirType type = hirGetNodeType(c->hir, node);
+
+		*offset = roundUpTo(*offset, hirTypeAlign(c->hir, type));
+
+		// We step forward by the size of the type
+		// *before* storing this local’s offset
+		// because the offset is actually negative
+		// (from the stack top).
+		*offset += hirTypeSize(c->hir, type);
+
+		c->temporary_offsets[node.index] = *offset;
+	}
+}
+
 static u32 calculateStackLayout(ctx *c, hirFunction function)
 {
 	u32 offset = 0;
@@ -229,8 +314,7 @@ static void store(ctx *c, hirType type)
 	}
 }
 
-static void gen(ctx *c, hirNode node);
-
+// Steps are pushed in reverse so that they run in order.
 static void genAddress(ctx *c, hirNode node)
 {
 	switch (hirGetNodeKind(c->hir, node)) {
@@ -244,20 +328,16 @@ static void genAddress(ctx *c, hirNode node)
 	case HIR_DEREFERENCE: {
 		hirDereference dereference =
 			hirGetNode(c->hir, node).dereference;
-		gen(c, dereference.value);
+		pushWork(c, STEP_GEN, dereference.value, 0);
 		break;
 	}
 
 	case HIR_INDEX: {
 		hirIndex index = hirGetNode(c->hir, node).index;
-		u32 size = hirTypeSize(c->hir, hirGetNodeType(c->hir, node));
-		genAddress(c, index.array);
-		push(c);
-		gen(c, index.index);
-		instruction(c, "mov", "x9, #%d", size);
-		instruction(c, "mul", "x8, x8, x9");
-		pop(c, "x9");
-		instruction(c, "add", "x8, x8, x9");
+		pushWork(c, STEP_INDEX_ADDRESS, node, 0);
+		pushWork(c, STEP_GEN, index.index, 0);
+		pushWork(c, STEP_PUSH, node, 0);
+		pushWork(c, STEP_GEN_ADDRESS, index.array, 0);
 		break;
 	}
 
@@ -268,25 +348,17 @@ static void genAddress(ctx *c, hirNode node)
 		assert(hirGetTypeKind(c->hir, type) == HIR_TYPE_ARRAY);
 		hirType child_type = hirGetType(c->hir, type).array.child_type;
 
-		u32 offset = c->temporary_offsets[node.index];
-
-		for (u16 i = 0; i < array_literal.count; i++) {
-			hirNode n = hirNodeMake(array_literal.start.index + i);
+		pushWork(c, STEP_ARRAY_ADDRESS, node, 0);
+		for (u32 i = array_literal.count; i > 0; i--) {
+			hirNode n = hirNodeMake(array_literal.start.index + i -
+						1);
 			assert(hirGetNodeType(c->hir, n).index ==
 			       child_type.index);
 
-			u32 element_offset =
-				offset - hirTypeSize(c->hir, child_type) * i;
-			instruction(c, "sub", "x8, fp, #%u", element_offset);
-			push(c);
-
-			gen(c, n);
-
-			store(c, child_type);
+			pushWork(c, STEP_STORE, n, child_type.index);
+			pushWork(c, STEP_GEN, n, 0);
+			pushWork(c, STEP_ARRAY_ELEMENT_ADDRESS, node, i - 1);
 		}
-
-		instruction(c, "sub", "x8, fp, #%u", offset);
-
 		break;
 	}
 
@@ -298,7 +370,7 @@ static void genAddress(ctx *c, hirNode node)
 	}
 }
 
-static void gen(ctx *c, hirNode node)
+static void genNode(ctx *c, hirNode node)
 {
 	switch (hirGetNodeKind(c->hir, node)) {
 	case HIR_MISSING:
@@ -312,89 +384,46 @@ static void gen(ctx *c, hirNode node)
 	}
 
 	case HIR_VARIABLE:
-		genAddress(c, node);
-		load(c, hirGetNodeType(c->hir, node));
+	case HIR_INDEX:
+		pushWork(c, STEP_LOAD, node, 0);
+		pushWork(c, STEP_GEN_ADDRESS, node, 0);
 		break;
 
 	case HIR_BINARY_OPERATION: {
 		hirBinaryOperation binary_operation =
 			hirGetNode(c->hir, node).binary_operation;
-		gen(c, binary_operation.lhs);
-		push(c);
-		gen(c, binary_operation.rhs);
-		instruction(c, "mov", "x9, x8");
-		pop(c, "x8");
-		switch (binary_operation.op) {
-		case AST_BINOP_ADD:
-			instruction(c, "add", "x8, x8, x9");
-			break;
-		case AST_BINOP_SUBTRACT:
-			instruction(c, "sub", "x8, x8, x9");
-			break;
-		case AST_BINOP_MULTIPLY:
-			instruction(c, "mul", "x8, x8, x9");
-			break;
-		case AST_BINOP_DIVIDE:
-			instruction(c, "sdiv", "x8, x8, x9");
-			break;
-		case AST_BINOP_EQUAL:
-			instruction(c, "cmp", "x8, x9");
-			instruction(c, "cset", "x8, eq");
-			break;
-		case AST_BINOP_NOT_EQUAL:
-			instruction(c, "cmp", "x8, x9");
-			instruction(c, "cset", "x8, ne");
-			break;
-		case AST_BINOP_LESS_THAN:
-			instruction(c, "cmp", "x8, x9");
-			instruction(c, "cset", "x8, lt");
-			break;
-		case AST_BINOP_LESS_THAN_EQUAL:
-			instruction(c, "cmp", "x8, x9");
-			instruction(c, "cset", "x8, le");
-			break;
-		case AST_BINOP_GREATER_THAN:
-			instruction(c, "cmp", "x8, x9");
-			instruction(c, "cset", "x8, gt");
-			break;
-		case AST_BINOP_GREATER_THAN_EQUAL:
-			instruction(c, "cmp", "x8, x9");
-			instruction(c, "cset", "x8, ge");
-			break;
-		}
+		pushWork(c, STEP_BINARY_OPERATION, node, 0);
+		pushWork(c, STEP_GEN, binary_operation.rhs, 0);
+		pushWork(c, STEP_PUSH, node, 0);
+		pushWork(c, STEP_GEN, binary_operation.lhs, 0);
 		break;
 	}
 
 	case HIR_ADDRESS_OF: {
 		hirAddressOf address_of = hirGetNode(c->hir, node).address_of;
-		genAddress(c, address_of.value);
+		pushWork(c, STEP_GEN_ADDRESS, address_of.value, 0);
 		break;
 	}
 
 	case HIR_DEREFERENCE: {
 		hirDereference dereference =
 			hirGetNode(c->hir, node).dereference;
-		gen(c, dereference.value);
-		load(c, hirGetNodeType(c->hir, node));
+		pushWork(c, STEP_LOAD, node, 0);
+		pushWork(c, STEP_GEN, dereference.value, 0);
 		break;
 	}
 
-	case HIR_INDEX:
-		genAddress(c, node);
-		load(c, hirGetNodeType(c->hir, node));
-		break;
-
 	case HIR_ARRAY_LITERAL:
-		genAddress(c, node);
+		pushWork(c, STEP_GEN_ADDRESS, node, 0);
 		break;
 
 	case HIR_ASSIGN: {
 		hirAssign assign = hirGetNode(c->hir, node).assign;
 		hirType type = hirGetNodeType(c->hir, assign.rhs);
-		genAddress(c, assign.lhs);
-		push(c);
-		gen(c, assign.rhs);
-		store(c, type);
+		pushWork(c, STEP_STORE, node, type.index);
+		pushWork(c, STEP_GEN, assign.rhs, 0);
+		pushWork(c, STEP_PUSH, node, 0);
+		pushWork(c, STEP_GEN_ADDRESS, assign.lhs, 0);
 		break;
 	}
 
@@ -402,14 +431,13 @@ static void gen(ctx *c, hirNode node)
 		hirIf if_ = hirGetNode(c->hir, node).if_;
 		u32 i = c->id;
 		c->id++;
-		gen(c, if_.condition);
-		instruction(c, "cbz", "x8, ELSE_%s_%u", c->function_name, i);
-		gen(c, if_.true_block);
-		instruction(c, "b", "ENDIF_%s_%u", c->function_name, i);
-		label(c, "ELSE_%s_%u", c->function_name, i);
-		if (if_.false_block.index != (u16)-1)
-			gen(c, if_.false_block);
-		label(c, "ENDIF_%s_%u", c->function_name, i);
+		pushWork(c, STEP_IF_END, node, i);
+		if (if_.false_block.index != (u32)-1)
+			pushWork(c, STEP_GEN, if_.false_block, 0);
+		pushWork(c, STEP_IF_ELSE, node, i);
+		pushWork(c, STEP_GEN, if_.true_block, 0);
+		pushWork(c, STEP_IF_CONDITION, node, i);
+		pushWork(c, STEP_GEN, if_.condition, 0);
 		break;
 	}
 
@@ -418,34 +446,180 @@ static void gen(ctx *c, hirNode node)
 		u32 i = c->id;
 		c->id++;
 		label(c, "WHILE_%s_%u", c->function_name, i);
-		gen(c, while_.condition);
-		instruction(c, "cbz", "x8, ENDWHILE_%s_%u", c->function_name,
-			    i);
-		gen(c, while_.true_block);
-		instruction(c, "b", "WHILE_%s_%u", c->function_name, i);
-		label(c, "ENDWHILE_%s_%u", c->function_name, i);
+		pushWork(c, STEP_WHILE_END, node, i);
+		pushWork(c, STEP_GEN, while_.true_block, 0);
+		pushWork(c, STEP_WHILE_CONDITION, node, i);
+		pushWork(c, STEP_GEN, while_.condition, 0);
 		break;
 	}
 
 	case HIR_RETURN: {
 		hirReturn retrn = hirGetNode(c->hir, node).retrn;
-		gen(c, retrn.value);
-		instruction(c, "mov", "x0, x8");
-		instruction(c, "b", "RETURN_%s", c->function_name);
+		pushWork(c, STEP_RETURN, node, 0);
+		pushWork(c, STEP_GEN, retrn.value, 0);
 		break;
 	}
 
 	case HIR_BLOCK: {
 		hirBlock block = hirGetNode(c->hir, node).block;
-		for (u16 i = 0; i < block.count; i++) {
-			hirNode n = hirNodeMake(block.start.index + i);
-			gen(c, n);
+		for (u32 i = block.count; i > 0; i--) {
+			hirNode n = hirNodeMake(block.start.index + i - 1);
+			pushWork(c, STEP_GEN, n, 0);
 		}
 		break;
 	}
 	}
 }
 
+static void genBinaryOperation(ctx *c, hirNode node)
+{
+	hirBinaryOperation binary_operation =
+		hirGetNode(c->hir, node).binary_operation;
+	instruction(c, "mov", "x9, x8");
+	pop(c, "x8");
+	switch (binary_operation.op) {
+	case AST_BINOP_ADD:
+		instruction(c, "add", "x8, x8, x9");
+		break;
+	case AST_BINOP_SUBTRACT:
+		instruction(c, "sub", "x8, x8, x9");
+		break;
+	case AST_BINOP_MULTIPLY:
+		instruction(c, "mul", "x8, x8, x9");
+		break;
+	case AST_BINOP_DIVIDE:
+		instruction(c, "sdiv", "x8, x8, x9");
+		break;
+	case AST_BINOP_EQUAL:
+		instruction(c, "cmp", "x8, x9");
+		instruction(c, "cset", "x8, eq");
+		break;
+	case AST_BINOP_NOT_EQUAL:
+		instruction(c, "cmp", "x8, x9");
+		instruction(c, "cset", "x8, ne");
+		break;
+	case AST_BINOP_LESS_THAN:
+		instruction(c, "cmp", "x8, x9");
+		instruction(c, "cset", "x8, lt");
+		break;
+	case AST_BINOP_LESS_THAN_EQUAL:
+		instruction(c, "cmp", "x8, x9");
+		instruction(c, "cset", "x8, le");
+		break;
+	case AST_BINOP_GREATER_THAN:
+		instruction(c, "cmp", "x8, x9");
+		instruction(c, "cset", "x8, gt");
+		break;
+	case AST_BINOP_GREATER_THAN_EQUAL:
+		instruction(c, "cmp", "x8, x9");
+		instruction(c, "cset", "x8, ge");
+		break;
+	}
+}
+
+static void gen(ctx *c, hirNode root)
+{
+	u32 base = c->work_count;
+	pushWork(c, STEP_GEN, root, 0);
+
+	while (c->work_count > base) {
+		codegenWork work = popWork(c);
+		hirNode node = work.node;
+
+		switch (work.step) {
+		case STEP_GEN:
+			genNode(c, node);
+			break;
+
+		case STEP_GEN_ADDRESS:
+			genAddress(c, node);
+			break;
+
+		case STEP_PUSH:
+			push(c);
+			break;
+
+		case STEP_LOAD:
+			load(c, hirGetNodeType(c->hir, node));
+			break;
+
+		case STEP_STORE:
+			store(c, hirTypeMake(work.value));
+			break;
+
+		case STEP_BINARY_OPERATION:
+			genBinaryOperation(c, node);
+			break;
+
+		case STEP_INDEX_ADDRESS: {
+			u32 size = hirTypeSize(c->hir,
+					       hirGetNodeType(c->hir, node));
+			instruction(c, "mov", "x9, #%d", size);
+			instruction(c, "mul", "x8, x8, x9");
+			pop(c, "x9");
+			instruction(c, "add", "x8, x8, x9");
+			break;
+		}
+
+		case STEP_ARRAY_ELEMENT_ADDRESS: {
+			hirType type = hirGetNodeType(c->hir, node);
+			hirType child_type =
+				hirGetType(c->hir, type).array.child_type;
+			u32 offset = c->temporary_offsets[node.index];
+			u32 element_offset =
+				offset -
+				hirTypeSize(c->hir, child_type) * work.value;
+			instruction(c, "sub", "x8, fp, #%u", element_offset);
+			push(c);
+			break;
+		}
+
+		case STEP_ARRAY_ADDRESS: {
+			u32 offset = c->temporary_offsets[node.index];
+			instruction(c, "sub", "x8, fp, #%u", offset);
+			break;
+		}
+
+		case STEP_IF_CONDITION:
+			instruction(c, "cbz", "x8, ELSE_%s_%u",
+				    c->function_name, work.value);
+			break;
+
+		case STEP_IF_ELSE:
+			instruction(c, "b", "ENDIF_%s_%u", c->function_name,
+				    work.value);
+			label(c, "ELSE_%s_%u", c->function_name, work.value);
+			break;
+
+		case STEP_IF_END:
+			label(c, "ENDIF_%s_%u", c->function_name, work.value);
+			break;
+
+		case STEP_WHILE_CONDITION:
+			instruction(c, "cbz", "x8, ENDWHILE_%s_%u",
+				    c->function_name, work.value);
+			break;
+
+		case STEP_WHILE_END:
+			instruction(c, "b", "WHILE_%s_%u", c->function_name,
+				    work.value);
+			label(c, "ENDWHILE_%s_%u", c->function_name,
+			      work.value);
+			break;
+
+		case STEP_RETURN:
+			instruction(c, "mov", "x0, x8");
+			instruction(c, "b", "RETURN_%s", c->function_name);
+			break;
+
+		case STEP_ALLOCATE_TEMPORARIES:
+		case STEP_ALLOCATE_ARRAY_TEMPORARY:
+			internalError("stack layout step during codegen");
+			break;
+		}
+	}
+}
+
 static void genPrologue(ctx *c, u32 stack_size)
 {
 	// allocate 16 bytes on the stack for the frame record
@@ -490,9 +664,13 @@ void codegen(hirRoot hir, interner interner, stringBuilder *assembly,
 			bumpAllocateArray(u32, &m->temp, hir.local_count),
 		.temporary_offsets =
 			bumpAllocateArray(u32, &m->temp, hir.node_count),
+		.temp = &m->temp,
+		.work = bumpAllocateArray(codegenWork, &m->temp,
+					  MIN_WORK_CAPACITY),
+		.work_capacity = MIN_WORK_CAPACITY,
 	};
 
-	for (u16 i = 0; i < hir.function_count; i++) {
+	for (u32 i = 0; i < hir.function_count; i++) {
 		hirFunction function = hir.functions[i];
 
 		c.function_name = internerLookup(interner, function.name);
@@ -17,30 +17,30 @@ diagnosticsStorage diagnosticsStorageCreate(bump *b)
 	};
 }
 
+diagnosticsStorage diagnosticsStorageCreateForFile(bump *b, u16 file)
+{
+	diagnosticsStorage diagnostics = diagnosticsStorageCreate(b);
+	diagnostics.single_file = true;
+	diagnostics.file = file;
+	return diagnostics;
+}
+
 // 0-indexed
 typedef struct lineColumn {
 	u32 line;
 	u32 column;
 } lineColumn;
 
-static lineColumn offsetToLineColumn(u32 offset, char *content)
+static lineColumn offsetToLineColumn(u32 offset, lineTable lines,
+				     usize length)
 {
-	lineColumn lc = {
-		.line = 0,
-		.column = 0,
-	};
-
-	for (u32 i = 0; i < offset; i++) {
-		assert(content[i] != 0);
-		lc.column++;
-
-		if (content[i] == '\n') {
-			lc.line++;
-			lc.column = 0;
-		}
-	}
+	assert(offset <= length);
 
-	return lc;
+	u32 line = lineTableLine(lines, offset);
+	return (lineColumn){
+		.line = line,
+		.column = offset - lineTableLineStart(lines, line),
+	};
 }
 
 void diagnosticsStorageRecord(diagnosticsStorage *diagnostics,
@@ -62,7 +62,8 @@ void diagnosticsStorageRecordV(diagnosticsStorage *diagnostics,
 	char *message = bumpPrintfV(&diagnostics->all_messages, fmt, ap);
 	u32 message_start = message - (char *)diagnostics->all_messages.top;
 
-	diagnostics->files[diagnostics->count] = currentFile();
+	diagnostics->files[diagnostics->count] =
+		diagnostics->single_file ? diagnostics->file : currentFile();
 	diagnostics->spans[diagnostics->count] = span;
 	diagnostics->severities[diagnostics->count] = severity;
 	diagnostics->message_starts[diagnostics->count] = message_start;
@@ -75,11 +76,13 @@ void diagnosticsStorageShow(diagnosticsStorage diagnostics, stringBuilder *sb)
 		u16 file = diagnostics.files[i];
 		char *file_name = currentProject().file_names[file];
 		char *file_content = currentProject().file_contents[file];
+		usize file_length = currentProject().file_lengths[file];
+		lineTable file_lines = currentProject().file_lines[file];
 
 		span span = diagnostics.spans[i];
 
 		lineColumn start_lc =
-			offsetToLineColumn(span.start, file_content);
+			offsetToLineColumn(span.start, file_lines, file_length);
 		stringBuilderPrintf(sb, "\033[90m%s:%u:%u:\033[m ", file_name,
 				    start_lc.line + 1, start_lc.column + 1);
 
@@ -100,26 +103,16 @@ void diagnosticsStorageShow(diagnosticsStorage diagnostics, stringBuilder *sb)
 			(char *)(diagnostics.all_messages.top + message_start);
 		stringBuilderPrintf(sb, "%s\033[m\n", message);
 
-		usize line_start = 0;
-		usize line_end = 0;
-
-		for (usize j = 0; file_content[j] != 0; j++) {
-			if (file_content[j] != '\n')
-				continue;
-
-			if (j < span.start) {
-				line_start = j;
-				line_start++; // get rid of leading newline
-			}
-
-			if (j >= span.end - 1) {
-				line_end = j;
-				break;
-			}
-		}
+		// Show every line the span touches.
+		u32 last = span.end > span.start ? span.end - 1 : span.start;
+		u32 end_line = lineTableLine(file_lines, last);
+		usize line_start =
+			lineTableLineStart(file_lines, start_lc.line);
+		usize line_end =
+			lineTableLineEnd(file_lines, end_line, file_length);
 
 		usize line_length = line_end - line_start;
-		stringBuilderPrintf(sb, "%.*s\n", line_length,
+		stringBuilderPrintf(sb, "%.*s\n", (int)line_length,
 				    &file_content[line_start]);
 
 		stringBuilderPrintf(sb, "\033[92m");
@@ -128,7 +121,7 @@ void diagnosticsStorageShow(diagnosticsStorage diagnostics, stringBuilder *sb)
 				stringBuilderPrintf(sb, "^");
 			else if (j >= span.start && j < span.end)
 				stringBuilderPrintf(sb, "~");
-			else if (file_content[j] == '\t')
+			else if (j < file_length && file_content[j] == '\t')
 				stringBuilderPrintf(sb, "\t");
 			else
 				stringBuilderPrintf(sb, " ");
@@ -163,3 +156,87 @@ void diagnosticsStorageDebug(diagnosticsStorage diagnostics, stringBuilder *sb)
 		stringBuilderPrintf(sb, "%s\n", message);
 	}
 }
+
+static char *diagnosticMessage(diagnosticsStorage diagnostics, u16 i)
+{
+	return (char *)(diagnostics.all_messages.top +
+			diagnostics.message_starts[i]);
+}
+
+bool diagnosticsStorageEqual(diagnosticsStorage a, diagnosticsStorage b)
+{
+	if (a.count != b.count)
+		return false;
+
+	for (u16 i = 0; i < a.count; i++) {
+		if (a.files[i] != b.files[i] ||
+		    a.spans[i].start != b.spans[i].start ||
+		    a.spans[i].end != b.spans[i].end ||
+		    a.severities[i] != b.severities[i])
+			return false;
+
+		if (strcmp(diagnosticMessage(a, i), diagnosticMessage(b, i)) !=
+		    0)
+			return false;
+	}
+
+	return true;
+}
+
+// Brings diagnostics about the current file up to date after an edit
+// which relexed the old bytes in replaced and shifted those after it
+// by delta. Entries from old_count on were recorded for the new content,
+// and take the place of the old ones inside replaced.
+void diagnosticsStorageApplyEdit(diagnosticsStorage *diagnostics,
+				 u16 old_count, span replaced, i64 delta,
+				 bump *temp)
+{
+	u16 count = diagnostics->count;
+	u16 file = diagnostics->single_file ? diagnostics->file : currentFile();
+
+	u16 *files = bumpCopyArray(u16, temp, diagnostics->files, count);
+	span *spans = bumpCopyArray(span, temp, diagnostics->spans, count);
+	severity *severities =
+		bumpCopyArray(severity, temp, diagnostics->severities, count);
+	u32 *message_starts =
+		bumpCopyArray(u32, temp, diagnostics->message_starts, count);
+
+	diagnostics->count = 0;
+
+	// before the edit, or about other files
+	for (u16 i = 0; i < old_count; i++) {
+		if (files[i] == file && spans[i].start >= replaced.start)
+			continue;
+		diagnostics->files[diagnostics->count] = files[i];
+		diagnostics->spans[diagnostics->count] = spans[i];
+		diagnostics->severities[diagnostics->count] = severities[i];
+		diagnostics->message_starts[diagnostics->count] =
+			message_starts[i];
+		diagnostics->count++;
+	}
+
+	// freshly recorded
+	for (u16 i = old_count; i < count; i++) {
+		diagnostics->files[diagnostics->count] = files[i];
+		diagnostics->spans[diagnostics->count] = spans[i];
+		diagnostics->severities[diagnostics->count] = severities[i];
+		diagnostics->message_starts[diagnostics->count] =
+			message_starts[i];
+		diagnostics->count++;
+	}
+
+	// after the edit, shifted into place
+	for (u16 i = 0; i < old_count; i++) {
+		if (files[i] != file || spans[i].start < replaced.end)
+			continue;
+		diagnostics->files[diagnostics->count] = files[i];
+		diagnostics->spans[diagnostics->count] = (span){
+			.start = (u32)((i64)spans[i].start + delta),
+			.end = (u32)((i64)spans[i].end + delta),
+		};
+		diagnostics->severities[diagnostics->count] = severities[i];
+		diagnostics->message_starts[diagnostics->count] =
+			message_starts[i];
+		diagnostics->count++;
+	}
+}
@@ -1,116 +1,1018 @@
 #include "minic.h"
 
-typedef struct ctx {
-	u64 *slot_hashes;
-	u32 *slot_lengths;
-	char **slot_ptrs;
-	identifierId *slot_ids;
+// A table of a file’s own identifiers, indexed by their hashes.
+// It starts out small and doubles whenever it gets too full,
+// so that it stays as small as the number of distinct identifiers allows.
+// The slot count is always a power of two,
+// which lets us find slots with a mask rather than a division.
+typedef struct localTable {
+	// local ID + 1, or 0 if the slot is empty
+	u32 *slots;
 	usize slot_count;
-	char **identifier_contents;
-	identifierId ident_id;
-} ctx;
 
-static void processToken(tokenBuffer *buf, char *contents, usize token, ctx *c,
-			 memory *m)
+	// indexed by local ID
+	span *spans;
+	u64 *hashes;
+	u32 count;
+} localTable;
+
+enum { LOCAL_TABLE_INITIAL_SLOTS = 256 };
+
+static void localTableInsertSlot(localTable *t, u32 local)
 {
-	assert(buf->identifier_ids[token].raw == (u32)-1);
+	usize mask = t->slot_count - 1;
+	usize slot = t->hashes[local] & mask;
+	while (t->slots[slot] != 0)
+		slot = (slot + 1) & mask;
+	t->slots[slot] = local + 1;
+}
 
-	if (buf->kinds[token] != TOK_IDENTIFIER)
-		return;
+static void localTableGrow(localTable *t, bump *b)
+{
+	t->slot_count *= 2;
+	t->slots = bumpAllocateArray(u32, b, t->slot_count);
+	memset(t->slots, 0, t->slot_count * sizeof(u32));
+
+	for (u32 local = 0; local < t->count; local++)
+		localTableInsertSlot(t, local);
+}
 
-	span span = buf->spans[token];
+static u32 localTableIntern(localTable *t, char *content, span span, u64 hash,
+			    bump *b)
+{
+	char *text = content + span.start;
 	u32 length = span.end - span.start;
-	char *ptr = contents + span.start;
-	u64 hash = fxhash((u8 *)ptr, length);
-
-	usize slot_index = hash % c->slot_count;
-	while (c->slot_ptrs[slot_index] != NULL) {
-		if (c->slot_hashes[slot_index] != hash)
-			goto no_match;
-
-		if (c->slot_lengths[slot_index] != length)
-			goto no_match;
-
-		if (memcmp(ptr, c->slot_ptrs[slot_index], length) != 0)
-			goto no_match;
-
-		// We’ve compared every possible source of equality we could,
-		// and everything has come up as a match.
-		// Thus, we have a slot which contains the current identifier.
-		// We link the current token to
-		// the identifier ID of the current slot,
-		// and then we’re done with this token!
-		buf->identifier_ids[token] = c->slot_ids[slot_index];
-		return;
 
-	no_match:
-		slot_index++;
-		slot_index %= c->slot_count;
+	usize mask = t->slot_count - 1;
+	usize slot = hash & mask;
+	while (t->slots[slot] != 0) {
+		u32 existing = t->slots[slot] - 1;
+		if (t->hashes[existing] == hash) {
+			u32 start = t->spans[existing].start;
+			u32 existing_length = t->spans[existing].end - start;
+			if (existing_length == length &&
+			    memcmp(content + start, text, length) == 0)
+				return existing;
+		}
+
+		slot = (slot + 1) & mask;
+	}
+
+	u32 local = t->count;
+	t->count++;
+	t->spans[local] = span;
+	t->hashes[local] = hash;
+	t->slots[slot] = local + 1;
+
+	// Keep the load factor at or below 0.75, as in the global table.
+	if (t->count * 4 > t->slot_count * 3)
+		localTableGrow(t, b);
+
+	return local;
+}
+
+// Most identifiers recur many times within a file,
+// so interning them against a small table of the file’s own first
+// means the project-wide table only sees each one once per file.
+void internFile(tokenBuffer *buf, char *content, memory *m)
+{
+	bumpMark mark = bumpCreateMark(&m->temp);
+
+	// Every identifier could be distinct,
+	// so the per-ID arrays are sized for that.
+	localTable t = {
+		.slots = bumpAllocateArray(u32, &m->temp,
+					   LOCAL_TABLE_INITIAL_SLOTS),
+		.slot_count = LOCAL_TABLE_INITIAL_SLOTS,
+		.spans = bumpAllocateArray(span, &m->temp,
+					   buf->identifier_count),
+		.hashes = bumpAllocateArray(u64, &m->temp,
+					    buf->identifier_count),
+	};
+	memset(t.slots, 0, t.slot_count * sizeof(u32));
+
+	// The lexer stores hashes only for identifiers,
+	// in the same order as the identifiers appear in the buffer.
+	usize identifier = 0;
+
+	for (usize token = 0; token < buf->count; token++) {
+		assert(buf->identifier_ids[token].raw == (u32)-1);
+
+		if (buf->kinds[token] != TOK_IDENTIFIER)
+			continue;
+
+		u64 hash = buf->identifier_hashes[identifier];
+		identifier++;
+
+		span span = tokenBufferSpan(*buf, token);
+		buf->identifier_ids[token].raw =
+			localTableIntern(&t, content, span, hash, &m->temp);
 	}
 
-	// At this point we’ve exited the loop because we found an empty slot
-	// and along the way didn’t stumble upon a slot
-	// which matches the current token.
+	assert(identifier == buf->identifier_count);
 
-	c->slot_hashes[slot_index] = hash;
-	c->slot_lengths[slot_index] = length;
-	c->slot_ptrs[slot_index] = ptr;
-	c->slot_ids[slot_index] = c->ident_id;
+	buf->local_identifier_spans =
+		bumpCopyArray(span, &m->general, t.spans, t.count);
+	buf->local_identifier_hashes =
+		bumpCopyArray(u64, &m->general, t.hashes, t.count);
+	buf->local_identifier_count = t.count;
+
+	bumpClearToMark(&m->temp, mark);
+}
+
+// The project-wide table used by intern().
+// Every file is known up front,
+// so it’s sized once for all of them and never grows.
+typedef struct internTable {
+	// identifier ID + 1, or 0 if the slot is empty
+	u32 *slots;
+	usize slot_count;
 
-	buf->identifier_ids[token] = c->ident_id;
+	// indexed by identifier ID
+	internedString *identifiers;
+	u64 *hashes;
+	usize count;
 
-	char *s = bumpCopyArray(char, &m->general, ptr, length + 1);
+	char *strings;
+	usize string_bytes;
+} internTable;
+
+static identifierId internTableInsert(internTable *t, char *text, u32 length,
+				      u64 hash)
+{
+	usize slot = hash % t->slot_count;
+	while (t->slots[slot] != 0) {
+		u32 existing = t->slots[slot] - 1;
+		internedString s = t->identifiers[existing];
+		if (t->hashes[existing] == hash && s.length == length &&
+		    memcmp(t->strings + s.offset, text, length) == 0)
+			return (identifierId){ .raw = existing };
+
+		slot++;
+		slot %= t->slot_count;
+	}
+
+	u32 id = t->count;
+	t->count++;
+
+	char *s = t->strings + t->string_bytes;
+	memcpy(s, text, length);
 	s[length] = 0;
-	c->identifier_contents[c->ident_id.raw] = s;
 
-	c->ident_id.raw++;
+	t->identifiers[id] = (internedString){
+		.offset = t->string_bytes,
+		.length = length,
+	};
+	t->hashes[id] = hash;
+	t->string_bytes += length + 1;
+	t->slots[slot] = id + 1;
+
+	return (identifierId){ .raw = id };
 }
 
+// Every identifier sits some distance past the slot its hash points at,
+// and a lookup for it has to walk over everything in between,
+// so the table itself tells us how long lookups are.
+static internerProbeStats internTableProbeStats(internTable t)
+{
+	internerProbeStats stats = { .slot_count = t.slot_count };
+
+	for (usize slot = 0; slot < t.slot_count; slot++) {
+		if (t.slots[slot] == 0)
+			continue;
+
+		usize home = t.hashes[t.slots[slot] - 1] % t.slot_count;
+		usize distance = slot >= home ? slot - home
+					      : slot + t.slot_count - home;
+		usize probe_length = distance + 1;
+
+		stats.total_probe_length += probe_length;
+		if (probe_length > stats.max_probe_length)
+			stats.max_probe_length = probe_length;
+	}
+
+	return stats;
+}
+
+// Buffers must have been interned with internFile first.
+// Afterwards their tokens refer to IDs in the returned interner.
 interner intern(tokenBuffer *bufs, char **contents, usize buf_count, memory *m)
 {
+	// Identifiers shared between files are only discovered while merging,
+	// so we size everything for the worst case:
+	// that no two files have an identifier in common.
 	usize identifier_count = 0;
-	for (u16 i = 0; i < buf_count; i++)
-		for (usize j = 0; j < bufs[i].count; j++)
-			if (bufs[i].kinds[j] == TOK_IDENTIFIER)
-				identifier_count++;
+	usize string_capacity = 0;
+	for (usize i = 0; i < buf_count; i++) {
+		tokenBuffer buf = bufs[i];
+		identifier_count += buf.local_identifier_count;
+		for (usize local = 0; local < buf.local_identifier_count;
+		     local++) {
+			span span = buf.local_identifier_spans[local];
+			string_capacity += span.end - span.start;
+		}
+	}
+	string_capacity += identifier_count; // for null terminators
 
-	// We allocate enough space to have a load factor of 0.75
-	// once the map has been populated.
-	usize slot_count = identifier_count * 4 / 3;
+	// Strings are found by 32-bit offsets into the pool.
+	assert(string_capacity <= (u32)-1);
 
 	bumpMark mark = bumpCreateMark(&m->temp);
 
-	ctx c = {
-		.slot_hashes = bumpAllocateArray(u64, &m->temp, slot_count),
-		.slot_lengths = bumpAllocateArray(u32, &m->temp, slot_count),
-		.slot_ptrs = bumpAllocateArray(char *, &m->temp, slot_count),
-		.slot_ids =
-			bumpAllocateArray(identifierId, &m->temp, slot_count),
+	// We allocate enough space to have a load factor of 0.75
+	// once the map has been populated.
+	// There’s always at least one slot so probing terminates.
+	usize slot_count = identifier_count * 4 / 3 + 1;
+	internTable t = {
+		.slots = bumpAllocateArray(u32, &m->temp, slot_count),
 		.slot_count = slot_count,
-		.identifier_contents = bumpAllocateArray(char *, &m->general,
-							 identifier_count),
-		.ident_id = { .raw = 0 },
+		.identifiers = bumpAllocateArray(internedString, &m->general,
+						 identifier_count),
+		.hashes = bumpAllocateArray(u64, &m->temp, identifier_count),
+		.strings = bumpAllocateArray(char, &m->general,
+					     string_capacity),
 	};
+	memset(t.slots, 0, slot_count * sizeof(u32));
+
+	for (usize i = 0; i < buf_count; i++) {
+		tokenBuffer *buf = &bufs[i];
+		identifierId *global_ids = bumpAllocateArray(
+			identifierId, &m->temp, buf->local_identifier_count);
 
-	// Zero everything out so that each ptr starts out as null.
-	memset(c.slot_ptrs, 0, slot_count * sizeof(char *));
+		for (usize local = 0; local < buf->local_identifier_count;
+		     local++) {
+			span span = buf->local_identifier_spans[local];
+			global_ids[local] = internTableInsert(
+				&t, contents[i] + span.start,
+				span.end - span.start,
+				buf->local_identifier_hashes[local]);
+		}
 
-	for (usize buf_index = 0; buf_index < buf_count; buf_index++) {
-		tokenBuffer *buf = &bufs[buf_index];
-		for (usize token = 0; token < buf->count; token++)
-			processToken(buf, contents[buf_index], token, &c, m);
+		for (usize token = 0; token < buf->count; token++) {
+			if (buf->kinds[token] != TOK_IDENTIFIER)
+				continue;
+			u32 local = buf->identifier_ids[token].raw;
+			assert(local < buf->local_identifier_count);
+			buf->identifier_ids[token] = global_ids[local];
+		}
 	}
 
+	interner result = {
+		.strings = t.strings,
+		.identifiers = t.identifiers,
+		.count = t.count,
+		.string_bytes = t.string_bytes,
+		.probes = internTableProbeStats(t),
+	};
+
 	// We have no use for the map any longer now that
 	// IDs have been allocated and contents have been copied.
 	bumpClearToMark(&m->temp, mark);
 
+	return result;
+}
+
+enum {
+	// Pages are only committed once touched,
+	// so these are limits rather than what actually gets used.
+	GROWABLE_STRING_MEMORY_SIZE = 1024 * 1024 * 1024,
+	GROWABLE_IDENTIFIER_MEMORY_SIZE = 256 * 1024 * 1024,
+	GROWABLE_HASH_MEMORY_SIZE = 256 * 1024 * 1024,
+	GROWABLE_SLOT_MEMORY_SIZE = 256 * 1024 * 1024,
+	GROWABLE_USED_MEMORY_SIZE = 32 * 1024 * 1024,
+
+	GROWABLE_INITIAL_SLOTS = 1024,
+};
+
+static void growableInternerAllocateSlots(growableInterner *gi,
+					  usize slot_count)
+{
+	bumpClearToMark(&gi->slot_memory, gi->slots_mark);
+	gi->slots = bumpAllocateArray(u32, &gi->slot_memory, slot_count);
+	gi->slot_count = slot_count;
+	memset(gi->slots, 0, slot_count * sizeof(u32));
+}
+
+// Builders hold on to their bump by pointer,
+// so the interner lives at a fixed address rather than being passed around.
+growableInterner *growableInternerCreate(bump *b)
+{
+	growableInterner *gi = bumpAllocateArray(growableInterner, b, 1);
+	*gi = (growableInterner){
+		.string_memory = allocateFromOs(GROWABLE_STRING_MEMORY_SIZE),
+		.identifier_memory =
+			allocateFromOs(GROWABLE_IDENTIFIER_MEMORY_SIZE),
+		.hash_memory = allocateFromOs(GROWABLE_HASH_MEMORY_SIZE),
+		.slot_memory = allocateFromOs(GROWABLE_SLOT_MEMORY_SIZE),
+		.used_memory = allocateFromOs(GROWABLE_USED_MEMORY_SIZE),
+	};
+
+	// Each array gets a bump of its own
+	// so its builder can stay open for as long as the interner lives.
+	gi->strings = bumpStartArrayBuilder(&gi->string_memory, sizeof(char));
+	gi->identifiers = bumpStartArrayBuilder(&gi->identifier_memory,
+						sizeof(internedString));
+	gi->hashes = bumpStartArrayBuilder(&gi->hash_memory, sizeof(u64));
+	gi->used = bumpStartArrayBuilder(&gi->used_memory, sizeof(bool));
+
+	gi->slots_mark = bumpCreateMark(&gi->slot_memory);
+	growableInternerAllocateSlots(gi, GROWABLE_INITIAL_SLOTS);
+
+	return gi;
+}
+
+void growableInternerDestroy(growableInterner *gi)
+{
+	freeToOs(gi->string_memory);
+	freeToOs(gi->identifier_memory);
+	freeToOs(gi->hash_memory);
+	freeToOs(gi->slot_memory);
+	freeToOs(gi->used_memory);
+	*gi = (growableInterner){ 0 };
+}
+
+// Since the slot count is always a power of two,
+// slots are found with a mask rather than a division.
+static usize growableInternerFindSlot(growableInterner *gi, char *text,
+				      u32 length, u64 hash)
+{
+	char *strings = gi->strings.top;
+	internedString *identifiers = gi->identifiers.top;
+	u64 *hashes = gi->hashes.top;
+
+	usize mask = gi->slot_count - 1;
+	usize slot = hash & mask;
+	while (gi->slots[slot] != 0) {
+		u32 existing = gi->slots[slot] - 1;
+		internedString s = identifiers[existing];
+		if (hashes[existing] == hash && s.length == length &&
+		    memcmp(strings + s.offset, text, length) == 0)
+			break;
+		slot = (slot + 1) & mask;
+	}
+
+	return slot;
+}
+
+// Doubles the table and reinserts every identifier from its stored hash;
+// the old table is thrown away beforehand,
+// so only one table ever takes up memory.
+static void growableInternerGrow(growableInterner *gi)
+{
+	u64 *hashes = gi->hashes.top;
+
+	growableInternerAllocateSlots(gi, gi->slot_count * 2);
+
+	usize mask = gi->slot_count - 1;
+	for (u32 id = 0; id < gi->count; id++) {
+		usize slot = hashes[id] & mask;
+		while (gi->slots[slot] != 0)
+			slot = (slot + 1) & mask;
+		gi->slots[slot] = id + 1;
+	}
+}
+
+static identifierId growableInternerUse(growableInterner *gi, u32 id)
+{
+	bool *used = gi->used.top;
+	if (!used[id]) {
+		used[id] = true;
+		gi->used_count++;
+	}
+	return (identifierId){ .raw = id };
+}
+
+// Puts a new identifier in the empty slot found for it,
+// without growing the table.
+static identifierId growableInternerAppend(growableInterner *gi, usize slot,
+					   char *text, u32 length, u64 hash)
+{
+	assert(gi->slots[slot] == 0);
+
+	// Strings are found by 32-bit offsets into the pool.
+	assert(gi->string_bytes + length + 1 <= (u32)-1);
+
+	u32 id = gi->count;
+	internedString s = { .offset = gi->string_bytes, .length = length };
+	char terminator = 0;
+	bool used = true;
+	arrayBuilderPushArray(&gi->strings, text, length);
+	arrayBuilderPush(&gi->strings, &terminator);
+	arrayBuilderPush(&gi->identifiers, &s);
+	arrayBuilderPush(&gi->hashes, &hash);
+	arrayBuilderPush(&gi->used, &used);
+	gi->string_bytes += length + 1;
+	gi->count++;
+	gi->used_count++;
+	gi->slots[slot] = id + 1;
+
+	return (identifierId){ .raw = id };
+}
+
+identifierId growableInternerInsert(growableInterner *gi, char *text,
+				    u32 length, u64 hash)
+{
+	usize slot = growableInternerFindSlot(gi, text, length, hash);
+	if (gi->slots[slot] != 0)
+		return growableInternerUse(gi, gi->slots[slot] - 1);
+
+	identifierId id = growableInternerAppend(gi, slot, text, length, hash);
+
+	// Keep the load factor at or below 0.75, as in the other tables.
+	if (gi->count * 4 > gi->slot_count * 3)
+		growableInternerGrow(gi);
+
+	return id;
+}
+
+enum {
+	// Files with fewer distinct identifiers than this
+	// aren’t worth starting threads to insert them for.
+	MIN_PARALLEL_INSERT_IDENTIFIERS = 16 * 1024,
+
+	// Rewriting a token is much cheaper than inserting an identifier,
+	// so it takes a lot more of them to be worth a thread.
+	MIN_PARALLEL_REWRITE_TOKENS = 256 * 1024,
+};
+
+// A file’s identifiers are inserted on several threads in two passes.
+// First each thread takes a share of the file’s local IDs
+// and looks each one up, claiming an empty slot if it isn’t found
+// by CAS-ing the local ID into a table of claims alongside the slots.
+// The slots themselves are only read while the threads run,
+// and a file’s local identifiers are all distinct,
+// so a claimed slot can never hold what a thread is looking for
+// and it just moves on to the next, without waiting for anyone.
+// Then the calling thread hands out IDs in order of local ID,
+// which is the order identifiers first appear in the file,
+// so they come out dense and exactly as serial insertion would number them.
+typedef struct insertJob {
+	growableInterner *gi;
+	_Atomic(u32) *claims;
+	tokenBuffer *buf;
+	char *content;
+	u32 start;
+	u32 end;
+
+	// indexed by local ID: the slot it was found in or claimed
+	u32 *found_slots;
+} insertJob;
+
+static void *insertJobRun(void *arg)
+{
+	insertJob *job = arg;
+	growableInterner *gi = job->gi;
+	tokenBuffer *buf = job->buf;
+	char *strings = gi->strings.top;
+	internedString *identifiers = gi->identifiers.top;
+	u64 *hashes = gi->hashes.top;
+	usize mask = gi->slot_count - 1;
+
+	for (u32 local = job->start; local < job->end; local++) {
+		span span = buf->local_identifier_spans[local];
+		char *text = job->content + span.start;
+		u32 length = span.end - span.start;
+		u64 hash = buf->local_identifier_hashes[local];
+
+		usize slot = hash & mask;
+		for (;; slot = (slot + 1) & mask) {
+			if (gi->slots[slot] != 0) {
+				u32 existing = gi->slots[slot] - 1;
+				internedString s = identifiers[existing];
+				if (hashes[existing] == hash &&
+				    s.length == length &&
+				    memcmp(strings + s.offset, text, length) ==
+					    0)
+					break;
+				continue;
+			}
+
+			// Nothing is read through a claim until every thread
+			// is joined, so there’s nothing to order it against.
+			u32 unclaimed = 0;
+			if (atomic_compare_exchange_strong_explicit(
+				    &job->claims[slot], &unclaimed, local + 1,
+				    memory_order_relaxed, memory_order_relaxed))
+				break;
+		}
+
+		job->found_slots[local] = slot;
+	}
+
+	return NULL;
+}
+
+// Fills in global_ids, indexed by local ID, using job_count threads.
+static void growableInternerInsertInJobs(growableInterner *gi,
+					 tokenBuffer *buf, char *content,
+					 usize job_count,
+					 identifierId *global_ids, memory *m)
+{
+	u32 local_count = buf->local_identifier_count;
+
+	// Every slot a thread finds has to stay put until IDs are handed out,
+	// so the table is grown up front as though every identifier were new.
+	while ((gi->count + local_count) * 4 > gi->slot_count * 3)
+		growableInternerGrow(gi);
+
+	bumpMark mark = bumpCreateMark(&m->temp);
+	_Atomic(u32) *claims =
+		bumpAllocateArray(_Atomic(u32), &m->temp, gi->slot_count);
+	for (usize slot = 0; slot < gi->slot_count; slot++)
+		atomic_init(&claims[slot], 0);
+	u32 *found_slots = bumpAllocateArray(u32, &m->temp, local_count);
+
+	insertJob *jobs = bumpAllocateArray(insertJob, &m->temp, job_count);
+	for (usize i = 0; i < job_count; i++) {
+		jobs[i] = (insertJob){
+			.gi = gi,
+			.claims = claims,
+			.buf = buf,
+			.content = content,
+			.start = (u32)(local_count * i / job_count),
+			.end = (u32)(local_count * (i + 1) / job_count),
+			.found_slots = found_slots,
+		};
+	}
+
+	pthread_t *threads =
+		bumpAllocateArray(pthread_t, &m->temp, job_count);
+
+	// The current thread takes care of the first share itself.
+	for (usize i = 1; i < job_count; i++)
+		pthread_create(&threads[i], NULL, insertJobRun, &jobs[i]);
+	insertJobRun(&jobs[0]);
+	for (usize i = 1; i < job_count; i++)
+		pthread_join(threads[i], NULL);
+
+	// A slot which was empty before the threads ran
+	// can only have been claimed by one identifier.
+	for (u32 local = 0; local < local_count; local++) {
+		usize slot = found_slots[local];
+		if (gi->slots[slot] != 0) {
+			global_ids[local] =
+				growableInternerUse(gi, gi->slots[slot] - 1);
+			continue;
+		}
+
+		assert(atomic_load_explicit(&claims[slot],
+					    memory_order_relaxed) == local + 1);
+		span span = buf->local_identifier_spans[local];
+		global_ids[local] = growableInternerAppend(
+			gi, slot, content + span.start, span.end - span.start,
+			buf->local_identifier_hashes[local]);
+	}
+
+	bumpClearToMark(&m->temp, mark);
+}
+
+// Tokens are rewritten from local to global IDs
+// by threads taking a range of the buffer each.
+typedef struct rewriteJob {
+	tokenBuffer *buf;
+	identifierId *global_ids;
+	usize start;
+	usize end;
+} rewriteJob;
+
+static void *rewriteJobRun(void *arg)
+{
+	rewriteJob *job = arg;
+	tokenBuffer *buf = job->buf;
+
+	for (usize token = job->start; token < job->end; token++) {
+		if (buf->kinds[token] != TOK_IDENTIFIER)
+			continue;
+		u32 local = buf->identifier_ids[token].raw;
+		assert(local < buf->local_identifier_count);
+		buf->identifier_ids[token] = job->global_ids[local];
+	}
+
+	return NULL;
+}
+
+static void rewriteIdentifiers(tokenBuffer *buf, identifierId *global_ids,
+			       usize job_count, memory *m)
+{
+	if (job_count > buf->count)
+		job_count = buf->count;
+
+	if (job_count <= 1) {
+		rewriteJobRun(&(rewriteJob){
+			.buf = buf,
+			.global_ids = global_ids,
+			.start = 0,
+			.end = buf->count,
+		});
+		return;
+	}
+
+	bumpMark mark = bumpCreateMark(&m->temp);
+	rewriteJob *jobs = bumpAllocateArray(rewriteJob, &m->temp, job_count);
+	for (usize i = 0; i < job_count; i++) {
+		jobs[i] = (rewriteJob){
+			.buf = buf,
+			.global_ids = global_ids,
+			.start = buf->count * i / job_count,
+			.end = buf->count * (i + 1) / job_count,
+		};
+	}
+
+	pthread_t *threads =
+		bumpAllocateArray(pthread_t, &m->temp, job_count);
+
+	// The current thread takes care of the first range itself.
+	for (usize i = 1; i < job_count; i++)
+		pthread_create(&threads[i], NULL, rewriteJobRun, &jobs[i]);
+	rewriteJobRun(&jobs[0]);
+	for (usize i = 1; i < job_count; i++)
+		pthread_join(threads[i], NULL);
+
+	bumpClearToMark(&m->temp, mark);
+}
+
+static void growableInternerAddFileInJobs(growableInterner *gi,
+					  tokenBuffer *buf, char *content,
+					  usize insert_job_count,
+					  usize rewrite_job_count, memory *m)
+{
+	bumpMark mark = bumpCreateMark(&m->temp);
+	identifierId *global_ids = bumpAllocateArray(
+		identifierId, &m->temp, buf->local_identifier_count);
+
+	if (insert_job_count > buf->local_identifier_count)
+		insert_job_count = buf->local_identifier_count;
+
+	if (insert_job_count > 1) {
+		growableInternerInsertInJobs(gi, buf, content, insert_job_count,
+					     global_ids, m);
+	} else {
+		for (usize local = 0; local < buf->local_identifier_count;
+		     local++) {
+			span span = buf->local_identifier_spans[local];
+			u64 hash = buf->local_identifier_hashes[local];
+			global_ids[local] = growableInternerInsert(
+				gi, content + span.start, span.end - span.start,
+				hash);
+		}
+	}
+
+	rewriteIdentifiers(buf, global_ids, rewrite_job_count, m);
+	bumpClearToMark(&m->temp, mark);
+}
+
+// The buffer must have been interned with internFile first.
+// Afterwards its tokens refer to IDs in the growable interner.
+void growableInternerAddFile(growableInterner *gi, tokenBuffer *buf,
+			     char *content, u32 worker_count, memory *m)
+{
+	usize insert_job_count =
+		buf->local_identifier_count / MIN_PARALLEL_INSERT_IDENTIFIERS;
+	if (insert_job_count > worker_count)
+		insert_job_count = worker_count;
+
+	usize rewrite_job_count = buf->count / MIN_PARALLEL_REWRITE_TOKENS;
+	if (rewrite_job_count > worker_count)
+		rewrite_job_count = worker_count;
+
+	growableInternerAddFileInJobs(gi, buf, content, insert_job_count,
+				      rewrite_job_count, m);
+}
+
+// Inserting and rewriting on several threads must give every token
+// the same ID as doing it serially, whether its identifier is new or not,
+// even for files far too small to be worth it.
+void growableInternerCheckParallel(tokenBuffer buf, char *content, memory *m)
+{
+	bumpMark mark = bumpCreateMark(&m->general);
+
+	tokenBuffer serial = buf;
+	serial.identifier_ids = bumpCopyArray(identifierId, &m->general,
+					      buf.identifier_ids, buf.count);
+	internFile(&serial, content, m);
+	tokenBuffer parallel = serial;
+	parallel.identifier_ids =
+		bumpCopyArray(identifierId, &m->general,
+			      serial.identifier_ids, serial.count);
+
+	growableInterner *serial_identifiers =
+		growableInternerCreate(&m->general);
+	growableInterner *parallel_identifiers =
+		growableInternerCreate(&m->general);
+
+	// Every other identifier is already known, in reverse order,
+	// so that neither the old IDs nor the new ones follow local IDs.
+	for (u32 i = serial.local_identifier_count; i > 0; i--) {
+		u32 local = i - 1;
+		if (local % 2 != 0)
+			continue;
+		span span = serial.local_identifier_spans[local];
+		u64 hash = serial.local_identifier_hashes[local];
+		identifierId a = growableInternerInsert(
+			serial_identifiers, content + span.start,
+			span.end - span.start, hash);
+		identifierId b = growableInternerInsert(
+			parallel_identifiers, content + span.start,
+			span.end - span.start, hash);
+		assert(a.raw == b.raw);
+	}
+
+	growableInternerAddFileInJobs(serial_identifiers, &serial, content, 1,
+				      1, m);
+	growableInternerAddFileInJobs(parallel_identifiers, &parallel,
+				      content, 3, 3, m);
+
+	assert(memcmp(serial.identifier_ids, parallel.identifier_ids,
+		      serial.count * sizeof(identifierId)) == 0);
+
+	interner a = growableInternerView(serial_identifiers);
+	interner b = growableInternerView(parallel_identifiers);
+	assert(a.count == b.count);
+	assert(a.string_bytes == b.string_bytes);
+	assert(memcmp(a.identifiers, b.identifiers,
+		      a.count * sizeof(internedString)) == 0);
+	assert(memcmp(a.strings, b.strings, a.string_bytes) == 0);
+	assert(serial_identifiers->used_count ==
+	       parallel_identifiers->used_count);
+
+	growableInternerDestroy(serial_identifiers);
+	growableInternerDestroy(parallel_identifiers);
+	bumpClearToMark(&m->general, mark);
+}
+
+// The arrays never move,
+// so a view stays valid as more files are added
+// (though it won’t know about identifiers added after it was taken).
+interner growableInternerView(growableInterner *gi)
+{
 	return (interner){
-		.contents = c.identifier_contents,
+		.strings = gi->strings.top,
+		.identifiers = gi->identifiers.top,
+		.count = gi->count,
+		.string_bytes = gi->string_bytes,
+	};
+}
+
+// This walks the whole table, so it’s best left until every file is in.
+internerProbeStats growableInternerProbeStats(growableInterner *gi)
+{
+	u64 *hashes = gi->hashes.top;
+	internerProbeStats stats = { .slot_count = gi->slot_count };
+
+	usize mask = gi->slot_count - 1;
+	for (usize slot = 0; slot < gi->slot_count; slot++) {
+		if (gi->slots[slot] == 0)
+			continue;
+
+		usize home = hashes[gi->slots[slot] - 1] & mask;
+		usize probe_length = ((slot - home) & mask) + 1;
+		stats.total_probe_length += probe_length;
+		if (probe_length > stats.max_probe_length)
+			stats.max_probe_length = probe_length;
+	}
+
+	return stats;
+}
+
+// The cache is a header followed by the identifier table, the hashes
+// and finally the string pool, all exactly as they are laid out in memory.
+// It’s only ever read back on the machine that wrote it,
+// so we don’t bother with byte order.
+typedef struct identifierCacheHeader {
+	u32 magic;
+	u32 version;
+	u64 count;
+	u64 string_bytes;
+	u64 generation;
+} identifierCacheHeader;
+
+enum {
+	IDENTIFIER_CACHE_MAGIC = 0x4449434d, // “MCID”
+
+	// Bump this whenever the layout or the identifier hash changes.
+	IDENTIFIER_CACHE_VERSION = 3,
+};
+
+static usize identifierCacheSize(identifierCacheHeader header)
+{
+	return sizeof(header) + header.count * sizeof(internedString) +
+	       header.count * sizeof(u64) + header.string_bytes;
+}
+
+// Anything could have happened to the file since we wrote it,
+// so we check that loading it can’t send lookups out of bounds
+// and that every string is NUL-terminated and matches its hash.
+static bool identifierCacheValid(identifierCacheHeader header,
+				 usize file_size, internedString *identifiers,
+				 u64 *hashes, char *strings)
+{
+	if (header.magic != IDENTIFIER_CACHE_MAGIC ||
+	    header.version != IDENTIFIER_CACHE_VERSION)
+		return false;
+
+	// checked separately so the sizes below can’t overflow
+	if (header.count > GROWABLE_USED_MEMORY_SIZE ||
+	    header.string_bytes > GROWABLE_STRING_MEMORY_SIZE)
+		return false;
+
+	if (file_size != identifierCacheSize(header))
+		return false;
+
+	for (usize id = 0; id < header.count; id++) {
+		internedString s = identifiers[id];
+		if ((u64)s.offset + s.length >= header.string_bytes)
+			return false;
+		if (strings[s.offset + s.length] != 0)
+			return false;
+		if (wyhash((u8 *)strings + s.offset, s.length) != hashes[id])
+			return false;
+	}
+
+	return true;
+}
+
+// The slot table isn’t saved, since it’s cheap to rebuild from the hashes
+// and a damaged one could send lookups anywhere.
+// Returns false, leaving the table empty again,
+// if two identifiers have the same text.
+static bool growableInternerRebuildSlots(growableInterner *gi, usize count,
+					 internedString *identifiers,
+					 u64 *hashes, char *strings)
+{
+	usize slot_count = GROWABLE_INITIAL_SLOTS;
+	while (count * 4 > slot_count * 3)
+		slot_count *= 2;
+	growableInternerAllocateSlots(gi, slot_count);
+
+	usize mask = slot_count - 1;
+	for (u32 id = 0; id < count; id++) {
+		internedString s = identifiers[id];
+		usize slot = hashes[id] & mask;
+		while (gi->slots[slot] != 0) {
+			internedString other = identifiers[gi->slots[slot] - 1];
+			if (other.length == s.length &&
+			    memcmp(strings + other.offset, strings + s.offset,
+				   s.length) == 0) {
+				growableInternerAllocateSlots(
+					gi, GROWABLE_INITIAL_SLOTS);
+				return false;
+			}
+			slot = (slot + 1) & mask;
+		}
+		gi->slots[slot] = id + 1;
+	}
+
+	return true;
+}
+
+bool growableInternerLoad(growableInterner *gi, const char *path)
+{
+	assert(gi->count == 0);
+
+	int fd = open(path, O_RDONLY);
+	if (fd == -1)
+		return false;
+
+	struct stat stat;
+	if (fstat(fd, &stat) == -1 ||
+	    (usize)stat.st_size < sizeof(identifierCacheHeader)) {
+		close(fd);
+		return false;
+	}
+	usize size = stat.st_size;
+
+	u8 *file = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (file == MAP_FAILED)
+		return false;
+
+	identifierCacheHeader header = { 0 };
+	memcpy(&header, file, sizeof(header));
+
+	u8 *identifiers = file + sizeof(header);
+	u8 *hashes = identifiers + header.count * sizeof(internedString);
+	u8 *strings = hashes + header.count * sizeof(u64);
+
+	bool valid = identifierCacheValid(header, size,
+					  (internedString *)identifiers,
+					  (u64 *)hashes, (char *)strings);
+
+	if (valid)
+		valid = growableInternerRebuildSlots(
+			gi, header.count, (internedString *)identifiers,
+			(u64 *)hashes, (char *)strings);
+
+	// The arrays have to keep growing as new identifiers turn up,
+	// so they’re copied out of the mapping rather than used in place.
+	if (valid) {
+		arrayBuilderPushArray(&gi->identifiers, identifiers,
+				      header.count);
+		arrayBuilderPushArray(&gi->hashes, hashes, header.count);
+		arrayBuilderPushArray(&gi->strings, strings,
+				      header.string_bytes);
+		bool *used = arrayBuilderExtend(&gi->used, header.count);
+		memset(used, 0, header.count * sizeof(bool));
+		gi->count = header.count;
+		gi->string_bytes = header.string_bytes;
+		gi->generation = header.generation;
+	}
+
+	munmap(file, size);
+	return valid;
+}
+
+static bool writeAll(int fd, void *p, usize size)
+{
+	return write(fd, p, size) == (isize)size;
+}
+
+// Identifiers nothing has used during this run are left out
+// once they make up half the table, so the cache can’t grow forever.
+// That renumbers everything after them,
+// so the saved cache starts a new generation
+// and AST cache images made with the old IDs are turned away.
+// It isn’t worth doing for just a few.
+void growableInternerSave(growableInterner *gi, const char *path, bump *b)
+{
+	bumpMark mark = bumpCreateMark(b);
+
+	char *strings = gi->strings.top;
+	internedString *identifiers = gi->identifiers.top;
+	u64 *hashes = gi->hashes.top;
+	usize count = gi->count;
+	usize string_bytes = gi->string_bytes;
+	u64 generation = gi->generation;
+
+	if (gi->used_count * 2 < gi->count) {
+		generation++;
+		bool *used = gi->used.top;
+		identifiers = bumpAllocateArray(internedString, b,
+						gi->used_count);
+		hashes = bumpAllocateArray(u64, b, gi->used_count);
+		strings = bumpAllocateArray(char, b, gi->string_bytes);
+		count = 0;
+		string_bytes = 0;
+
+		internedString *old_identifiers = gi->identifiers.top;
+		u64 *old_hashes = gi->hashes.top;
+		char *old_strings = gi->strings.top;
+		for (usize id = 0; id < gi->count; id++) {
+			if (!used[id])
+				continue;
+
+			internedString s = old_identifiers[id];
+			memcpy(strings + string_bytes,
+			       old_strings + s.offset, s.length + 1);
+			identifiers[count] = (internedString){
+				.offset = string_bytes,
+				.length = s.length,
+			};
+			hashes[count] = old_hashes[id];
+			string_bytes += s.length + 1;
+			count++;
+		}
+	}
+
+	identifierCacheHeader header = {
+		.magic = IDENTIFIER_CACHE_MAGIC,
+		.version = IDENTIFIER_CACHE_VERSION,
+		.count = count,
+		.string_bytes = string_bytes,
+		.generation = generation,
 	};
+
+	// We write to a temporary file and rename it into place
+	// so a run that’s interrupted can’t leave a torn cache behind.
+	char *temporary_path = bumpPrintf(b, "%s.tmp", path);
+
+	int fd = open(temporary_path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if (fd == -1) {
+		bumpClearToMark(b, mark);
+		return;
+	}
+
+	bool written =
+		writeAll(fd, &header, sizeof(header)) &&
+		writeAll(fd, identifiers, count * sizeof(internedString)) &&
+		writeAll(fd, hashes, count * sizeof(u64)) &&
+		writeAll(fd, strings, string_bytes);
+	close(fd);
+
+	if (written)
+		rename(temporary_path, path);
+	else
+		unlink(temporary_path);
+	bumpClearToMark(b, mark);
 }
 
 char *internerLookup(interner i, identifierId id)
 {
-	return i.contents[id.raw];
+	assert(id.raw < i.count);
+	return i.strings + i.identifiers[id.raw].offset;
+}
+
+u32 internerLookupLength(interner i, identifierId id)
+{
+	assert(id.raw < i.count);
+	return i.identifiers[id.raw].length;
 }
@@ -1,181 +1,1263 @@
 #include "minic.h"
 
-static const char *keywords[] = { "func", "return", "var",  "set",
-				  "if",	  "else",   "while" };
-static const tokenKind keywordKinds[] = { TOK_FUNC, TOK_RETURN, TOK_VAR,
-					  TOK_SET,  TOK_IF,	TOK_ELSE,
-					  TOK_WHILE };
-
-static const char twoCharTokens[][2] = {
-	{ '=', '=' }, { '!', '=' }, { '<', '=' }, { '>', '=' }, { ':', '=' }
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#elif defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Keywords are recognized while scanning identifiers
+// by looking them up in a perfect hash table
+// keyed on their length and their first and last characters.
+// If a newly-added keyword collides with an existing one,
+// building the table will fail an assertion,
+// and KEYWORD_HASH will need to be adjusted.
+#define KEYWORDS(X)                                                            \
+	X("func", TOK_FUNC)                                                    \
+	X("return", TOK_RETURN)                                                \
+	X("var", TOK_VAR)                                                      \
+	X("set", TOK_SET)                                                      \
+	X("if", TOK_IF)                                                        \
+	X("else", TOK_ELSE)                                                    \
+	X("while", TOK_WHILE)
+
+enum { KEYWORD_SLOT_COUNT = 16 };
+
+#define KEYWORD_HASH(length, first, last)                                      \
+	(((usize)(u8)(first) + 2 * (usize)(u8)(last) + (length)) &             \
+	 (KEYWORD_SLOT_COUNT - 1))
+
+typedef struct keyword {
+	const char *text;
+	usize length;
+	tokenKind kind;
+} keyword;
+
+// Indexing a string literal isn’t a constant expression in C,
+// so the slots can’t be picked by designated initializers
+// without writing each keyword’s first and last characters out by hand.
+// Instead the table is filled in the first time anything is lexed.
+#define KEYWORD_SLOT(keyword_text, token_kind)                                 \
+	keywordSlotSet(keyword_text, sizeof(keyword_text) - 1, token_kind);
+
+// Empty slots have a length of zero,
+// which no identifier can match.
+static keyword keywords[KEYWORD_SLOT_COUNT];
+static pthread_once_t keywords_once = PTHREAD_ONCE_INIT;
+
+static void keywordSlotSet(const char *text, usize length, tokenKind kind)
+{
+	keyword *slot =
+		&keywords[KEYWORD_HASH(length, text[0], text[length - 1])];
+	assert(slot->length == 0);
+	*slot = (keyword){ .text = text, .length = length, .kind = kind };
+}
+
+static void keywordsBuild(void)
+{
+	KEYWORDS(KEYWORD_SLOT)
+}
+
+// Every punctuation token the lexer recognizes.
+// Two-character tokens are listed as the first character
+// followed by the character that may come after it.
+// The dispatch tables below are generated from this list,
+// so adding an operator only requires adding it here.
+//
+// Since the second-character table has one entry per first character,
+// each first character may start at most one two-character token.
+#define PUNCTUATION_TOKENS(ONE, TWO)                                           \
+	ONE('=', TOK_EQUAL)                                                    \
+	ONE('+', TOK_PLUS)                                                     \
+	ONE('-', TOK_DASH)                                                     \
+	ONE('*', TOK_STAR)                                                     \
+	ONE('/', TOK_SLASH)                                                    \
+	ONE('{', TOK_LBRACE)                                                   \
+	ONE('}', TOK_RBRACE)                                                   \
+	ONE('(', TOK_LPAREN)                                                   \
+	ONE(')', TOK_RPAREN)                                                   \
+	ONE('[', TOK_LSQUARE)                                                  \
+	ONE(']', TOK_RSQUARE)                                                  \
+	ONE('<', TOK_LANGLE)                                                   \
+	ONE('>', TOK_RANGLE)                                                   \
+	ONE(':', TOK_COLON)                                                    \
+	ONE(';', TOK_SEMI)                                                     \
+	ONE('&', TOK_AMPERSAND)                                                \
+	ONE(',', TOK_COMMA)                                                    \
+	TWO('=', '=', TOK_EQUAL_EQUAL)                                         \
+	TWO('!', '=', TOK_BANG_EQUAL)                                          \
+	TWO('<', '=', TOK_LANGLE_EQUAL)                                        \
+	TWO('>', '=', TOK_RANGLE_EQUAL)                                        \
+	TWO(':', '=', TOK_COLON_EQUAL)
+
+#define DIGIT_CHARACTERS(X)                                                    \
+	X('0') X('1') X('2') X('3') X('4') X('5') X('6') X('7') X('8') X('9')
+
+#define IDENTIFIER_FIRST_CHARACTERS(X)                                         \
+	X('a') X('b') X('c') X('d') X('e') X('f') X('g') X('h') X('i')         \
+	X('j') X('k') X('l') X('m') X('n') X('o') X('p') X('q') X('r')         \
+	X('s') X('t') X('u') X('v') X('w') X('x') X('y') X('z') X('A')         \
+	X('B') X('C') X('D') X('E') X('F') X('G') X('H') X('I') X('J')         \
+	X('K') X('L') X('M') X('N') X('O') X('P') X('Q') X('R') X('S')         \
+	X('T') X('U') X('V') X('W') X('X') X('Y') X('Z') X('_')
+
+typedef enum byteClass {
+	BYTE_OTHER,
+	BYTE_WHITESPACE,
+	BYTE_NEWLINE,
+	BYTE_DIGIT,
+	BYTE_IDENTIFIER_FIRST
+} byteClass;
+
+#define DIGIT_CLASS(c) [(u8)(c)] = BYTE_DIGIT,
+#define IDENTIFIER_FIRST_CLASS(c) [(u8)(c)] = BYTE_IDENTIFIER_FIRST,
+
+static const byteClass byteClasses[256] = {
+	[' '] = BYTE_WHITESPACE,
+	['\t'] = BYTE_WHITESPACE,
+	['\n'] = BYTE_NEWLINE,
+	DIGIT_CHARACTERS(DIGIT_CLASS)
+	IDENTIFIER_FIRST_CHARACTERS(IDENTIFIER_FIRST_CLASS)
 };
-static const tokenKind twoCharTokenKinds[] = { TOK_EQUAL_EQUAL, TOK_BANG_EQUAL,
-					       TOK_LANGLE_EQUAL,
-					       TOK_RANGLE_EQUAL,
-					       TOK_COLON_EQUAL };
-
-static const char oneCharTokens[] = { '=', '+', '-', '*', '/', '{',
-				      '}', '(', ')', '[', ']', '<',
-				      '>', ':', ';', '&', ',' };
-static const tokenKind oneCharTokenKinds[] = {
-	TOK_EQUAL,     TOK_PLUS,   TOK_DASH,   TOK_STAR,   TOK_SLASH,
-	TOK_LBRACE,    TOK_RBRACE, TOK_LPAREN, TOK_RPAREN, TOK_LSQUARE,
-	TOK_RSQUARE,   TOK_LANGLE, TOK_RANGLE, TOK_COLON,  TOK_SEMI,
-	TOK_AMPERSAND, TOK_COMMA
+
+#define ONE_CHAR_TOKEN(c, token_kind) [(u8)(c)] = (token_kind),
+#define TWO_CHAR_TOKEN(first_char, second_char, token_kind)                    \
+	[(u8)(first_char)] = { .second = (second_char), .kind = (token_kind) },
+#define SKIP_ONE_CHAR_TOKEN(c, token_kind)
+#define SKIP_TWO_CHAR_TOKEN(first_char, second_char, token_kind)
+
+// Bytes which don’t start a one-character token map to TOK_EOF,
+// which never comes out of the lexer.
+static const tokenKind oneCharTokenKinds[256] = {
+	PUNCTUATION_TOKENS(ONE_CHAR_TOKEN, SKIP_TWO_CHAR_TOKEN)
 };
 
+typedef struct twoCharToken {
+	char second;
+	tokenKind kind;
+} twoCharToken;
+
+// Bytes which don’t start a two-character token
+// have a second character of zero.
+static const twoCharToken twoCharTokens[256] = {
+	PUNCTUATION_TOKENS(SKIP_ONE_CHAR_TOKEN, TWO_CHAR_TOKEN)
+};
+
+// Token spans are stored as a start offset and a one-byte length.
+// The few tokens which are too long for that
+// have their length stored in a separate table instead,
+// sorted by token index.
+enum { LONG_SPAN_LENGTH = 0xFF };
+
+// Tokens are accumulated in temp memory together with their kinds
+// and are only split into separate arrays once lexing is done.
+// This leaves general memory free for the line table,
+// which is written to its final location as we go.
+typedef struct lexedToken {
+	span span;
+	tokenKind kind;
+
+	// the hash of an identifier or the value of a number;
+	// unused for other tokens
+	u64 value;
+} lexedToken;
+
 typedef struct lexer {
-	arrayBuilder kinds;
-	arrayBuilder spans;
+	// Space for tokens is claimed a batch at a time and filled in directly,
+	// since pushing each one costs a call and a memcpy of unknown size.
+	// What’s left of the last batch is thrown away with the rest of temp.
+	arrayBuilder tokens;
+	lexedToken *batch;
+	usize batch_remaining;
+
+	arrayBuilder newlines;
 	usize count;
+	usize identifier_count;
+	usize literal_count;
+	usize newline_count;
 } lexer;
 
-static void pushToken(lexer *lexer, tokenKind kind, u32 start, u32 end)
+enum { TOKEN_BATCH_SIZE = 256 };
+
+static void pushLexedToken(lexer *lexer, lexedToken token)
 {
-	arrayBuilderPush(&lexer->kinds, &kind);
-	arrayBuilderPush(&lexer->spans, &(span){ .start = start, .end = end });
+	if (lexer->batch_remaining == 0) {
+		lexer->batch =
+			arrayBuilderExtend(&lexer->tokens, TOKEN_BATCH_SIZE);
+		lexer->batch_remaining = TOKEN_BATCH_SIZE;
+	}
+
+	*lexer->batch++ = token;
+	lexer->batch_remaining--;
 	lexer->count++;
 }
 
+static void pushToken(lexer *lexer, tokenKind kind, u32 start, u32 end)
+{
+	lexedToken token = {
+		.span = { .start = start, .end = end },
+		.kind = kind,
+		.value = 0,
+	};
+	pushLexedToken(lexer, token);
+}
+
+static void pushNumber(lexer *lexer, u32 start, u32 end, u64 value)
+{
+	lexedToken token = {
+		.span = { .start = start, .end = end },
+		.kind = TOK_NUMBER,
+		.value = value,
+	};
+	pushLexedToken(lexer, token);
+	lexer->literal_count++;
+}
+
+// The identifier’s bytes are still in cache from having just been scanned,
+// so we hash them here to save the interner from having to read them again.
+static void pushIdentifier(lexer *lexer, char *input, u32 start, u32 end)
+{
+	lexedToken token = {
+		.span = { .start = start, .end = end },
+		.kind = TOK_IDENTIFIER,
+		.value = wyhash((u8 *)input + start, end - start),
+	};
+	pushLexedToken(lexer, token);
+	lexer->identifier_count++;
+}
+
+static void pushNewline(lexer *lexer, u32 offset)
+{
+	arrayBuilderPush(&lexer->newlines, &offset);
+	lexer->newline_count++;
+}
+
+static byteClass classify(char c)
+{
+	return byteClasses[(u8)c];
+}
+
 static bool isWhitespace(char c)
 {
-	return c == ' ' || c == '\t' || c == '\n';
+	return classify(c) == BYTE_WHITESPACE;
 }
 
 static bool isDigit(char c)
 {
-	return c >= '0' && c <= '9';
+	return classify(c) == BYTE_DIGIT;
+}
+
+static bool isIdentifierRest(char c)
+{
+	byteClass class = classify(c);
+	return class == BYTE_IDENTIFIER_FIRST || class == BYTE_DIGIT;
+}
+
+// The kernels below classify a whole chunk of input at once,
+// producing a mask in which each byte that belongs to the class
+// we’re scanning for is represented by one or more set bits.
+// Counting the trailing set bits then tells us
+// how many bytes at the start of the chunk are in that class,
+// which lets us skip over entire runs of whitespace or identifier characters
+// without looking at each byte individually.
+#if defined(__AVX2__)
+enum { CHUNK_SIZE = 32 };
+#else
+enum { CHUNK_SIZE = 16 };
+#endif
+
+#if defined(__ARM_NEON)
+
+// NEON has no equivalent of SSE’s movemask,
+// so instead we narrow each byte of the comparison result to four bits.
+// This gives us a 64-bit mask with four bits per byte.
+static usize matchingPrefixLength(uint8x16_t matches)
+{
+	uint8x8_t narrowed = vshrn_n_u16(vreinterpretq_u16_u8(matches), 4);
+	u64 mask = vget_lane_u64(vreinterpret_u64_u8(narrowed), 0);
+	if (mask == (u64)-1)
+		return CHUNK_SIZE;
+	return __builtin_ctzll(~mask) / 4;
 }
 
-static bool isIdentifierFirst(char c)
+static usize whitespacePrefixLength(const char *s)
 {
-	return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c == '_');
+	uint8x16_t chunk = vld1q_u8((const u8 *)s);
+	uint8x16_t matches = vorrq_u8(vceqq_u8(chunk, vdupq_n_u8(' ')),
+				      vceqq_u8(chunk, vdupq_n_u8('\t')));
+	return matchingPrefixLength(matches);
 }
 
-static void convertKeywords(char *input, tokenBuffer *buf)
+static usize identifierPrefixLength(const char *s)
 {
-	usize keywords_count = sizeof(keywords) / sizeof(keywords[0]);
+	uint8x16_t chunk = vld1q_u8((const u8 *)s);
 
-	for (usize i = 0; i < buf->count; i++) {
-		tokenKind *kind = &buf->kinds[i];
+	// Setting bit 5 maps uppercase letters onto lowercase ones,
+	// so we only need a single range check for letters.
+	uint8x16_t lower = vorrq_u8(chunk, vdupq_n_u8(0x20));
+	uint8x16_t letters = vcleq_u8(vsubq_u8(lower, vdupq_n_u8('a')),
+				      vdupq_n_u8('z' - 'a'));
+	uint8x16_t digits = vcleq_u8(vsubq_u8(chunk, vdupq_n_u8('0')),
+				     vdupq_n_u8('9' - '0'));
+	uint8x16_t underscores = vceqq_u8(chunk, vdupq_n_u8('_'));
 
-		if (*kind != TOK_IDENTIFIER)
-			continue;
+	uint8x16_t matches = vorrq_u8(vorrq_u8(letters, digits), underscores);
+	return matchingPrefixLength(matches);
+}
 
-		span span = buf->spans[i];
-		usize length = span.end - span.start;
+#elif defined(__AVX2__)
 
-		for (usize j = 0; j < keywords_count; j++) {
-			if (strlen(keywords[j]) != length)
-				continue;
-			if (strncmp(input + span.start, keywords[j], length) !=
-			    0)
-				continue;
-			*kind = keywordKinds[j];
-			break;
+// The mask has a bit for each of the 32 bytes,
+// so it’s widened before inverting
+// to leave a set bit past the end when every byte matched.
+static usize matchingPrefixLength(__m256i matches)
+{
+	u32 mask = (u32)_mm256_movemask_epi8(matches);
+	return __builtin_ctzll(~(u64)mask);
+}
+
+static usize whitespacePrefixLength(const char *s)
+{
+	__m256i chunk = _mm256_loadu_si256((const __m256i *)s);
+	__m256i matches = _mm256_or_si256(
+		_mm256_cmpeq_epi8(chunk, _mm256_set1_epi8(' ')),
+		_mm256_cmpeq_epi8(chunk, _mm256_set1_epi8('\t')));
+	return matchingPrefixLength(matches);
+}
+
+// The same range checks as the SSE2 version below,
+// with the same reliance on signed comparisons.
+static usize identifierPrefixLength(const char *s)
+{
+	__m256i chunk = _mm256_loadu_si256((const __m256i *)s);
+
+	__m256i lower = _mm256_or_si256(chunk, _mm256_set1_epi8(0x20));
+	__m256i letters = _mm256_andnot_si256(
+		_mm256_cmpgt_epi8(lower, _mm256_set1_epi8('z')),
+		_mm256_cmpgt_epi8(lower, _mm256_set1_epi8('a' - 1)));
+	__m256i digits = _mm256_andnot_si256(
+		_mm256_cmpgt_epi8(chunk, _mm256_set1_epi8('9')),
+		_mm256_cmpgt_epi8(chunk, _mm256_set1_epi8('0' - 1)));
+	__m256i underscores =
+		_mm256_cmpeq_epi8(chunk, _mm256_set1_epi8('_'));
+
+	__m256i matches = _mm256_or_si256(
+		_mm256_or_si256(letters, digits), underscores);
+	return matchingPrefixLength(matches);
+}
+
+#elif defined(__SSE2__)
+
+static usize matchingPrefixLength(__m128i matches)
+{
+	u32 mask = (u32)_mm_movemask_epi8(matches);
+	return __builtin_ctz(~mask);
+}
+
+static usize whitespacePrefixLength(const char *s)
+{
+	__m128i chunk = _mm_loadu_si128((const __m128i *)s);
+	__m128i matches =
+		_mm_or_si128(_mm_cmpeq_epi8(chunk, _mm_set1_epi8(' ')),
+			     _mm_cmpeq_epi8(chunk, _mm_set1_epi8('\t')));
+	return matchingPrefixLength(matches);
+}
+
+static usize identifierPrefixLength(const char *s)
+{
+	__m128i chunk = _mm_loadu_si128((const __m128i *)s);
+
+	// SSE2 only has signed comparisons.
+	// That’s fine for us, though:
+	// bytes with the high bit set compare as negative,
+	// which puts them outside of every range we check for.
+	__m128i lower = _mm_or_si128(chunk, _mm_set1_epi8(0x20));
+	__m128i letters =
+		_mm_and_si128(_mm_cmpgt_epi8(lower, _mm_set1_epi8('a' - 1)),
+			      _mm_cmplt_epi8(lower, _mm_set1_epi8('z' + 1)));
+	__m128i digits =
+		_mm_and_si128(_mm_cmpgt_epi8(chunk, _mm_set1_epi8('0' - 1)),
+			      _mm_cmplt_epi8(chunk, _mm_set1_epi8('9' + 1)));
+	__m128i underscores = _mm_cmpeq_epi8(chunk, _mm_set1_epi8('_'));
+
+	__m128i matches =
+		_mm_or_si128(_mm_or_si128(letters, digits), underscores);
+	return matchingPrefixLength(matches);
+}
+
+#else
+
+// Without vector instructions we just check one byte at a time.
+
+static usize whitespacePrefixLength(const char *s)
+{
+	usize i = 0;
+	while (i < CHUNK_SIZE && isWhitespace(s[i]))
+		i++;
+	return i;
+}
+
+static usize identifierPrefixLength(const char *s)
+{
+	usize i = 0;
+	while (i < CHUNK_SIZE && isIdentifierRest(s[i]))
+		i++;
+	return i;
+}
+
+#endif
+
+static usize skipWhitespace(const char *input, usize i, usize length)
+{
+	// Most runs are a single space between two tokens,
+	// which isn’t worth loading a whole chunk for.
+	i++;
+	if (i < length && !isWhitespace(input[i]))
+		return i;
+
+	while (i + CHUNK_SIZE <= length) {
+		usize run = whitespacePrefixLength(input + i);
+		i += run;
+		if (run < CHUNK_SIZE)
+			return i;
+	}
+
+	// Never read past the end of the input;
+	// the last few bytes are handled one at a time.
+	while (i < length && isWhitespace(input[i]))
+		i++;
+	return i;
+}
+
+static usize skipIdentifier(const char *input, usize i, usize length)
+{
+	while (i + CHUNK_SIZE <= length) {
+		usize run = identifierPrefixLength(input + i);
+		i += run;
+		if (run < CHUNK_SIZE)
+			return i;
+	}
+
+	while (i < length && isIdentifierRest(input[i]))
+		i++;
+	return i;
+}
+
+static tokenKind identifierKind(const char *text, usize length)
+{
+	keyword k = keywords[KEYWORD_HASH(length, text[0], text[length - 1])];
+	if (k.length != length)
+		return TOK_IDENTIFIER;
+	if (memcmp(text, k.text, length) != 0)
+		return TOK_IDENTIFIER;
+	return k.kind;
+}
+
+// Comments run up to the next newline,
+// which is left for the lexer to record in the line table.
+// Since nothing inside a comment matters,
+// we can hand the search off to memchr,
+// which is vectorized on every platform we care about.
+static usize skipComment(const char *input, usize i, usize length)
+{
+	const char *newline = memchr(input + i, '\n', length - i);
+	if (newline == NULL)
+		return length;
+	return newline - input;
+}
+
+// Lexes whatever comes next in the input --
+// either a run of whitespace, a comment or a single token --
+// and returns the offset just past it.
+static usize lexToken(lexer *lexer, char *input, usize i, usize length,
+		      diagnosticsStorage *diagnostics)
+{
+	switch (classify(input[i])) {
+	case BYTE_WHITESPACE:
+		return skipWhitespace(input, i, length);
+
+	// Newlines get a class of their own
+	// so that we can build up the line table as we go
+	// without having to look at each skipped whitespace byte again.
+	case BYTE_NEWLINE:
+		pushNewline(lexer, i);
+		return i + 1;
+
+	case BYTE_DIGIT: {
+		// We decode the value as we go
+		// so nobody has to scan the digits a second time.
+		u32 start = i;
+		u64 value = 0;
+		bool overflowed = false;
+		while (i < length && isDigit(input[i])) {
+			u64 digit = (u64)(input[i] - '0');
+			overflowed |=
+				__builtin_mul_overflow(value, 10, &value) ||
+				__builtin_add_overflow(value, digit, &value);
+			i++;
+		}
+		u32 end = i;
+
+		// Integers are signed 64-bit,
+		// so anything past INT64_MAX would silently wrap.
+		if (overflowed || value > INT64_MAX) {
+			span span = { .start = start, .end = end };
+			diagnosticsStorageRecord(diagnostics, DIAG_ERROR, span,
+						 "integer literal too large");
+			value = 0;
 		}
+
+		pushNumber(lexer, start, end, value);
+		return i;
+	}
+
+	case BYTE_IDENTIFIER_FIRST: {
+		u32 start = i;
+		i = skipIdentifier(input, i, length);
+		u32 end = i;
+		tokenKind kind = identifierKind(input + start, end - start);
+		if (kind == TOK_IDENTIFIER)
+			pushIdentifier(lexer, input, start, end);
+		else
+			pushToken(lexer, kind, start, end);
+		return i;
+	}
+
+	case BYTE_OTHER:
+		break;
+	}
+
+	u8 first = input[i];
+
+	if (first == '/' && i + 1 < length && input[i + 1] == '/')
+		return skipComment(input, i + 2, length);
+
+	twoCharToken two_char_token = twoCharTokens[first];
+	if (two_char_token.second != 0 && i + 1 < length &&
+	    input[i + 1] == two_char_token.second) {
+		u32 start = i;
+		i += 2;
+		u32 end = i;
+		pushToken(lexer, two_char_token.kind, start, end);
+		return i;
+	}
+
+	tokenKind one_char_token_kind = oneCharTokenKinds[first];
+	if (one_char_token_kind != TOK_EOF) {
+		u32 start = i;
+		i++;
+		u32 end = i;
+		pushToken(lexer, one_char_token_kind, start, end);
+		return i;
 	}
+
+	span span = {
+		.start = i,
+		.end = i + 1,
+	};
+	diagnosticsStorageRecord(diagnostics, DIAG_ERROR, span,
+				 "invalid token “%c”", input[i]);
+	i++;
+	pushToken(lexer, TOK_ERROR, span.start, span.end);
+	return i;
 }
 
-tokenBuffer lex(char *input, diagnosticsStorage *diagnostics, memory *m)
+static tokenBuffer lexRange(char *input, usize length,
+			   diagnosticsStorage *diagnostics, memory *m)
 {
+	pthread_once(&keywords_once, keywordsBuild);
 	bumpMark mark = bumpCreateMark(&m->temp);
 
 	lexer lexer = {
-		.kinds = bumpStartArrayBuilder(&m->general, sizeof(tokenKind)),
-		.spans = bumpStartArrayBuilder(&m->temp, sizeof(span)),
+		.tokens = bumpStartArrayBuilder(&m->temp, sizeof(lexedToken)),
+		.newlines = bumpStartArrayBuilder(&m->general, sizeof(u32)),
 	};
 
 	usize i = 0;
+	while (i < length)
+		i = lexToken(&lexer, input, i, length, diagnostics);
 
-	while (input[i] != 0) {
-		if (isWhitespace(input[i])) {
-			i++;
-			goto next;
-		}
+	lexedToken *tokens =
+		(lexedToken *)bumpFinishArrayBuilder(&m->temp, &lexer.tokens);
+	u32 *newlines =
+		(u32 *)bumpFinishArrayBuilder(&m->general, &lexer.newlines);
 
-		if (isDigit(input[i])) {
-			u32 start = i;
-			while (isDigit(input[i]))
-				i++;
-			u32 end = i;
-			pushToken(&lexer, TOK_NUMBER, start, end);
-			goto next;
-		}
+	// Split tokens from temp memory into kinds and spans in general memory.
+	tokenKind *kinds =
+		bumpAllocateArray(tokenKind, &m->general, lexer.count);
+	u32 *span_starts = bumpAllocateArray(u32, &m->general, lexer.count);
+	u8 *span_lengths = bumpAllocateArray(u8, &m->general, lexer.count);
 
-		if (isIdentifierFirst(input[i])) {
-			u32 start = i;
-			while (isIdentifierFirst(input[i]) || isDigit(input[i]))
-				i++;
-			u32 end = i;
-			pushToken(&lexer, TOK_IDENTIFIER, start, end);
-			goto next;
+	u64 *identifier_hashes =
+		bumpAllocateArray(u64, &m->general, lexer.identifier_count);
+	usize identifier_count = 0;
+
+	u32 *literal_tokens =
+		bumpAllocateArray(u32, &m->general, lexer.literal_count);
+	u64 *literal_values =
+		bumpAllocateArray(u64, &m->general, lexer.literal_count);
+	usize literal_count = 0;
+
+	u32 *newline_identifier_counts =
+		bumpAllocateArray(u32, &m->general, lexer.newline_count);
+	usize newline = 0;
+
+	arrayBuilder long_spans_builder =
+		bumpStartArrayBuilder(&m->general, sizeof(tokenLongSpan));
+	usize long_span_count = 0;
+
+	for (usize j = 0; j < lexer.count; j++) {
+		span span = tokens[j].span;
+		u32 token_length = span.end - span.start;
+
+		for (; newline < lexer.newline_count &&
+		       newlines[newline] < span.start;
+		     newline++)
+			newline_identifier_counts[newline] = identifier_count;
+
+		kinds[j] = tokens[j].kind;
+		span_starts[j] = span.start;
+
+		if (tokens[j].kind == TOK_IDENTIFIER) {
+			identifier_hashes[identifier_count] = tokens[j].value;
+			identifier_count++;
 		}
 
-		usize two_char_tokens_count =
-			sizeof(twoCharTokens) / sizeof(twoCharTokens[0]);
-		for (usize j = 0; j < two_char_tokens_count; j++) {
-			char first = twoCharTokens[j][0];
-			char second = twoCharTokens[j][1];
-			u32 start = i;
-			if (input[i] != first)
-				continue;
-			if (input[i + 1] != second)
-				continue;
-			i += 2;
-			u32 end = i;
-			pushToken(&lexer, twoCharTokenKinds[j], start, end);
-			goto next;
+		if (tokens[j].kind == TOK_NUMBER) {
+			literal_tokens[literal_count] = j;
+			literal_values[literal_count] = tokens[j].value;
+			literal_count++;
 		}
 
-		usize one_char_tokens_count =
-			sizeof(oneCharTokens) / sizeof(oneCharTokens[0]);
-		for (usize j = 0; j < one_char_tokens_count; j++) {
-			if (input[i] != oneCharTokens[j])
-				continue;
-			u32 start = i;
-			i++;
-			u32 end = i;
-			pushToken(&lexer, oneCharTokenKinds[j], start, end);
-			goto next;
+		if (token_length < LONG_SPAN_LENGTH) {
+			span_lengths[j] = token_length;
+			continue;
 		}
 
-		span span = {
-			.start = i,
-			.end = i + 1,
+		span_lengths[j] = LONG_SPAN_LENGTH;
+		tokenLongSpan long_span = {
+			.token = j,
+			.length = token_length,
 		};
-		diagnosticsStorageRecord(diagnostics, DIAG_ERROR, span,
-					 "invalid token “%c”", input[i]);
-		i++;
-		pushToken(&lexer, TOK_ERROR, span.start, span.end);
-
-	next:;
+		arrayBuilderPush(&long_spans_builder, &long_span);
+		long_span_count++;
 	}
 
-	tokenKind *kinds =
-		(tokenKind *)bumpFinishArrayBuilder(&m->general, &lexer.kinds);
-	span *spans = (span *)bumpFinishArrayBuilder(&m->temp, &lexer.spans);
+	for (; newline < lexer.newline_count; newline++)
+		newline_identifier_counts[newline] = identifier_count;
 
-	// Copy spans from temp memory into general memory.
-	spans = bumpCopyArray(span, &m->general, spans, lexer.count);
+	tokenLongSpan *long_spans =
+		bumpFinishArrayBuilder(&m->general, &long_spans_builder);
 	bumpClearToMark(&m->temp, mark);
 
 	tokenBuffer buf = {
 		.kinds = kinds,
-		.spans = spans,
+		.span_starts = span_starts,
+		.span_lengths = span_lengths,
+		.long_spans = long_spans,
 		.identifier_ids = NULL,
+		.identifier_hashes = identifier_hashes,
+		.literal_tokens = literal_tokens,
+		.literal_values = literal_values,
+		.lines = {
+			.newlines = newlines,
+			.count = lexer.newline_count,
+		},
+		.newline_identifier_counts = newline_identifier_counts,
 		.count = lexer.count,
+		.long_span_count = long_span_count,
+		.identifier_count = identifier_count,
+		.literal_count = literal_count,
+	};
+
+	buf.identifier_ids =
+		bumpAllocateArray(identifierId, &m->general, buf.count);
+	memset(buf.identifier_ids, -1, buf.count * sizeof(identifierId));
+
+	return buf;
+}
+
+tokenBuffer lex(char *input, usize length, diagnosticsStorage *diagnostics,
+	       memory *m)
+{
+	return lexRange(input, length, diagnostics, m);
+}
+
+// Chunks smaller than this aren’t worth starting a thread for.
+enum { MIN_PARALLEL_LEX_CHUNK_SIZE = 256 * 1024 };
+
+typedef struct lexJob {
+	char *input;
+	usize start;
+	usize length;
+	u16 file;
+	memory m;
+	diagnosticsStorage diagnostics;
+	tokenBuffer tokens;
+} lexJob;
+
+static void *lexJobRun(void *arg)
+{
+	lexJob *job = arg;
+	job->diagnostics =
+		diagnosticsStorageCreateForFile(&job->m.general, job->file);
+	job->tokens = lexRange(job->input + job->start, job->length,
+			       &job->diagnostics, &job->m);
+	return NULL;
+}
+
+// Splits the input into at most chunk_count chunks
+// which each end just after a newline.
+// No token can contain a newline,
+// so lexing each chunk on its own produces the same tokens
+// as lexing the whole input at once.
+static usize splitIntoChunks(char *input, usize length, usize chunk_count,
+			     lexJob *jobs)
+{
+	usize count = 0;
+	usize start = 0;
+
+	for (usize i = 0; i < chunk_count && start < length; i++) {
+		usize end = length * (i + 1) / chunk_count;
+		if (end < start)
+			end = start;
+
+		// The last chunk always runs to the end of the input.
+		if (i == chunk_count - 1)
+			end = length;
+
+		while (end < length && input[end - 1] != '\n')
+			end++;
+
+		if (end == start)
+			continue;
+
+		jobs[count] = (lexJob){
+			.input = input,
+			.start = start,
+			.length = end - start,
+			.file = currentFile(),
+		};
+		count++;
+		start = end;
+	}
+
+	return count;
+}
+
+static tokenBuffer stitchTokenBuffers(lexJob *jobs, usize job_count,
+				      diagnosticsStorage *diagnostics,
+				      memory *m)
+{
+	tokenBuffer buf = { 0 };
+	for (usize i = 0; i < job_count; i++) {
+		buf.count += jobs[i].tokens.count;
+		buf.long_span_count += jobs[i].tokens.long_span_count;
+		buf.identifier_count += jobs[i].tokens.identifier_count;
+		buf.literal_count += jobs[i].tokens.literal_count;
+		buf.lines.count += jobs[i].tokens.lines.count;
+	}
+
+	buf.kinds = bumpAllocateArray(tokenKind, &m->general, buf.count);
+	buf.span_starts = bumpAllocateArray(u32, &m->general, buf.count);
+	buf.span_lengths = bumpAllocateArray(u8, &m->general, buf.count);
+	buf.long_spans = bumpAllocateArray(tokenLongSpan, &m->general,
+					   buf.long_span_count);
+	buf.identifier_ids =
+		bumpAllocateArray(identifierId, &m->general, buf.count);
+	buf.identifier_hashes =
+		bumpAllocateArray(u64, &m->general, buf.identifier_count);
+	buf.literal_tokens =
+		bumpAllocateArray(u32, &m->general, buf.literal_count);
+	buf.literal_values =
+		bumpAllocateArray(u64, &m->general, buf.literal_count);
+	buf.lines.newlines =
+		bumpAllocateArray(u32, &m->general, buf.lines.count);
+	buf.newline_identifier_counts =
+		bumpAllocateArray(u32, &m->general, buf.lines.count);
+	memset(buf.identifier_ids, -1, buf.count * sizeof(identifierId));
+
+	usize token_offset = 0;
+	usize long_span_offset = 0;
+	usize identifier_offset = 0;
+	usize literal_offset = 0;
+	usize newline_offset = 0;
+
+	for (usize i = 0; i < job_count; i++) {
+		lexJob *job = &jobs[i];
+		tokenBuffer chunk = job->tokens;
+
+		memcpy(buf.kinds + token_offset, chunk.kinds,
+		       chunk.count * sizeof(tokenKind));
+		memcpy(buf.span_lengths + token_offset, chunk.span_lengths,
+		       chunk.count * sizeof(u8));
+		memcpy(buf.identifier_hashes + identifier_offset,
+		       chunk.identifier_hashes,
+		       chunk.identifier_count * sizeof(u64));
+		memcpy(buf.literal_values + literal_offset,
+		       chunk.literal_values, chunk.literal_count * sizeof(u64));
+
+		// Spans and token indexes are relative
+		// to the start of the chunk, so we shift them
+		// to be relative to the start of the whole input.
+		for (usize j = 0; j < chunk.count; j++)
+			buf.span_starts[token_offset + j] =
+				chunk.span_starts[j] + job->start;
+
+		for (usize j = 0; j < chunk.long_span_count; j++) {
+			tokenLongSpan long_span = chunk.long_spans[j];
+			long_span.token += token_offset;
+			buf.long_spans[long_span_offset + j] = long_span;
+		}
+
+		for (usize j = 0; j < chunk.literal_count; j++)
+			buf.literal_tokens[literal_offset + j] =
+				chunk.literal_tokens[j] + token_offset;
+
+		for (usize j = 0; j < chunk.lines.count; j++) {
+			buf.lines.newlines[newline_offset + j] =
+				chunk.lines.newlines[j] + job->start;
+			buf.newline_identifier_counts[newline_offset + j] =
+				chunk.newline_identifier_counts[j] +
+				identifier_offset;
+		}
+
+		for (u16 j = 0; j < job->diagnostics.count; j++) {
+			span s = job->diagnostics.spans[j];
+			s.start += job->start;
+			s.end += job->start;
+
+			u32 message_start = job->diagnostics.message_starts[j];
+			char *message = (char *)(job->diagnostics.all_messages
+							 .top +
+						 message_start);
+			diagnosticsStorageRecord(diagnostics,
+						 job->diagnostics.severities[j],
+						 s, "%s", message);
+		}
+
+		token_offset += chunk.count;
+		long_span_offset += chunk.long_span_count;
+		identifier_offset += chunk.identifier_count;
+		literal_offset += chunk.literal_count;
+		newline_offset += chunk.lines.count;
+	}
+
+	return buf;
+}
+
+static tokenBuffer lexChunked(char *input, usize length, usize chunk_count,
+			      diagnosticsStorage *diagnostics, memory *m)
+{
+	bumpMark mark = bumpCreateMark(&m->temp);
+	lexJob *jobs = bumpAllocateArray(lexJob, &m->temp, chunk_count);
+	usize job_count = splitIntoChunks(input, length, chunk_count, jobs);
+
+	if (job_count <= 1) {
+		bumpClearToMark(&m->temp, mark);
+		return lex(input, length, diagnostics, m);
+	}
+
+	// Each job gets its own memory since bumps can’t be shared
+	// between threads. This is generously sized, but since it’s
+	// only touched as the lexer needs it, most is never committed.
+	for (usize i = 0; i < job_count; i++) {
+		usize size = jobs[i].length * 32 + 1024 * 1024;
+		jobs[i].m = (memory){
+			.temp = allocateFromOs(size),
+			.general = allocateFromOs(size),
+		};
+	}
+
+	pthread_t *threads =
+		bumpAllocateArray(pthread_t, &m->temp, job_count);
+
+	// The current thread takes care of the first chunk itself.
+	for (usize i = 1; i < job_count; i++)
+		pthread_create(&threads[i], NULL, lexJobRun, &jobs[i]);
+	lexJobRun(&jobs[0]);
+	for (usize i = 1; i < job_count; i++)
+		pthread_join(threads[i], NULL);
+
+	tokenBuffer buf = stitchTokenBuffers(jobs, job_count, diagnostics, m);
+
+	for (usize i = 0; i < job_count; i++) {
+		freeToOs(jobs[i].m.temp);
+		freeToOs(jobs[i].m.general);
+	}
+
+	bumpClearToMark(&m->temp, mark);
+	return buf;
+}
+
+tokenBuffer lexParallel(char *input, usize length, u32 worker_count,
+			diagnosticsStorage *diagnostics, memory *m)
+{
+	usize chunk_count = length / MIN_PARALLEL_LEX_CHUNK_SIZE;
+	if (chunk_count > worker_count)
+		chunk_count = worker_count;
+
+	if (chunk_count <= 1)
+		return lex(input, length, diagnostics, m);
+
+	return lexChunked(input, length, chunk_count, diagnostics, m);
+}
+
+// Finds the index of the first element of a sorted array
+// which is at least the given value.
+static usize firstAtLeast(u32 *values, usize count, u32 value)
+{
+	usize low = 0;
+	usize high = count;
+	while (low < high) {
+		usize middle = low + (high - low) / 2;
+		if (values[middle] < value)
+			low = middle + 1;
+		else
+			high = middle;
+	}
+	return low;
+}
+
+// The diagnostics must hold what lexing the old content reported,
+// and are brought up to date with the new content.
+tokenBuffer relex(tokenBuffer old, char *new_content, usize length,
+		  span edited, u32 inserted_length,
+		  diagnosticsStorage *diagnostics, memory *m)
+{
+	i64 delta = (i64)inserted_length - (i64)(edited.end - edited.start);
+
+	// where the edit ends in the new content
+	usize new_edited_end = edited.start + inserted_length;
+
+	// No token spans multiple lines,
+	// so everything before the line containing the edit is unaffected,
+	// and the start of that line is always a token boundary.
+	usize restart = edited.start;
+	while (restart > 0 && new_content[restart - 1] != '\n')
+		restart--;
+
+	usize first = firstAtLeast(old.span_starts, old.count, restart);
+	usize candidate = firstAtLeast(old.span_starts, old.count, edited.end);
+	usize tail = old.count;
+	usize tail_newline_start = old.lines.count;
+
+	pthread_once(&keywords_once, keywordsBuild);
+	bumpMark mark = bumpCreateMark(&m->temp);
+	u16 old_diagnostic_count = diagnostics->count;
+
+	lexer lexer = {
+		.tokens = bumpStartArrayBuilder(&m->temp, sizeof(lexedToken)),
+		.newlines = bumpStartArrayBuilder(&m->general, sizeof(u32)),
 	};
 
-	convertKeywords(input, &buf);
+	usize i = restart;
+	while (i < length) {
+		// Past the edit the new content is identical to the old,
+		// only shifted by delta. The lexer carries no state
+		// besides its position, so if the old lexer also began
+		// a token at the corresponding offset, it must have produced
+		// the very same tokens from there on as we would.
+		if (i >= new_edited_end) {
+			u32 old_offset = (u32)((i64)i - delta);
+			while (candidate < old.count &&
+			       old.span_starts[candidate] < old_offset)
+				candidate++;
+
+			if (candidate < old.count &&
+			    old.span_starts[candidate] == old_offset) {
+				tail = candidate;
+				tail_newline_start = firstAtLeast(
+					old.lines.newlines, old.lines.count,
+					old_offset);
+				break;
+			}
+		}
+
+		i = lexToken(&lexer, new_content, i, length, diagnostics);
+	}
+
+	lexedToken *tokens =
+		(lexedToken *)bumpFinishArrayBuilder(&m->temp, &lexer.tokens);
+	u32 *new_newlines =
+		(u32 *)bumpFinishArrayBuilder(&m->general, &lexer.newlines);
+
+	// Old diagnostics from the relexed bytes no longer apply,
+	// and those past them move along with the tail.
+	span replaced = {
+		.start = restart,
+		.end = tail < old.count ? old.span_starts[tail] : (u32)-1,
+	};
+	diagnosticsStorageApplyEdit(diagnostics, old_diagnostic_count,
+				    replaced, delta, &m->temp);
+
+	usize new_count = lexer.count;
+	usize tail_count = old.count - tail;
+
+	// restart is always just after a newline (or at the very start),
+	// so the count stored for that newline is every identifier before it.
+	usize prefix_newline_count =
+		firstAtLeast(old.lines.newlines, old.lines.count, restart);
+	usize prefix_identifier_count =
+		prefix_newline_count == 0
+			? 0
+			: old.newline_identifier_counts[prefix_newline_count -
+							1];
 
+	usize replaced_identifier_count = 0;
+	for (usize j = first; j < tail; j++)
+		if (old.kinds[j] == TOK_IDENTIFIER)
+			replaced_identifier_count++;
+
+	usize tail_identifier_start =
+		prefix_identifier_count + replaced_identifier_count;
+	usize tail_identifier_count =
+		old.identifier_count - tail_identifier_start;
+
+	usize prefix_literal_count =
+		firstAtLeast(old.literal_tokens, old.literal_count, first);
+	usize tail_literal_start =
+		firstAtLeast(old.literal_tokens, old.literal_count, tail);
+	usize tail_literal_count = old.literal_count - tail_literal_start;
+
+	usize tail_newline_count = old.lines.count - tail_newline_start;
+
+	tokenBuffer buf = {
+		.count = first + new_count + tail_count,
+		.identifier_count = prefix_identifier_count +
+				    lexer.identifier_count +
+				    tail_identifier_count,
+		.literal_count = prefix_literal_count + lexer.literal_count +
+				 tail_literal_count,
+		.lines = {
+			.count = prefix_newline_count + lexer.newline_count +
+				 tail_newline_count,
+		},
+	};
+
+	buf.kinds = bumpAllocateArray(tokenKind, &m->general, buf.count);
+	buf.span_starts = bumpAllocateArray(u32, &m->general, buf.count);
+	buf.span_lengths = bumpAllocateArray(u8, &m->general, buf.count);
 	buf.identifier_ids =
 		bumpAllocateArray(identifierId, &m->general, buf.count);
+	buf.identifier_hashes =
+		bumpAllocateArray(u64, &m->general, buf.identifier_count);
+	buf.literal_tokens =
+		bumpAllocateArray(u32, &m->general, buf.literal_count);
+	buf.literal_values =
+		bumpAllocateArray(u64, &m->general, buf.literal_count);
+	buf.lines.newlines =
+		bumpAllocateArray(u32, &m->general, buf.lines.count);
+	buf.newline_identifier_counts =
+		bumpAllocateArray(u32, &m->general, buf.lines.count);
 	memset(buf.identifier_ids, -1, buf.count * sizeof(identifierId));
 
+	// unchanged tokens before the edit
+	memcpy(buf.kinds, old.kinds, first * sizeof(tokenKind));
+	memcpy(buf.span_starts, old.span_starts, first * sizeof(u32));
+	memcpy(buf.span_lengths, old.span_lengths, first * sizeof(u8));
+	memcpy(buf.identifier_hashes, old.identifier_hashes,
+	       prefix_identifier_count * sizeof(u64));
+	memcpy(buf.literal_tokens, old.literal_tokens,
+	       prefix_literal_count * sizeof(u32));
+	memcpy(buf.literal_values, old.literal_values,
+	       prefix_literal_count * sizeof(u64));
+	memcpy(buf.lines.newlines, old.lines.newlines,
+	       prefix_newline_count * sizeof(u32));
+	memcpy(buf.newline_identifier_counts, old.newline_identifier_counts,
+	       prefix_newline_count * sizeof(u32));
+
+	arrayBuilder long_spans_builder =
+		bumpStartArrayBuilder(&m->general, sizeof(tokenLongSpan));
+
+	usize long_span = 0;
+	for (; long_span < old.long_span_count; long_span++) {
+		if (old.long_spans[long_span].token >= first)
+			break;
+		arrayBuilderPush(&long_spans_builder,
+				 &old.long_spans[long_span]);
+		buf.long_span_count++;
+	}
+
+	// freshly-lexed tokens
+	usize identifier = prefix_identifier_count;
+	usize literal = prefix_literal_count;
+	u32 *new_newline_identifier_counts =
+		buf.newline_identifier_counts + prefix_newline_count;
+	usize newline = 0;
+	for (usize j = 0; j < new_count; j++) {
+		usize token = first + j;
+		span span = tokens[j].span;
+		u32 token_length = span.end - span.start;
+
+		for (; newline < lexer.newline_count &&
+		       new_newlines[newline] < span.start;
+		     newline++)
+			new_newline_identifier_counts[newline] = identifier;
+
+		buf.kinds[token] = tokens[j].kind;
+		buf.span_starts[token] = span.start;
+
+		if (tokens[j].kind == TOK_IDENTIFIER) {
+			buf.identifier_hashes[identifier] = tokens[j].value;
+			identifier++;
+		}
+
+		if (tokens[j].kind == TOK_NUMBER) {
+			buf.literal_tokens[literal] = token;
+			buf.literal_values[literal] = tokens[j].value;
+			literal++;
+		}
+
+		if (token_length < LONG_SPAN_LENGTH) {
+			buf.span_lengths[token] = token_length;
+			continue;
+		}
+
+		buf.span_lengths[token] = LONG_SPAN_LENGTH;
+		tokenLongSpan new_long_span = {
+			.token = token,
+			.length = token_length,
+		};
+		arrayBuilderPush(&long_spans_builder, &new_long_span);
+		buf.long_span_count++;
+	}
+	for (; newline < lexer.newline_count; newline++)
+		new_newline_identifier_counts[newline] = identifier;
+	memcpy(buf.lines.newlines + prefix_newline_count, new_newlines,
+	       lexer.newline_count * sizeof(u32));
+
+	// unchanged tokens after the edit, shifted into place
+	usize tail_destination = first + new_count;
+	memcpy(buf.kinds + tail_destination, old.kinds + tail,
+	       tail_count * sizeof(tokenKind));
+	memcpy(buf.span_lengths + tail_destination, old.span_lengths + tail,
+	       tail_count * sizeof(u8));
+	for (usize j = 0; j < tail_count; j++)
+		buf.span_starts[tail_destination + j] =
+			(u32)((i64)old.span_starts[tail + j] + delta);
+	memcpy(buf.identifier_hashes + identifier,
+	       old.identifier_hashes + tail_identifier_start,
+	       tail_identifier_count * sizeof(u64));
+	for (usize j = 0; j < tail_literal_count; j++) {
+		buf.literal_tokens[literal + j] =
+			old.literal_tokens[tail_literal_start + j] - tail +
+			tail_destination;
+		buf.literal_values[literal + j] =
+			old.literal_values[tail_literal_start + j];
+	}
+	usize tail_newline_destination =
+		prefix_newline_count + lexer.newline_count;
+	i64 identifier_delta =
+		(i64)identifier - (i64)tail_identifier_start;
+	for (usize j = 0; j < tail_newline_count; j++) {
+		u32 old_newline = old.lines.newlines[tail_newline_start + j];
+		buf.lines.newlines[tail_newline_destination + j] =
+			(u32)((i64)old_newline + delta);
+
+		u32 old_identifier_count =
+			old.newline_identifier_counts[tail_newline_start + j];
+		buf.newline_identifier_counts[tail_newline_destination + j] =
+			(u32)((i64)old_identifier_count + identifier_delta);
+	}
+
+	for (; long_span < old.long_span_count; long_span++) {
+		tokenLongSpan tail_long_span = old.long_spans[long_span];
+		if (tail_long_span.token < tail)
+			continue;
+		tail_long_span.token =
+			tail_long_span.token - tail + tail_destination;
+		arrayBuilderPush(&long_spans_builder, &tail_long_span);
+		buf.long_span_count++;
+	}
+
+	buf.long_spans =
+		bumpFinishArrayBuilder(&m->general, &long_spans_builder);
+	bumpClearToMark(&m->temp, mark);
+
 	return buf;
 }
 
+span tokenBufferSpan(tokenBuffer buf, usize token)
+{
+	assert(token < buf.count);
+	u32 start = buf.span_starts[token];
+	u8 length = buf.span_lengths[token];
+
+	if (length != LONG_SPAN_LENGTH)
+		return (span){ .start = start, .end = start + length };
+
+	usize low = 0;
+	usize high = buf.long_span_count;
+	while (low < high) {
+		usize middle = low + (high - low) / 2;
+		tokenLongSpan long_span = buf.long_spans[middle];
+
+		if (long_span.token == token)
+			return (span){
+				.start = start,
+				.end = start + long_span.length,
+			};
+
+		if (long_span.token < token)
+			low = middle + 1;
+		else
+			high = middle;
+	}
+
+	internalError("token %zu has no long span entry", token);
+	return (span){ 0 };
+}
+
+// Finds the first number token at or after the given token,
+// as an index into literal_tokens and literal_values.
+usize tokenBufferFirstLiteral(tokenBuffer buf, usize token)
+{
+	return firstAtLeast(buf.literal_tokens, buf.literal_count, token);
+}
+
+u64 tokenBufferLiteralValue(tokenBuffer buf, usize token)
+{
+	assert(token < buf.count);
+	assert(buf.kinds[token] == TOK_NUMBER);
+
+	usize literal = tokenBufferFirstLiteral(buf, token);
+	if (literal < buf.literal_count && buf.literal_tokens[literal] == token)
+		return buf.literal_values[literal];
+
+	internalError("token %zu has no literal entry", token);
+	return 0;
+}
+
+// Newline n ends line n, so the line an offset is on
+// is the number of newlines before it.
+u32 lineTableLine(lineTable lines, u32 offset)
+{
+	return firstAtLeast(lines.newlines, lines.count, offset);
+}
+
+u32 lineTableLineStart(lineTable lines, u32 line)
+{
+	assert(line <= lines.count);
+	return line == 0 ? 0 : lines.newlines[line - 1] + 1;
+}
+
+// The end of a line is the newline which ends it,
+// except for the last line, which runs to the end of the file.
+u32 lineTableLineEnd(lineTable lines, u32 line, usize length)
+{
+	assert(line <= lines.count);
+	return line == lines.count ? length : lines.newlines[line];
+}
+
+usize tokenBufferSpanBytes(tokenBuffer buf)
+{
+	return buf.count * (sizeof(u32) + sizeof(u8)) +
+	       buf.long_span_count * sizeof(tokenLongSpan);
+}
+
 const char *tokenKindShow(tokenKind kind)
 {
 	switch (kind) {
@@ -325,11 +1407,17 @@ void tokenBufferDebug(tokenBuffer buf, stringBuilder *sb)
 	stringBuilderPrintf(sb, "{");
 
 	for (usize i = 0; i < buf.count; i++) {
-		span span = buf.spans[i];
+		span span = tokenBufferSpan(buf, i);
 		tokenKind kind = buf.kinds[i];
 		stringBuilderPrintf(sb, "\n\t%s %u..%u", tokenKindDebug(kind),
 				    span.start, span.end);
 
+		if (kind == TOK_NUMBER)
+			stringBuilderPrintf(
+				sb, " (value: %llu)",
+				(unsigned long long)tokenBufferLiteralValue(
+					buf, i));
+
 		u32 id = buf.identifier_ids[i].raw;
 		if (id == (u32)-1)
 			continue;
@@ -348,10 +1436,146 @@ void tokenBufferDebugPrint(tokenBuffer buf, bump *b)
 	bumpClearToMark(b, mark);
 }
 
-char *lexTests(char *input, memory *m)
+bool tokenBuffersEqual(tokenBuffer a, tokenBuffer b)
+{
+	if (a.count != b.count || a.long_span_count != b.long_span_count ||
+	    a.identifier_count != b.identifier_count ||
+	    a.literal_count != b.literal_count ||
+	    a.lines.count != b.lines.count)
+		return false;
+
+	return memcmp(a.kinds, b.kinds, a.count * sizeof(tokenKind)) == 0 &&
+	       memcmp(a.span_starts, b.span_starts, a.count * sizeof(u32)) ==
+		       0 &&
+	       memcmp(a.span_lengths, b.span_lengths, a.count * sizeof(u8)) ==
+		       0 &&
+	       memcmp(a.identifier_ids, b.identifier_ids,
+		      a.count * sizeof(identifierId)) == 0 &&
+	       memcmp(a.long_spans, b.long_spans,
+		      a.long_span_count * sizeof(tokenLongSpan)) == 0 &&
+	       memcmp(a.identifier_hashes, b.identifier_hashes,
+		      a.identifier_count * sizeof(u64)) == 0 &&
+	       memcmp(a.literal_tokens, b.literal_tokens,
+		      a.literal_count * sizeof(u32)) == 0 &&
+	       memcmp(a.literal_values, b.literal_values,
+		      a.literal_count * sizeof(u64)) == 0 &&
+	       memcmp(a.lines.newlines, b.lines.newlines,
+		      a.lines.count * sizeof(u32)) == 0 &&
+	       memcmp(a.newline_identifier_counts, b.newline_identifier_counts,
+		      a.lines.count * sizeof(u32)) == 0;
+}
+
+// Relexing after an edit must produce the same tokens and diagnostics
+// as lexing the edited input from scratch.
+static void checkRelex(tokenBuffer buf, char *input, usize length,
+		       span edited, const char *insertion,
+		       diagnosticsStorage old_diagnostics, memory *m)
+{
+	bumpMark general_mark = bumpCreateMark(&m->general);
+	bumpMark temp_mark = bumpCreateMark(&m->temp);
+
+	u32 inserted_length = strlen(insertion);
+	char *new_content = bumpPrintf(&m->temp, "%.*s%s%.*s",
+				       (int)edited.start, input, insertion,
+				       (int)(length - edited.end),
+				       input + edited.end);
+	usize new_length = length - (edited.end - edited.start) +
+			   inserted_length;
+
+	diagnosticsStorage diagnostics = diagnosticsStorageCreate(&m->temp);
+	for (u16 i = 0; i < old_diagnostics.count; i++) {
+		char *message = (char *)(old_diagnostics.all_messages.top +
+					 old_diagnostics.message_starts[i]);
+		diagnosticsStorageRecord(&diagnostics,
+					 old_diagnostics.severities[i],
+					 old_diagnostics.spans[i], "%s",
+					 message);
+	}
+
+	tokenBuffer relexed = relex(buf, new_content, new_length, edited,
+				    inserted_length, &diagnostics, m);
+
+	diagnosticsStorage expected_diagnostics =
+		diagnosticsStorageCreate(&m->temp);
+	tokenBuffer expected =
+		lex(new_content, new_length, &expected_diagnostics, m);
+
+	assert(tokenBuffersEqual(relexed, expected));
+	assert(diagnosticsStorageEqual(diagnostics, expected_diagnostics));
+
+	bumpClearToMark(&m->temp, temp_mark);
+	bumpClearToMark(&m->general, general_mark);
+}
+
+// Edits at random places in the input, each inserting one of these.
+// They are chosen to start, end, split and join tokens and lines,
+// and to add and remove diagnostics.
+static const char *relex_insertions[] = {
+	"", "x", " ", "\n", "12", "99999999999999999999999", "//", "$",
+	"func", ":=", "abc def", "\n\n", "(",
+};
+
+enum { RELEX_EDIT_COUNT = 256, RELEX_MAX_REMOVED = 16 };
+
+static void checkRandomRelexes(tokenBuffer buf, char *input, usize length,
+			       diagnosticsStorage diagnostics, memory *m)
+{
+	// xorshift64, so that the edits are the same from one run to the next
+	u64 random = 0x9e3779b97f4a7c15;
+	for (u32 i = 0; i < RELEX_EDIT_COUNT; i++) {
+		random ^= random << 13;
+		random ^= random >> 7;
+		random ^= random << 17;
+
+		u32 start = random % (length + 1);
+		u32 removed = (random >> 16) % (RELEX_MAX_REMOVED + 1);
+		if (removed > length - start)
+			removed = length - start;
+		const char *insertion =
+			relex_insertions[(random >> 32) %
+					 (sizeof(relex_insertions) /
+					  sizeof(relex_insertions[0]))];
+
+		checkRelex(buf, input, length,
+			   (span){ .start = start, .end = start + removed },
+			   insertion, diagnostics, m);
+	}
+}
+
+// The line table must agree with counting newlines by hand.
+static void checkLineTable(lineTable lines, char *input, usize length)
+{
+	u32 line = 0;
+	for (usize i = 0; i <= length; i++) {
+		assert(lineTableLine(lines, i) == line);
+
+		assert(lineTableLineStart(lines, line) <= i);
+		assert(i <= lineTableLineEnd(lines, line, length));
+
+		if (i < length && input[i] == '\n')
+			line++;
+	}
+	assert(line == lines.count);
+}
+
+char *lexTests(char *input, usize length, memory *m)
 {
 	diagnosticsStorage diagnostics = diagnosticsStorageCreate(&m->general);
-	tokenBuffer buf = lex(input, &diagnostics, m);
+	tokenBuffer buf = lex(input, length, &diagnostics, m);
+	checkLineTable(buf.lines, input, length);
+
+	// Lexing in chunks must produce exactly the same tokens and diagnostics
+	// as lexing serially, even for inputs far too small to be worth it.
+	diagnosticsStorage scratch_diagnostics =
+		diagnosticsStorageCreate(&m->general);
+	tokenBuffer chunked =
+		lexChunked(input, length, 3, &scratch_diagnostics, m);
+	assert(tokenBuffersEqual(buf, chunked));
+	assert(diagnosticsStorageEqual(scratch_diagnostics, diagnostics));
+
+	checkRandomRelexes(buf, input, length, diagnostics, m);
+	growableInternerCheckParallel(buf, input, m);
+
 	stringBuilder sb = stringBuilderCreate(&m->temp);
 	tokenBufferDebug(buf, &sb);
 	diagnosticsStorageDebug(diagnostics, &sb);
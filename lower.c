@@ -1,9 +1,10 @@
 #include "minic.h"
 
 enum {
-	MAX_NODE_COUNT = 63 * 1024,
-	MAX_LOCAL_COUNT = 63 * 1024,
-	MAX_TYPE_COUNT = 63 * 1024,
+	// Arrays which turn out to be too small grow to at least this size.
+	MIN_GROWN_CAPACITY = 16,
+
+	MIN_STACK_CAPACITY = 64,
 };
 
 typedef struct fullNode {
@@ -18,16 +19,133 @@ typedef struct fullType {
 	hirTypeKind kind;
 } fullType;
 
+// What’s left to do for an expression or statement.
+// The AST is lowered with an explicit stack of these
+// rather than by recursion, so that deeply nested code
+// can’t overflow the C stack.
+typedef enum lowerStep {
+	STEP_EXPRESSION,
+	STEP_EXPRESSION_NO_MODIFY_USED,
+	STEP_STATEMENT,
+
+	// allocates the node on top of the node stack
+	// and pushes its handle onto the allocated stack
+	STEP_ALLOCATE,
+
+	STEP_BINARY_OPERATION,
+	STEP_ADDRESS_OF,
+	STEP_DEREFERENCE,
+	STEP_INDEX,
+	STEP_ARRAY_ELEMENT,
+	STEP_RETURN,
+	STEP_LOCAL_DEFINITION,
+	STEP_ASSIGN,
+	STEP_IF,
+	STEP_WHILE,
+	STEP_BLOCK,
+} lowerStep;
+
+typedef struct lowerWork {
+	u32 ast_index;
+
+	// which element of an array literal was just lowered,
+	// and the type of the elements before it
+	u32 element;
+	hirType type;
+
+	lowerStep step;
+} lowerWork;
+
 typedef struct ctx {
 	hirRoot hir;
 	astRoot ast;
 	diagnosticsStorage *diagnostics;
 	bool *local_used;
+
+	// The HIR’s arrays are allocated straight into general memory
+	// and are moved to larger allocations if they fill up.
+	// Temporary memory is no good for this,
+	// since it’s cleared as soon as lowering is done.
+	bump *general;
+	u32 function_capacity;
+	u32 node_capacity;
+	u32 local_capacity;
+	u32 type_capacity;
+
+	// The work stack and the stacks of nodes
+	// waiting for whatever they’re part of to be finished
+	// are kept in temporary memory
+	// and are moved to larger allocations if they fill up.
+	bump *temp;
+	lowerWork *work;
+	u32 work_count;
+	u32 work_capacity;
+	fullNode *node_stack;
+	u32 node_stack_count;
+	u32 node_stack_capacity;
+	hirNode *allocated;
+	u32 allocated_count;
+	u32 allocated_capacity;
 } ctx;
 
+// Indices are 32-bit, and -1 is reserved to mean “none”.
+static u32 grownCapacity(u32 capacity)
+{
+	assert(capacity <= (u32)-1 / 2);
+	if (capacity < MIN_GROWN_CAPACITY / 2)
+		return MIN_GROWN_CAPACITY;
+	return capacity * 2;
+}
+
+static void growNodes(ctx *c, u32 capacity)
+{
+	u32 count = c->hir.node_count;
+	c->hir.nodes = bumpGrowArray(hirNodeData, c->general, c->hir.nodes,
+				     count, capacity);
+	c->hir.node_kinds = bumpGrowArray(hirNodeKind, c->general,
+					  c->hir.node_kinds, count, capacity);
+	c->hir.node_types = bumpGrowArray(hirType, c->general,
+					  c->hir.node_types, count, capacity);
+	c->hir.node_spans = bumpGrowArray(span, c->general, c->hir.node_spans,
+					  count, capacity);
+	c->node_capacity = capacity;
+}
+
+static void growLocals(ctx *c, u32 capacity)
+{
+	u32 count = c->hir.local_count;
+	c->hir.local_names = bumpGrowArray(identifierId, c->general,
+					   c->hir.local_names, count, capacity);
+	c->hir.local_types = bumpGrowArray(hirType, c->general,
+					   c->hir.local_types, count, capacity);
+	c->hir.local_spans = bumpGrowArray(span, c->general,
+					   c->hir.local_spans, count, capacity);
+	c->local_used = bumpGrowArray(bool, c->general, c->local_used, count,
+				      capacity);
+	c->local_capacity = capacity;
+}
+
+static void growTypes(ctx *c, u32 capacity)
+{
+	u32 count = c->hir.type_count;
+	c->hir.types = bumpGrowArray(hirTypeData, c->general, c->hir.types,
+				     count, capacity);
+	c->hir.type_kinds = bumpGrowArray(hirTypeKind, c->general,
+					  c->hir.type_kinds, count, capacity);
+	c->type_capacity = capacity;
+}
+
+static void growFunctions(ctx *c, u32 capacity)
+{
+	u32 count = c->hir.function_count;
+	c->hir.functions = bumpGrowArray(hirFunction, c->general,
+					 c->hir.functions, count, capacity);
+	c->function_capacity = capacity;
+}
+
 static hirLocal lookupLocal(ctx *c, identifierId name)
 {
-	for (u16 i = c->hir.current_function_locals_start.index;
+	for (u32 i = c->hir.current_function_locals_start.index;
 	     i < c->hir.local_count; i++)
 		if (c->hir.local_names[i].raw == name.raw)
 			return hirLocalMake(i);
@@ -36,14 +154,10 @@ static hirLocal lookupLocal(ctx *c, identifierId name)
 
 static hirNode allocateNode(ctx *c, fullNode node)
 {
-	if (c->hir.node_count >= MAX_NODE_COUNT) {
-		diagnosticsStorageRecord(c->diagnostics, DIAG_ERROR, node.span,
-					 "reached limit of %u nodes",
-					 MAX_NODE_COUNT);
-		internalError("ran out of node slots");
-	}
+	u32 i = c->hir.node_count;
+	if (i == c->node_capacity)
+		growNodes(c, grownCapacity(i));
 
-	u16 i = c->hir.node_count;
 	c->hir.node_count++;
 	c->hir.nodes[i] = node.data;
 	c->hir.node_kinds[i] = node.kind;
@@ -55,9 +169,10 @@ static hirNode allocateNode(ctx *c, fullNode node)
 static hirLocal allocateLocal(ctx *c, identifierId name, hirType type,
 			      span span)
 {
-	assert(c->hir.local_count < MAX_LOCAL_COUNT);
+	u32 i = c->hir.local_count;
+	if (i == c->local_capacity)
+		growLocals(c, grownCapacity(i));
 
-	u16 i = c->hir.local_count;
 	c->hir.local_count++;
 
 	c->hir.local_names[i] = name;
@@ -71,9 +186,7 @@ static hirLocal allocateLocal(ctx *c, identifierId name, hirType type,
 
 static hirType allocateType(ctx *c, hirTypeKind kind, hirTypeData data)
 {
-	assert(c->hir.type_count < MAX_TYPE_COUNT);
-
-	for (u16 i = 0; i < c->hir.type_count; i++) {
+	for (u32 i = 0; i < c->hir.type_count; i++) {
 		if (c->hir.type_kinds[i] != kind)
 			continue;
 		if (memcmp(&c->hir.types[i], &data, sizeof(hirTypeData)) != 0)
@@ -81,7 +194,10 @@ static hirType allocateType(ctx *c, hirTypeKind kind, hirTypeData data)
 		return hirTypeMake(i);
 	}
 
-	u16 i = c->hir.type_count;
+	u32 i = c->hir.type_count;
+	if (i == c->type_capacity)
+		growTypes(c, grownCapacity(i));
+
 	c->hir.type_count++;
 
 	c->hir.types[i] = data;
@@ -89,11 +205,186 @@ static hirType allocateType(ctx *c, hirTypeKind kind, hirTypeData data)
 	return hirTypeMake(i);
 }
 
-static fullNode lowerExpression(ctx *c, astExpression ast_expression,
-				memory *m);
+static void pushFunction(ctx *c, hirFunction function)
+{
+	u32 i = c->hir.function_count;
+	if (i == c->function_capacity)
+		growFunctions(c, grownCapacity(i));
+
+	c->hir.function_count++;
+	c->hir.functions[i] = function;
+}
+
+static void pushNode(ctx *c, fullNode node)
+{
+	if (c->node_stack_count == c->node_stack_capacity) {
+		u32 capacity = c->node_stack_capacity * 2;
+		c->node_stack =
+			bumpGrowArray(fullNode, c->temp, c->node_stack,
+				      c->node_stack_count, capacity);
+		c->node_stack_capacity = capacity;
+	}
+
+	c->node_stack[c->node_stack_count++] = node;
+}
+
+static fullNode popNode(ctx *c)
+{
+	assert(c->node_stack_count > 0);
+	return c->node_stack[--c->node_stack_count];
+}
+
+static void pushAllocated(ctx *c, hirNode node)
+{
+	if (c->allocated_count == c->allocated_capacity) {
+		u32 capacity = c->allocated_capacity * 2;
+		c->allocated = bumpGrowArray(hirNode, c->temp, c->allocated,
+					     c->allocated_count, capacity);
+		c->allocated_capacity = capacity;
+	}
+
+	c->allocated[c->allocated_count++] = node;
+}
+
+static hirNode popAllocated(ctx *c)
+{
+	assert(c->allocated_count > 0);
+	return c->allocated[--c->allocated_count];
+}
+
+static lowerWork *pushWork(ctx *c, lowerStep step, u32 ast_index)
+{
+	if (c->work_count == c->work_capacity) {
+		u32 capacity = c->work_capacity * 2;
+		c->work = bumpGrowArray(lowerWork, c->temp, c->work,
+					c->work_count, capacity);
+		c->work_capacity = capacity;
+	}
+
+	lowerWork *work = &c->work[c->work_count++];
+	*work = (lowerWork){
+		.ast_index = ast_index,
+		.type = hirTypeMake(-1),
+		.step = step,
+	};
+	return work;
+}
+
+// Lowers an expression and allocates the node it produces.
+// Steps are pushed in reverse so that they run in order.
+static void pushAllocatedExpression(ctx *c, astExpression ast_expression)
+{
+	pushWork(c, STEP_ALLOCATE, -1);
+	pushWork(c, STEP_EXPRESSION, ast_expression.index);
+}
+
+static void pushAllocatedStatement(ctx *c, astStatement ast_statement)
+{
+	pushWork(c, STEP_ALLOCATE, -1);
+	pushWork(c, STEP_STATEMENT, ast_statement.index);
+}
+
+static fullNode missingNode(ctx *c, span span)
+{
+	hirTypeData type_data;
+	memset(&type_data, 0, sizeof(type_data));
+
+	fullNode n;
+	memset(&n, 0, sizeof(n));
+	n.kind = HIR_MISSING;
+	n.type = allocateType(c, HIR_TYPE_VOID, type_data);
+	n.span = span;
+	return n;
+}
+
+static void finishNode(ctx *c, fullNode n)
+{
+	assert(n.kind != (hirNodeKind)-1);
+	assert(n.type.index != (u32)-1);
+	pushNode(c, n);
+}
+
+// Lowers element of the array literal ast_expression,
+// or finishes the array literal once every element has been lowered.
+static void nextArrayElement(ctx *c, astExpression ast_expression,
+			     u32 element, hirType child_type)
+{
+	astArrayLiteral ast_array_literal =
+		astGetExpression(c->ast, ast_expression).array_literal;
+
+	if (element < ast_array_literal.count) {
+		lowerWork *work = pushWork(c, STEP_ARRAY_ELEMENT,
+					   ast_expression.index);
+		work->element = element;
+		work->type = child_type;
+		pushWork(c, STEP_EXPRESSION,
+			 ast_array_literal.start.index + element);
+		return;
+	}
+
+	// The elements are the last nodes pushed.
+	u32 base = c->node_stack_count - ast_array_literal.count;
+	hirNode start = hirNodeMake(-1);
+
+	for (u32 i = 0; i < ast_array_literal.count; i++) {
+		hirNode this = allocateNode(c, c->node_stack[base + i]);
+		if (start.index == (u32)-1)
+			start = this;
+	}
+
+	c->node_stack_count = base;
+
+	hirArray array_type = {
+		.child_type = child_type,
+		.count = ast_array_literal.count,
+	};
 
-static fullNode lowerExpressionInner(ctx *c, astExpression ast_expression,
-				     bool should_modify_used, memory *m)
+	fullNode n;
+	memset(&n, 0, sizeof(n));
+	n.span = astGetExpressionSpan(c->ast, ast_expression);
+	n.kind = HIR_ARRAY_LITERAL;
+	n.type = allocateType(c, HIR_TYPE_ARRAY,
+			      (hirTypeData){ .array = array_type });
+	n.data.array_literal.start = start;
+	n.data.array_literal.count = ast_array_literal.count;
+	finishNode(c, n);
+}
+
+// Checks the element just lowered against the array’s element type.
+static void finishArrayElement(ctx *c, lowerWork work)
+{
+	fullNode *node = &c->node_stack[c->node_stack_count - 1];
+	hirType child_type = work.type;
+
+	if (hirGetTypeKind(c->hir, child_type) == HIR_TYPE_VOID) {
+		child_type = node->type;
+	} else if (node->type.index != child_type.index) {
+		u8 buffer[128];
+		bump b = bumpCreate(buffer, sizeof(buffer));
+		stringBuilder sb = stringBuilderCreate(&b);
+		stringBuilderPrintf(&sb, "expected “");
+		hirTypeShow(c->hir, child_type, &sb);
+		stringBuilderPrintf(&sb, "” but found “");
+		hirTypeShow(c->hir, node->type, &sb);
+		stringBuilderPrintf(&sb, "”");
+
+		char *message = stringBuilderFinish(sb);
+		diagnosticsStorageRecord(c->diagnostics, DIAG_ERROR,
+					 node->span, "%s", message);
+
+		// Since we’re reusing the faulty node
+		// instead of just creating a new missing node,
+		// we make sure to zero out the node data
+		// just to be on the safe side.
+		*node = missingNode(c, node->span);
+	}
+
+	nextArrayElement(c, astExpressionMake(work.ast_index),
+			 work.element + 1, child_type);
+}
+
+static void lowerExpression(ctx *c, astExpression ast_expression,
+			    bool should_modify_used)
 {
 	fullNode n;
 	memset(&n, 0, sizeof(n));
@@ -102,14 +393,9 @@ static fullNode lowerExpressionInner(ctx *c, astExpression ast_expression,
 	n.span = astGetExpressionSpan(c->ast, ast_expression);
 
 	switch (astGetExpressionKind(c->ast, ast_expression)) {
-	case AST_EXPR_MISSING: {
-		hirTypeData type_data;
-		memset(&type_data, 0, sizeof(type_data));
-
-		n.kind = HIR_MISSING;
-		n.type = allocateType(c, HIR_TYPE_VOID, type_data);
+	case AST_EXPR_MISSING:
+		n = missingNode(c, n.span);
 		break;
-	}
 
 	case AST_EXPR_INT_LITERAL: {
 		astIntLiteral ast_int_literal =
@@ -128,26 +414,17 @@ static fullNode lowerExpressionInner(ctx *c, astExpression ast_expression,
 			astGetExpression(c->ast, ast_expression).variable;
 
 		if (ast_variable.name.raw == (u32)-1) {
-			hirTypeData type_data;
-			memset(&type_data, 0, sizeof(type_data));
-
-			n.kind = HIR_MISSING;
-			n.type = allocateType(c, HIR_TYPE_VOID, type_data);
+			n = missingNode(c, n.span);
 			break;
 		}
 
 		hirLocal local = lookupLocal(c, ast_variable.name);
-		if (local.index == (u16)-1) {
+		if (local.index == (u32)-1) {
 			diagnosticsStorageRecord(
 				c->diagnostics, DIAG_ERROR,
 				astGetExpressionSpan(c->ast, ast_expression),
 				"undefined variable");
-
-			hirTypeData type_data;
-			memset(&type_data, 0, sizeof(type_data));
-
-			n.kind = HIR_MISSING;
-			n.type = allocateType(c, HIR_TYPE_VOID, type_data);
+			n = missingNode(c, n.span);
 			break;
 		}
 
@@ -164,264 +441,207 @@ static fullNode lowerExpressionInner(ctx *c, astExpression ast_expression,
 		astBinaryOperation ast_binary_operation =
 			astGetExpression(c->ast, ast_expression)
 				.binary_operation;
-
-		hirNode lhs = allocateNode(
-			c, lowerExpression(c, ast_binary_operation.lhs, m));
-		hirNode rhs = allocateNode(
-			c, lowerExpression(c, ast_binary_operation.rhs, m));
-
-		n.kind = HIR_BINARY_OPERATION;
-		n.type = hirGetNodeType(c->hir, lhs);
-		n.data.binary_operation.lhs = lhs;
-		n.data.binary_operation.rhs = rhs;
-		n.data.binary_operation.op = ast_binary_operation.op;
-		break;
+		pushWork(c, STEP_BINARY_OPERATION, ast_expression.index);
+		pushAllocatedExpression(c, ast_binary_operation.rhs);
+		pushAllocatedExpression(c, ast_binary_operation.lhs);
+		return;
 	}
 
 	case AST_EXPR_ADDRESS_OF: {
 		astAddressOf ast_address_of =
 			astGetExpression(c->ast, ast_expression).address_of;
-
-		hirNode value = allocateNode(
-			c, lowerExpression(c, ast_address_of.value, m));
-
-		hirTypeData type_data;
-		memset(&type_data, 0, sizeof(type_data));
-		type_data.pointer.child_type = hirGetNodeType(c->hir, value);
-
-		n.kind = HIR_ADDRESS_OF;
-		n.type = allocateType(c, HIR_TYPE_POINTER, type_data);
-		n.data.address_of.value = value;
-		break;
+		pushWork(c, STEP_ADDRESS_OF, ast_expression.index);
+		pushAllocatedExpression(c, ast_address_of.value);
+		return;
 	}
 
 	case AST_EXPR_DEREFERENCE: {
 		astDereference ast_dereference =
 			astGetExpression(c->ast, ast_expression).dereference;
-
-		hirNode value = allocateNode(
-			c, lowerExpression(c, ast_dereference.value, m));
-
-		hirType value_type = hirGetNodeType(c->hir, value);
-		if (hirGetTypeKind(c->hir, value_type) != HIR_TYPE_POINTER) {
-			u8 buffer[128];
-			bump b = bumpCreate(buffer, sizeof(buffer));
-			stringBuilder sb = stringBuilderCreate(&b);
-
-			stringBuilderPrintf(
-				&sb, "cannot dereference non-pointer type “");
-			hirTypeShow(c->hir, value_type, &sb);
-			stringBuilderPrintf(&sb, "”");
-
-			char *message = stringBuilderFinish(sb);
-			diagnosticsStorageRecord(c->diagnostics, DIAG_ERROR,
-						 hirGetNodeSpan(c->hir, value),
-						 message);
-
-			hirTypeData type_data;
-			memset(&type_data, 0, sizeof(type_data));
-
-			n.kind = HIR_MISSING;
-			n.type = allocateType(c, HIR_TYPE_VOID, type_data);
-			break;
-		}
-
-		hirType child_type =
-			hirGetType(c->hir, value_type).pointer.child_type;
-
-		n.kind = HIR_DEREFERENCE;
-		n.type = child_type;
-		n.data.dereference.value = value;
-		break;
+		pushWork(c, STEP_DEREFERENCE, ast_expression.index);
+		pushAllocatedExpression(c, ast_dereference.value);
+		return;
 	}
 
 	case AST_EXPR_INDEX: {
 		astIndex ast_index =
 			astGetExpression(c->ast, ast_expression).index;
-
-		hirNode array =
-			allocateNode(c, lowerExpression(c, ast_index.array, m));
-		hirNode index =
-			allocateNode(c, lowerExpression(c, ast_index.index, m));
-
-		hirType index_type = hirGetNodeType(c->hir, index);
-		if (hirGetTypeKind(c->hir, index_type) != HIR_TYPE_I64) {
-			u8 buffer[128];
-			bump b = bumpCreate(buffer, sizeof(buffer));
-			stringBuilder sb = stringBuilderCreate(&b);
-			stringBuilderPrintf(&sb, "index is non-integer type “");
-			hirTypeShow(c->hir, index_type, &sb);
-			stringBuilderPrintf(&sb, "”");
-			char *message = stringBuilderFinish(sb);
-			diagnosticsStorageRecord(c->diagnostics, DIAG_ERROR,
-						 hirGetNodeSpan(c->hir, array),
-						 message);
-
-			hirTypeData type_data;
-			memset(&type_data, 0, sizeof(type_data));
-
-			n.kind = HIR_MISSING;
-			n.type = allocateType(c, HIR_TYPE_VOID, type_data);
-			break;
-		}
-
-		hirType array_type = hirGetNodeType(c->hir, array);
-		if (hirGetTypeKind(c->hir, array_type) != HIR_TYPE_ARRAY) {
-			u8 buffer[128];
-			bump b = bumpCreate(buffer, sizeof(buffer));
-			stringBuilder sb = stringBuilderCreate(&b);
-			stringBuilderPrintf(
-				&sb, "cannot index into non-array type “");
-			hirTypeShow(c->hir, array_type, &sb);
-			stringBuilderPrintf(&sb, "”");
-			char *message = stringBuilderFinish(sb);
-			diagnosticsStorageRecord(c->diagnostics, DIAG_ERROR,
-						 hirGetNodeSpan(c->hir, array),
-						 message);
-
-			hirTypeData type_data;
-			memset(&type_data, 0, sizeof(type_data));
-
-			n.kind = HIR_MISSING;
-			n.type = allocateType(c, HIR_TYPE_VOID, type_data);
-			break;
-		}
-
-		hirType array_child_type =
-			hirGetType(c->hir, array_type).array.child_type;
-
-		n.kind = HIR_INDEX;
-		n.type = array_child_type;
-		n.data.index.array = array;
-		n.data.index.index = index;
-		break;
+		pushWork(c, STEP_INDEX, ast_expression.index);
+		pushAllocatedExpression(c, ast_index.index);
+		pushAllocatedExpression(c, ast_index.array);
+		return;
 	}
 
 	case AST_EXPR_ARRAY_LITERAL: {
-		astArrayLiteral ast_array_literal =
-			astGetExpression(c->ast, ast_expression).array_literal;
-
-		bumpMark mark = bumpCreateMark(&m->temp);
-		arrayBuilder nodes_builder =
-			bumpStartArrayBuilder(&m->temp, sizeof(fullNode));
-
+		// Elements are lowered one at a time,
+		// since each is checked against the type of those before it.
 		hirTypeData child_type_data;
 		memset(&child_type_data, 0, sizeof(child_type_data));
 		hirType child_type =
 			allocateType(c, HIR_TYPE_VOID, child_type_data);
+		nextArrayElement(c, ast_expression, 0, child_type);
+		return;
+	}
+	}
 
-		for (u16 i = 0; i < ast_array_literal.count; i++) {
-			astExpression ast_e = astExpressionMake(
-				ast_array_literal.start.index + i);
-
-			fullNode node = lowerExpression(c, ast_e, m);
-
-			if (hirGetTypeKind(c->hir, child_type) ==
-			    HIR_TYPE_VOID) {
-				child_type = node.type;
-			} else if (node.type.index != child_type.index) {
-				u8 buffer[128];
-				bump b = bumpCreate(buffer, sizeof(buffer));
-				stringBuilder sb = stringBuilderCreate(&b);
-				stringBuilderPrintf(&sb, "expected “");
-				hirTypeShow(c->hir, child_type, &sb);
-				stringBuilderPrintf(&sb, "” but found “");
-				hirTypeShow(c->hir, node.type, &sb);
-				stringBuilderPrintf(&sb, "”");
-
-				char *message = stringBuilderFinish(sb);
-				diagnosticsStorageRecord(c->diagnostics,
-							 DIAG_ERROR, node.span,
-							 message);
-
-				hirTypeData type_data;
-				memset(&type_data, 0, sizeof(type_data));
-
-				// Since we’re reusing the faulty node
-				// instead of just creating a new missing node,
-				// we make sure to zero out the node data
-				// just to be on the safe side.
-				node.kind = HIR_MISSING;
-				memset(&node.data, 0, sizeof(node.data));
-				node.type = allocateType(c, HIR_TYPE_VOID,
-							 type_data);
-			}
-
-			arrayBuilderPush(&nodes_builder, &node);
-		}
+	finishNode(c, n);
+}
 
-		fullNode *nodes =
-			bumpFinishArrayBuilder(&m->temp, &nodes_builder);
+static void finishBinaryOperation(ctx *c, astExpression ast_expression)
+{
+	astBinaryOperation ast_binary_operation =
+		astGetExpression(c->ast, ast_expression).binary_operation;
+	hirNode rhs = popAllocated(c);
+	hirNode lhs = popAllocated(c);
 
-		hirNode start = hirNodeMake(-1);
+	fullNode n;
+	memset(&n, 0, sizeof(n));
+	n.span = astGetExpressionSpan(c->ast, ast_expression);
+	n.kind = HIR_BINARY_OPERATION;
+	n.type = hirGetNodeType(c->hir, lhs);
+	n.data.binary_operation.lhs = lhs;
+	n.data.binary_operation.rhs = rhs;
+	n.data.binary_operation.op = ast_binary_operation.op;
+	finishNode(c, n);
+}
 
-		for (u16 i = 0; i < ast_array_literal.count; i++) {
-			hirNode this = allocateNode(c, nodes[i]);
-			if (start.index == (u16)-1)
-				start = this;
-		}
+static void finishAddressOf(ctx *c, astExpression ast_expression)
+{
+	hirNode value = popAllocated(c);
 
-		bumpClearToMark(&m->temp, mark);
+	hirTypeData type_data;
+	memset(&type_data, 0, sizeof(type_data));
+	type_data.pointer.child_type = hirGetNodeType(c->hir, value);
 
-		hirArray array_type = {
-			.child_type = child_type,
-			.count = ast_array_literal.count,
-		};
+	fullNode n;
+	memset(&n, 0, sizeof(n));
+	n.span = astGetExpressionSpan(c->ast, ast_expression);
+	n.kind = HIR_ADDRESS_OF;
+	n.type = allocateType(c, HIR_TYPE_POINTER, type_data);
+	n.data.address_of.value = value;
+	finishNode(c, n);
+}
 
-		n.kind = HIR_ARRAY_LITERAL;
-		n.type = allocateType(c, HIR_TYPE_ARRAY,
-				      (hirTypeData){ .array = array_type });
-		n.data.array_literal.start = start;
-		n.data.array_literal.count = ast_array_literal.count;
-		break;
-	}
+static void finishDereference(ctx *c, astExpression ast_expression)
+{
+	hirNode value = popAllocated(c);
+	span span = astGetExpressionSpan(c->ast, ast_expression);
+
+	hirType value_type = hirGetNodeType(c->hir, value);
+	if (hirGetTypeKind(c->hir, value_type) != HIR_TYPE_POINTER) {
+		u8 buffer[128];
+		bump b = bumpCreate(buffer, sizeof(buffer));
+		stringBuilder sb = stringBuilderCreate(&b);
+
+		stringBuilderPrintf(&sb,
+				    "cannot dereference non-pointer type “");
+		hirTypeShow(c->hir, value_type, &sb);
+		stringBuilderPrintf(&sb, "”");
+
+		char *message = stringBuilderFinish(sb);
+		diagnosticsStorageRecord(c->diagnostics, DIAG_ERROR,
+					 hirGetNodeSpan(c->hir, value),
+					 "%s", message);
+
+		finishNode(c, missingNode(c, span));
+		return;
 	}
 
-	assert(n.kind != (hirNodeKind)-1);
-	assert(n.type.index != (u16)-1);
-	return n;
-}
+	hirType child_type = hirGetType(c->hir, value_type).pointer.child_type;
 
-static fullNode lowerExpression(ctx *c, astExpression ast_expression, memory *m)
-{
-	return lowerExpressionInner(c, ast_expression, true, m);
+	fullNode n;
+	memset(&n, 0, sizeof(n));
+	n.span = span;
+	n.kind = HIR_DEREFERENCE;
+	n.type = child_type;
+	n.data.dereference.value = value;
+	finishNode(c, n);
 }
 
-static fullNode
-lowerExpressionNoModifyUsed(ctx *c, astExpression ast_expression, memory *m)
+static void finishIndex(ctx *c, astExpression ast_expression)
 {
-	return lowerExpressionInner(c, ast_expression, false, m);
+	hirNode index = popAllocated(c);
+	hirNode array = popAllocated(c);
+	span span = astGetExpressionSpan(c->ast, ast_expression);
+
+	hirType index_type = hirGetNodeType(c->hir, index);
+	if (hirGetTypeKind(c->hir, index_type) != HIR_TYPE_I64) {
+		u8 buffer[128];
+		bump b = bumpCreate(buffer, sizeof(buffer));
+		stringBuilder sb = stringBuilderCreate(&b);
+		stringBuilderPrintf(&sb, "index is non-integer type “");
+		hirTypeShow(c->hir, index_type, &sb);
+		stringBuilderPrintf(&sb, "”");
+		char *message = stringBuilderFinish(sb);
+		diagnosticsStorageRecord(c->diagnostics, DIAG_ERROR,
+					 hirGetNodeSpan(c->hir, array),
+					 "%s", message);
+
+		finishNode(c, missingNode(c, span));
+		return;
+	}
+
+	hirType array_type = hirGetNodeType(c->hir, array);
+	if (hirGetTypeKind(c->hir, array_type) != HIR_TYPE_ARRAY) {
+		u8 buffer[128];
+		bump b = bumpCreate(buffer, sizeof(buffer));
+		stringBuilder sb = stringBuilderCreate(&b);
+		stringBuilderPrintf(&sb,
+				    "cannot index into non-array type “");
+		hirTypeShow(c->hir, array_type, &sb);
+		stringBuilderPrintf(&sb, "”");
+		char *message = stringBuilderFinish(sb);
+		diagnosticsStorageRecord(c->diagnostics, DIAG_ERROR,
+					 hirGetNodeSpan(c->hir, array),
+					 "%s", message);
+
+		finishNode(c, missingNode(c, span));
+		return;
+	}
+
+	hirType array_child_type =
+		hirGetType(c->hir, array_type).array.child_type;
+
+	fullNode n;
+	memset(&n, 0, sizeof(n));
+	n.span = span;
+	n.kind = HIR_INDEX;
+	n.type = array_child_type;
+	n.data.index.array = array;
+	n.data.index.index = index;
+	finishNode(c, n);
 }
 
-static fullNode lowerStatement(ctx *c, astStatement ast_statement, memory *m)
+static fullNode voidNode(ctx *c, astStatement ast_statement, hirNodeKind kind)
 {
+	hirTypeData type_data;
+	memset(&type_data, 0, sizeof(type_data));
+
 	fullNode n;
 	memset(&n, 0, sizeof(n));
-	n.kind = -1;
-	n.type = hirTypeMake(-1);
 	n.span = astGetStatementSpan(c->ast, ast_statement);
+	n.kind = kind;
+	n.type = allocateType(c, HIR_TYPE_VOID, type_data);
+	return n;
+}
 
-	switch (astGetStatementKind(c->ast, ast_statement)) {
-	case AST_STMT_MISSING: {
-		hirTypeData type_data;
-		memset(&type_data, 0, sizeof(type_data));
+static void lowerStatement(ctx *c, astStatement ast_statement)
+{
+	span span = astGetStatementSpan(c->ast, ast_statement);
 
-		n.kind = HIR_MISSING;
-		n.type = allocateType(c, HIR_TYPE_VOID, type_data);
+	switch (astGetStatementKind(c->ast, ast_statement)) {
+	case AST_STMT_MISSING:
+		finishNode(c, missingNode(c, span));
 		break;
-	}
 
 	case AST_STMT_RETURN: {
 		astReturn ast_retrn =
 			astGetStatement(c->ast, ast_statement).retrn;
 
-		hirTypeData type_data;
-		memset(&type_data, 0, sizeof(type_data));
-
-		n.kind = HIR_RETURN;
-		n.type = allocateType(c, HIR_TYPE_VOID, type_data);
-		n.data.retrn.value =
-			allocateNode(c, lowerExpression(c, ast_retrn.value, m));
+		// The node’s type is allocated before anything inside it.
+		pushNode(c, voidNode(c, ast_statement, HIR_RETURN));
+		pushWork(c, STEP_RETURN, ast_statement.index);
+		pushAllocatedExpression(c, ast_retrn.value);
 		break;
 	}
 
@@ -431,210 +651,278 @@ static fullNode lowerStatement(ctx *c, astStatement ast_statement, memory *m)
 
 		hirLocal existing_local =
 			lookupLocal(c, ast_local_definition.name);
-		if (existing_local.index != (u16)-1) {
+		if (existing_local.index != (u32)-1) {
 			diagnosticsStorageRecord(
-				c->diagnostics, DIAG_ERROR,
-				astGetStatementSpan(c->ast, ast_statement),
+				c->diagnostics, DIAG_ERROR, span,
 				"cannot shadow existing variable");
-
-			hirTypeData type_data;
-			memset(&type_data, 0, sizeof(type_data));
-
-			n.kind = HIR_MISSING;
-			n.type = allocateType(c, HIR_TYPE_VOID, type_data);
+			finishNode(c, missingNode(c, span));
 			break;
 		}
 
-		hirNode rhs = allocateNode(
-			c, lowerExpression(c, ast_local_definition.value, m));
-
-		if (ast_local_definition.name.raw == (u32)-1) {
-			hirTypeData type_data;
-			memset(&type_data, 0, sizeof(type_data));
-
-			n.kind = HIR_MISSING;
-			n.type = allocateType(c, HIR_TYPE_VOID, type_data);
-			break;
-		}
-
-		hirLocal local = allocateLocal(
-			c, ast_local_definition.name,
-			hirGetNodeType(c->hir, rhs),
-			astGetStatementSpan(c->ast, ast_statement));
-
-		fullNode lhs_unallocd;
-		memset(&lhs_unallocd, 0, sizeof(lhs_unallocd));
-		lhs_unallocd.data.variable.local = local;
-		lhs_unallocd.kind = HIR_VARIABLE;
-		lhs_unallocd.type = hirGetLocalType(c->hir, local);
-		hirNode lhs = allocateNode(c, lhs_unallocd);
-
-		hirTypeData type_data;
-		memset(&type_data, 0, sizeof(type_data));
-
-		n.kind = HIR_ASSIGN;
-		n.type = allocateType(c, HIR_TYPE_VOID, type_data);
-		n.data.assign.lhs = lhs;
-		n.data.assign.rhs = rhs;
+		pushWork(c, STEP_LOCAL_DEFINITION, ast_statement.index);
+		pushAllocatedExpression(c, ast_local_definition.value);
 		break;
 	}
 
 	case AST_STMT_ASSIGN: {
 		astAssign ast_assign =
 			astGetStatement(c->ast, ast_statement).assign;
+		pushWork(c, STEP_ASSIGN, ast_statement.index);
+		pushWork(c, STEP_EXPRESSION, ast_assign.rhs.index);
+		pushWork(c, STEP_EXPRESSION_NO_MODIFY_USED,
+			 ast_assign.lhs.index);
+		break;
+	}
 
-		fullNode lhs =
-			lowerExpressionNoModifyUsed(c, ast_assign.lhs, m);
-		fullNode rhs = lowerExpression(c, ast_assign.rhs, m);
+	case AST_STMT_IF: {
+		astIf ast_if = astGetStatement(c->ast, ast_statement).if_;
+		pushNode(c, voidNode(c, ast_statement, HIR_IF));
+		pushWork(c, STEP_IF, ast_statement.index);
+		if (ast_if.false_block.index != (u32)-1)
+			pushAllocatedStatement(c, ast_if.false_block);
+		pushAllocatedStatement(c, ast_if.true_block);
+		pushAllocatedExpression(c, ast_if.condition);
+		break;
+	}
 
-		if (lhs.type.index != rhs.type.index) {
-			u8 buffer[128];
-			bump b = bumpCreate(buffer, sizeof(buffer));
-			stringBuilder sb = stringBuilderCreate(&b);
+	case AST_STMT_WHILE: {
+		astWhile ast_while =
+			astGetStatement(c->ast, ast_statement).while_;
+		pushNode(c, voidNode(c, ast_statement, HIR_WHILE));
+		pushWork(c, STEP_WHILE, ast_statement.index);
+		pushAllocatedStatement(c, ast_while.true_block);
+		pushAllocatedExpression(c, ast_while.condition);
+		break;
+	}
 
-			stringBuilderPrintf(&sb, "expected “");
-			hirTypeShow(c->hir, lhs.type, &sb);
-			stringBuilderPrintf(&sb, "” but found “");
-			hirTypeShow(c->hir, rhs.type, &sb);
-			stringBuilderPrintf(&sb, "”");
+	case AST_STMT_BLOCK: {
+		astBlock ast_block =
+			astGetStatement(c->ast, ast_statement).block;
+		pushWork(c, STEP_BLOCK, ast_statement.index);
+		for (u32 i = ast_block.count; i > 0; i--)
+			pushWork(c, STEP_STATEMENT,
+				 ast_block.start.index + i - 1);
+		break;
+	}
+	}
+}
 
-			char *message = stringBuilderFinish(sb);
-			diagnosticsStorageRecord(c->diagnostics, DIAG_ERROR,
-						 rhs.span, message);
+static void finishLocalDefinition(ctx *c, astStatement ast_statement)
+{
+	astLocalDefinition ast_local_definition =
+		astGetStatement(c->ast, ast_statement).local_definition;
+	hirNode rhs = popAllocated(c);
+	span span = astGetStatementSpan(c->ast, ast_statement);
+
+	if (ast_local_definition.name.raw == (u32)-1) {
+		finishNode(c, missingNode(c, span));
+		return;
+	}
 
-			hirTypeData type_data;
-			memset(&type_data, 0, sizeof(type_data));
+	hirLocal local = allocateLocal(c, ast_local_definition.name,
+				       hirGetNodeType(c->hir, rhs), span);
 
-			n.kind = HIR_MISSING;
-			n.type = allocateType(c, HIR_TYPE_VOID, type_data);
-			break;
-		}
+	fullNode lhs_unallocd;
+	memset(&lhs_unallocd, 0, sizeof(lhs_unallocd));
+	lhs_unallocd.data.variable.local = local;
+	lhs_unallocd.kind = HIR_VARIABLE;
+	lhs_unallocd.type = hirGetLocalType(c->hir, local);
+	hirNode lhs = allocateNode(c, lhs_unallocd);
 
-		hirTypeData type_data;
-		memset(&type_data, 0, sizeof(type_data));
+	fullNode n = voidNode(c, ast_statement, HIR_ASSIGN);
+	n.data.assign.lhs = lhs;
+	n.data.assign.rhs = rhs;
+	finishNode(c, n);
+}
 
-		n.kind = HIR_ASSIGN;
-		n.type = allocateType(c, HIR_TYPE_VOID, type_data);
-		n.data.assign.lhs = allocateNode(c, lhs);
-		n.data.assign.rhs = allocateNode(c, rhs);
-		break;
+static void finishAssign(ctx *c, astStatement ast_statement)
+{
+	fullNode rhs = popNode(c);
+	fullNode lhs = popNode(c);
+
+	if (lhs.type.index != rhs.type.index) {
+		u8 buffer[128];
+		bump b = bumpCreate(buffer, sizeof(buffer));
+		stringBuilder sb = stringBuilderCreate(&b);
+
+		stringBuilderPrintf(&sb, "expected “");
+		hirTypeShow(c->hir, lhs.type, &sb);
+		stringBuilderPrintf(&sb, "” but found “");
+		hirTypeShow(c->hir, rhs.type, &sb);
+		stringBuilderPrintf(&sb, "”");
+
+		char *message = stringBuilderFinish(sb);
+		diagnosticsStorageRecord(c->diagnostics, DIAG_ERROR, rhs.span,
+					 "%s", message);
+
+		span span = astGetStatementSpan(c->ast, ast_statement);
+		finishNode(c, missingNode(c, span));
+		return;
 	}
 
-	case AST_STMT_IF: {
-		astIf ast_if = astGetStatement(c->ast, ast_statement).if_;
+	fullNode n = voidNode(c, ast_statement, HIR_ASSIGN);
+	n.data.assign.lhs = allocateNode(c, lhs);
+	n.data.assign.rhs = allocateNode(c, rhs);
+	finishNode(c, n);
+}
 
-		hirTypeData type_data;
-		memset(&type_data, 0, sizeof(type_data));
+static void finishBlock(ctx *c, astStatement ast_statement)
+{
+	astBlock ast_block = astGetStatement(c->ast, ast_statement).block;
 
-		n.kind = HIR_IF;
-		n.type = allocateType(c, HIR_TYPE_VOID, type_data);
+	// The block’s statements are the last nodes pushed.
+	u32 base = c->node_stack_count - ast_block.count;
+	hirNode start = hirNodeMake(-1);
 
-		n.data.if_.condition = allocateNode(
-			c, lowerExpression(c, ast_if.condition, m));
+	for (u32 i = 0; i < ast_block.count; i++) {
+		hirNode this = allocateNode(c, c->node_stack[base + i]);
+		if (start.index == (u32)-1)
+			start = this;
+	}
 
-		n.data.if_.true_block = allocateNode(
-			c, lowerStatement(c, ast_if.true_block, m));
+	c->node_stack_count = base;
 
-		if (ast_if.false_block.index != (u16)-1)
-			n.data.if_.false_block = allocateNode(
-				c, lowerStatement(c, ast_if.false_block, m));
-		else
-			n.data.if_.false_block.index = -1;
+	fullNode n = voidNode(c, ast_statement, HIR_BLOCK);
+	n.data.block.start = start;
+	n.data.block.count = ast_block.count;
+	finishNode(c, n);
+}
+
+static void runStep(ctx *c, lowerWork work)
+{
+	astExpression ast_expression = astExpressionMake(work.ast_index);
+	astStatement ast_statement = astStatementMake(work.ast_index);
 
+	switch (work.step) {
+	case STEP_EXPRESSION:
+		lowerExpression(c, ast_expression, true);
 		break;
-	}
 
-	case AST_STMT_WHILE: {
-		astWhile ast_while =
-			astGetStatement(c->ast, ast_statement).while_;
+	case STEP_EXPRESSION_NO_MODIFY_USED:
+		lowerExpression(c, ast_expression, false);
+		break;
 
-		hirTypeData type_data;
-		memset(&type_data, 0, sizeof(type_data));
+	case STEP_STATEMENT:
+		lowerStatement(c, ast_statement);
+		break;
 
-		n.kind = HIR_WHILE;
-		n.type = allocateType(c, HIR_TYPE_VOID, type_data);
-		n.data.while_.condition = allocateNode(
-			c, lowerExpression(c, ast_while.condition, m));
-		n.data.while_.true_block = allocateNode(
-			c, lowerStatement(c, ast_while.true_block, m));
+	case STEP_ALLOCATE:
+		pushAllocated(c, allocateNode(c, popNode(c)));
 		break;
-	}
 
-	case AST_STMT_BLOCK: {
-		astBlock ast_block =
-			astGetStatement(c->ast, ast_statement).block;
+	case STEP_BINARY_OPERATION:
+		finishBinaryOperation(c, ast_expression);
+		break;
 
-		bumpMark mark = bumpCreateMark(&m->temp);
-		arrayBuilder nodes_builder =
-			bumpStartArrayBuilder(&m->temp, sizeof(fullNode));
+	case STEP_ADDRESS_OF:
+		finishAddressOf(c, ast_expression);
+		break;
 
-		for (u16 i = 0; i < ast_block.count; i++) {
-			astStatement ast_s =
-				astStatementMake(ast_block.start.index + i);
+	case STEP_DEREFERENCE:
+		finishDereference(c, ast_expression);
+		break;
 
-			fullNode node = lowerStatement(c, ast_s, m);
-			arrayBuilderPush(&nodes_builder, &node);
-		}
+	case STEP_INDEX:
+		finishIndex(c, ast_expression);
+		break;
 
-		fullNode *nodes =
-			bumpFinishArrayBuilder(&m->temp, &nodes_builder);
+	case STEP_ARRAY_ELEMENT:
+		finishArrayElement(c, work);
+		break;
 
-		hirNode start = hirNodeMake(-1);
+	case STEP_RETURN: {
+		hirNode value = popAllocated(c);
+		fullNode n = popNode(c);
+		n.data.retrn.value = value;
+		finishNode(c, n);
+		break;
+	}
 
-		for (u16 i = 0; i < ast_block.count; i++) {
-			hirNode this = allocateNode(c, nodes[i]);
-			if (start.index == (u16)-1)
-				start = this;
-		}
+	case STEP_LOCAL_DEFINITION:
+		finishLocalDefinition(c, ast_statement);
+		break;
 
-		bumpClearToMark(&m->temp, mark);
+	case STEP_ASSIGN:
+		finishAssign(c, ast_statement);
+		break;
 
-		hirTypeData type_data;
-		memset(&type_data, 0, sizeof(type_data));
+	case STEP_IF: {
+		astIf ast_if = astGetStatement(c->ast, ast_statement).if_;
+		hirNode false_block = hirNodeMake(-1);
+		if (ast_if.false_block.index != (u32)-1)
+			false_block = popAllocated(c);
+		hirNode true_block = popAllocated(c);
+		hirNode condition = popAllocated(c);
+
+		fullNode n = popNode(c);
+		n.data.if_.condition = condition;
+		n.data.if_.true_block = true_block;
+		n.data.if_.false_block = false_block;
+		finishNode(c, n);
+		break;
+	}
+
+	case STEP_WHILE: {
+		hirNode true_block = popAllocated(c);
+		hirNode condition = popAllocated(c);
 
-		n.kind = HIR_BLOCK;
-		n.type = allocateType(c, HIR_TYPE_VOID, type_data);
-		n.data.block.start = start;
-		n.data.block.count = ast_block.count;
+		fullNode n = popNode(c);
+		n.data.while_.condition = condition;
+		n.data.while_.true_block = true_block;
+		finishNode(c, n);
 		break;
 	}
+
+	case STEP_BLOCK:
+		finishBlock(c, ast_statement);
+		break;
 	}
+}
 
-	assert(n.kind != (hirNodeKind)-1);
-	assert(n.type.index != (u16)-1);
-	return n;
+static fullNode lowerFunctionBody(ctx *c, astStatement ast_statement)
+{
+	assert(c->work_count == 0);
+	pushWork(c, STEP_STATEMENT, ast_statement.index);
+
+	while (c->work_count > 0)
+		runStep(c, c->work[--c->work_count]);
+
+	assert(c->allocated_count == 0);
+	assert(c->node_stack_count == 1);
+	return popNode(c);
 }
 
 hirRoot lower(astRoot ast, diagnosticsStorage *diagnostics, memory *m)
 {
 	bumpMark mark = bumpCreateMark(&m->temp);
-
-	arrayBuilder functions =
-		bumpStartArrayBuilder(&m->general, sizeof(hirFunction));
-
 	ctx c = {
 		.hir = {
-			.functions = NULL,
-			.nodes = bumpAllocateArray(hirNodeData, &m->temp, MAX_NODE_COUNT),
-			.node_kinds = bumpAllocateArray(hirNodeKind, &m->temp, MAX_NODE_COUNT),
-			.node_types = bumpAllocateArray(hirType, &m->temp, MAX_NODE_COUNT),
-			.node_spans = bumpAllocateArray(span, &m->temp, MAX_NODE_COUNT),
-			.local_names = bumpAllocateArray(identifierId, &m->temp, MAX_LOCAL_COUNT),
-			.local_types = bumpAllocateArray(hirType, &m->temp, MAX_LOCAL_COUNT),
-			.local_spans = bumpAllocateArray(span, &m->temp, MAX_LOCAL_COUNT),
-			.types = bumpAllocateArray(hirTypeData, &m->temp, MAX_TYPE_COUNT),
-			.type_kinds = bumpAllocateArray(hirTypeKind, &m->temp, MAX_TYPE_COUNT),
-			.function_count = 0,
-			.node_count = 0,
-			.local_count = 0,
 			.current_function_locals_start = hirLocalMake(-1),
 		},
 		.ast = ast,
 		.diagnostics = diagnostics,
-		.local_used = bumpAllocateArray(bool, &m->temp, MAX_LOCAL_COUNT),
+		.general = &m->general,
+		.temp = &m->temp,
+		.work = bumpAllocateArray(lowerWork, &m->temp,
+					  MIN_STACK_CAPACITY),
+		.work_capacity = MIN_STACK_CAPACITY,
+		.node_stack = bumpAllocateArray(fullNode, &m->temp,
+						MIN_STACK_CAPACITY),
+		.node_stack_capacity = MIN_STACK_CAPACITY,
+		.allocated = bumpAllocateArray(hirNode, &m->temp,
+					       MIN_STACK_CAPACITY),
+		.allocated_capacity = MIN_STACK_CAPACITY,
 	};
 
-	for (u16 i = 0; i < c.ast.function_count; i++) {
+	// Most statements and expressions lower to a single node,
+	// and every local is introduced by a statement of its own.
+	// Types are deduplicated, so there are only ever a handful.
+	growNodes(&c, ast.statement_count + ast.expression_count + 1);
+	growLocals(&c, ast.statement_count + 1);
+	growTypes(&c, MIN_GROWN_CAPACITY);
+	growFunctions(&c, ast.function_count + 1);
+
+	for (u32 i = 0; i < c.ast.function_count; i++) {
 		astFunction ast_function = c.ast.functions[i];
 
 		if (ast_function.name.raw == (u32)-1)
@@ -643,8 +931,8 @@ hirRoot lower(astRoot ast, diagnosticsStorage *diagnostics, memory *m)
 		hirLocal locals_start = hirLocalMake(c.hir.local_count);
 		c.hir.current_function_locals_start = locals_start;
 		hirNode body = allocateNode(
-			&c, lowerStatement(&c, ast_function.body, m));
-		u16 locals_count = c.hir.local_count - locals_start.index;
+			&c, lowerFunctionBody(&c, ast_function.body));
+		u32 locals_count = c.hir.local_count - locals_start.index;
 
 		hirFunction function;
 		memset(&function, 0, sizeof(function));
@@ -652,36 +940,12 @@ hirRoot lower(astRoot ast, diagnosticsStorage *diagnostics, memory *m)
 		function.locals_count = locals_count;
 		function.body = body;
 		function.name = ast_function.name;
-		arrayBuilderPush(&functions, &function);
-		c.hir.function_count++;
+		pushFunction(&c, function);
 	}
 
-	c.hir.functions = bumpFinishArrayBuilder(&m->general, &functions);
-
-	c.hir.nodes = bumpCopyArray(hirNodeData, &m->general, c.hir.nodes,
-				    c.hir.node_count);
-	c.hir.node_kinds = bumpCopyArray(hirNodeKind, &m->general,
-					 c.hir.node_kinds, c.hir.node_count);
-	c.hir.node_types = bumpCopyArray(hirType, &m->general, c.hir.node_types,
-					 c.hir.node_count);
-	c.hir.node_spans = bumpCopyArray(span, &m->general, c.hir.node_spans,
-					 c.hir.node_count);
-
-	c.hir.local_names = bumpCopyArray(identifierId, &m->general,
-					  c.hir.local_names, c.hir.local_count);
-	c.hir.local_types = bumpCopyArray(hirType, &m->general,
-					  c.hir.local_types, c.hir.local_count);
-	c.hir.local_spans = bumpCopyArray(span, &m->general, c.hir.local_spans,
-					  c.hir.local_count);
-
-	c.hir.types = bumpCopyArray(hirTypeData, &m->general, c.hir.types,
-				    c.hir.type_count);
-	c.hir.type_kinds = bumpCopyArray(hirTypeKind, &m->general,
-					 c.hir.type_kinds, c.hir.type_count);
-
-	for (u16 i = 0; i < c.hir.function_count; i++) {
+	for (u32 i = 0; i < c.hir.function_count; i++) {
 		hirFunction function = c.hir.functions[i];
-		for (u16 j = 0; j < function.locals_count; j++) {
+		for (u32 j = 0; j < function.locals_count; j++) {
 			hirLocal local =
 				hirLocalMake(function.locals_start.index + j);
 			if (!c.local_used[local.index])
@@ -693,7 +957,6 @@ hirRoot lower(astRoot ast, diagnosticsStorage *diagnostics, memory *m)
 	}
 
 	bumpClearToMark(&m->temp, mark);
-
 	return c.hir;
 }
 
@@ -781,17 +1044,17 @@ u32 hirTypeAlign(hirRoot hir, hirType type)
 	}
 }
 
-hirNode hirNodeMake(u16 index)
+hirNode hirNodeMake(u32 index)
 {
 	return (hirNode){ .index = index };
 }
 
-hirLocal hirLocalMake(u16 index)
+hirLocal hirLocalMake(u32 index)
 {
 	return (hirLocal){ .index = index };
 }
 
-hirType hirTypeMake(u16 index)
+hirType hirTypeMake(u32 index)
 {
 	return (hirType){ .index = index };
 }
@@ -844,7 +1107,8 @@ static void debugNode(debugCtx *c, hirNode node)
 	case HIR_INT_LITERAL: {
 		hirIntLiteral int_literal =
 			hirGetNode(c->hir, node).int_literal;
-		stringBuilderPrintf(c->sb, "%llu", int_literal.value);
+		stringBuilderPrintf(c->sb, "%llu",
+				    (unsigned long long)int_literal.value);
 		break;
 	}
 
@@ -945,7 +1209,7 @@ static void debugNode(debugCtx *c, hirNode node)
 
 		stringBuilderPrintf(c->sb, "[");
 		c->indentation++;
-		for (u16 i = 0; i < array_literal.count; i++) {
+		for (u32 i = 0; i < array_literal.count; i++) {
 			hirNode n = hirNodeMake(array_literal.start.index + i);
 			newline(c);
 			debugNode(c, n);
@@ -973,7 +1237,7 @@ static void debugNode(debugCtx *c, hirNode node)
 		stringBuilderPrintf(c->sb, " ");
 		debugNode(c, if_.true_block);
 
-		if (if_.false_block.index == (u16)-1)
+		if (if_.false_block.index == (u32)-1)
 			break;
 
 		stringBuilderPrintf(c->sb, " else ");
@@ -1005,7 +1269,7 @@ static void debugNode(debugCtx *c, hirNode node)
 		}
 		stringBuilderPrintf(c->sb, "{");
 		c->indentation++;
-		for (u16 i = 0; i < block.count; i++) {
+		for (u32 i = 0; i < block.count; i++) {
 			hirNode n = hirNodeMake(block.start.index + i);
 			newline(c);
 			debugNode(c, n);
@@ -1024,7 +1288,7 @@ static void debugFunction(debugCtx *c, hirFunction function)
 			    internerLookup(c->interner, function.name));
 
 	c->indentation++;
-	for (u16 i = 0; i < function.locals_count; i++) {
+	for (u32 i = 0; i < function.locals_count; i++) {
 		hirLocal local = hirLocalMake(function.locals_start.index + i);
 		identifierId name = hirGetLocalName(c->hir, local);
 		newline(c);
@@ -1048,7 +1312,7 @@ void hirDebug(hirRoot hir, interner interner, stringBuilder *sb)
 	};
 
 	bool first = true;
-	for (u16 i = 0; i < hir.function_count; i++) {
+	for (u32 i = 0; i < hir.function_count; i++) {
 		if (first)
 			first = false;
 		else
@@ -1068,18 +1332,20 @@ void hirDebugPrint(hirRoot hir, interner interner, bump *b)
 	bumpClearToMark(b, mark);
 }
 
-char *lowerTests(char *input, memory *m)
+char *lowerTests(char *input, usize length, memory *m)
 {
 	diagnosticsStorage diagnostics = diagnosticsStorageCreate(&m->general);
-	tokenBuffer buf = lex(input, &diagnostics, m);
+	tokenBuffer buf = lex(input, length, &diagnostics, m);
+	internFile(&buf, input, m);
 	interner interner = intern(&buf, &input, 1, m);
-	astRoot ast = parse(buf, input, &diagnostics, m);
+	astRoot ast = parse(buf, &diagnostics, m);
 
 	// Remove all diagnostics up to this point.
 	diagnostics.count = 0;
 	diagnostics.all_messages.bytes_used = 0;
 
 	hirRoot hir = lower(ast, &diagnostics, m);
+	hirSpanIndexCheck(hir, length, m);
 	stringBuilder sb = stringBuilderCreate(&m->temp);
 	hirDebug(hir, interner, &sb);
 	diagnosticsStorageDebug(diagnostics, &sb);
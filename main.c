@@ -14,6 +14,14 @@ int main(int argc, char **argv)
 		assert(m.temp.bytes_used == 0);
 		runTests("tests_lower", lowerTests, &m.temp);
 		assert(m.temp.bytes_used == 0);
+		runTests("tests_ast_cache", astCacheTests, &m.temp);
+		assert(m.temp.bytes_used == 0);
+		runDeepNestingTest();
+		return 0;
+	}
+
+	if (argc == 2 && strcmp(argv[1], "--bench") == 0) {
+		runBenchmarks();
 		return 0;
 	}
 
@@ -24,26 +32,76 @@ int main(int argc, char **argv)
 
 	setCurrentProject(current_project);
 
-	tokenBuffer *token_buffers = bumpAllocateArray(
-		tokenBuffer, &m.general, current_project.num_files);
+	u32 num_cpus = numCpus();
+	growableInterner *identifiers = growableInternerCreate(&m.general);
+
+	// Starting from the previous run’s identifiers
+	// means most of them don’t need to be inserted again,
+	// and that they keep the same IDs from one run to the next.
+	const char *identifier_cache_path = ".minic-identifiers";
+	bool identifiers_cached =
+		growableInternerLoad(identifiers, identifier_cache_path);
+	usize cached_identifier_count = identifiers->count;
+
+	// Files whose contents haven’t changed since they were last compiled
+	// are loaded from here instead of being lexed and parsed again.
+	const char *ast_cache_dir = ".minic-cache";
+	mkdir(ast_cache_dir, 0777);
+	u16 ast_cache_hits = 0;
+	u64 cold_front_end_nanoseconds = 0;
+	u64 warm_front_end_nanoseconds = 0;
+
+	// Everything a file needs is thrown away once it has been compiled,
+	// so the most memory we ever use is what the largest file needs.
+	usize peak_general_bytes = 0;
+	usize peak_general_padding_bytes = 0;
+	usize token_count = 0;
+	usize span_bytes = 0;
 
 	for (u16 i = 0; i < current_project.num_files; i++) {
 		setCurrentFile(i);
-		char *content = current_project.file_contents[i];
-		tokenBuffer tokens = lex(content, &diagnostics, &m);
-		token_buffers[i] = tokens;
-		assert(m.temp.bytes_used == 0);
-	}
+		bumpMark file_mark = bumpCreateMark(&m.general);
 
-	interner interner = intern(token_buffers, current_project.file_contents,
-				   current_project.num_files, &m);
-
-	for (u16 i = 0; i < current_project.num_files; i++) {
-		setCurrentFile(i);
+		char *name = current_project.file_names[i];
+		char *content = current_project.file_contents[i];
+		usize length = current_project.file_lengths[i];
+		u64 front_end_start = nowNanoseconds();
+
+		cachedAst cached = { 0 };
+		bool ast_cached =
+			astCacheLoad(&cached, ast_cache_dir, name, content,
+				     length, identifiers, &m.temp);
+		tokenBuffer tokens = cached.tokens;
+		astRoot ast = cached.ast;
+
+		if (!ast_cached) {
+			u16 diagnostic_count = diagnostics.count;
+			tokens = lexParallel(content, length, num_cpus,
+					     &diagnostics, &m);
+			internFile(&tokens, content, &m);
+			growableInternerAddFile(identifiers, &tokens, content,
+						num_cpus, &m);
+			ast = parseParallel(tokens, num_cpus, &diagnostics,
+					    &m);
+
+			// Diagnostics aren’t cached,
+			// so only files without any can skip the front end.
+			if (diagnostics.count == diagnostic_count)
+				astCacheSave(ast_cache_dir, name, content,
+					     length, tokens, ast, identifiers,
+					     &m.temp);
+		}
+
+		u64 front_end_nanoseconds = nowNanoseconds() - front_end_start;
+		if (ast_cached) {
+			ast_cache_hits++;
+			warm_front_end_nanoseconds += front_end_nanoseconds;
+		} else {
+			cold_front_end_nanoseconds += front_end_nanoseconds;
+		}
+
+		interner interner = growableInternerView(identifiers);
 
-		astRoot ast = parse(token_buffers[i],
-				    current_project.file_contents[i],
-				    &diagnostics, &m);
 		if (debug)
 			astDebugPrint(ast, interner, &m.temp);
 
@@ -54,8 +112,34 @@ int main(int argc, char **argv)
 		codegen(hir, interner, &assembly, &diagnostics, &m);
 
 		assert(m.temp.bytes_used == 0);
+
+		token_count += tokens.count;
+		span_bytes += tokenBufferSpanBytes(tokens);
+		if (m.general.bytes_used > peak_general_bytes) {
+			peak_general_bytes = m.general.bytes_used;
+			peak_general_padding_bytes =
+				m.general.padding_bytes_used;
+		}
+
+		// Diagnostics are only shown once every file is done,
+		// so the line table has to outlive the rest of the file.
+		bumpMark temp_mark = bumpCreateMark(&m.temp);
+		lineTable lines = tokens.lines;
+		u32 *newlines = bumpCopyArray(u32, &m.temp, lines.newlines,
+					      lines.count);
+		bumpClearToMark(&m.general, file_mark);
+		lines.newlines =
+			bumpCopyArray(u32, &m.general, newlines, lines.count);
+		current_project.file_lines[i] = lines;
+		bumpClearToMark(&m.temp, temp_mark);
+
+		if (ast_cached)
+			astCacheUnmap(cached);
 	}
 
+	interner interner = growableInternerView(identifiers);
+	growableInternerSave(identifiers, identifier_cache_path, &m.temp);
+
 	bumpMark mark = bumpCreateMark(&m.temp);
 	stringBuilder sb = stringBuilderCreate(&m.temp);
 	diagnosticsStorageShow(diagnostics, &sb);
@@ -66,9 +150,52 @@ int main(int argc, char **argv)
 
 	if (debug) {
 		debugLog("compiled %u files using", current_project.num_files);
-		debugLog("    %zu bytes of general memory (%zu bytes padding)",
-			 m.general.bytes_used, m.general.padding_bytes_used);
+		debugLog("    %zu bytes of general memory at peak (%zu bytes "
+			 "padding)",
+			 peak_general_bytes, peak_general_padding_bytes);
 		debugLog("    %zu bytes of assembly", assembly_bump.bytes_used);
+
+		// Compare against storing a full span for every token.
+		double saved_bytes = (double)(token_count * sizeof(span)) -
+				     (double)span_bytes;
+		double saved_per_token =
+			token_count == 0 ? 0 : saved_bytes / token_count;
+		debugLog("    %zu bytes of token spans (%.2f bytes saved per "
+			 "token)",
+			 span_bytes, saved_per_token);
+
+		debugLog("    %zu identifiers in %zu bytes of identifier "
+			 "strings",
+			 interner.count, interner.string_bytes);
+		if (identifiers_cached)
+			debugLog("    %zu identifiers loaded from %s",
+				 cached_identifier_count,
+				 identifier_cache_path);
+
+		// Cold files are lexed, parsed and saved to the AST cache,
+		// while warm ones are loaded from it.
+		debugLog("    %u of %u files loaded from %s",
+			 ast_cache_hits, current_project.num_files,
+			 ast_cache_dir);
+		debugLog("    %.3f ms on cold files, %.3f ms on warm files",
+			 cold_front_end_nanoseconds / 1e6,
+			 warm_front_end_nanoseconds / 1e6);
+
+		internerProbeStats probes =
+			growableInternerProbeStats(identifiers);
+		double identifier_count = (double)interner.count;
+		double average_probe_length =
+			interner.count == 0
+				? 0
+				: probes.total_probe_length / identifier_count;
+		double load_factor =
+			probes.slot_count == 0
+				? 0
+				: identifier_count / probes.slot_count;
+		debugLog("    %zu identifier slots (load factor %.2f, "
+			 "%.2f average and %zu maximum probe length)",
+			 probes.slot_count, load_factor, average_probe_length,
+			 probes.max_probe_length);
 	}
 
 	for (u16 i = 0; i < diagnostics.count; i++)
@@ -12,6 +12,11 @@ bump allocateFromOs(usize size)
 	return bumpCreate(p, size);
 }
 
+void freeToOs(bump b)
+{
+	munmap(b.top, b.max_size);
+}
+
 memory memoryCreate(void)
 {
 	return (memory){
@@ -1,6 +1,8 @@
 #include <dirent.h>
 #include <fcntl.h>
+#include <pthread.h>
 #include <stdarg.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
@@ -11,6 +13,7 @@
 #include <sys/stat.h>
 #include <sys/sysctl.h>
 #include <sys/types.h>
+#include <time.h>
 #include <unistd.h>
 
 typedef uint8_t u8;
@@ -40,6 +43,8 @@ u32 numCpus(void);
 u64 rotl(u64 value, u64 count);
 u64 rotr(u64 value, u64 count);
 u64 fxhash(u8 *ptr, usize len);
+u64 wyhash(u8 *ptr, usize len);
+u64 nowNanoseconds(void);
 
 // ----------------------------------------------------------------------------
 // bump.c
@@ -68,17 +73,30 @@ bumpMark bumpCreateMark(bump *b);
 void bumpClearToMark(bump *b, bumpMark mark);
 void *bumpAllocateArray_(bump *b, usize count, usize element_size);
 void *bumpCopyArray_(bump *b, void *buffer, usize count, usize element_size);
+void *bumpGrowArray_(bump *b, void *buffer, usize count, usize new_count,
+		     usize element_size);
 bump bumpCreateSubBump(bump *b, usize size);
-char *bumpPrintf(bump *b, const char *fmt, ...);
-char *bumpPrintfV(bump *b, const char *fmt, va_list ap);
+char *bumpPrintf(bump *b, const char *fmt, ...)
+	__attribute__((format(printf, 2, 3)));
+char *bumpPrintfV(bump *b, const char *fmt, va_list ap)
+	__attribute__((format(printf, 2, 0)));
 
 #define bumpAllocateArray(type, b, count)                                      \
 	((type *)(bumpAllocateArray_((b), (count), sizeof(type))))
 #define bumpCopyArray(type, b, buffer, count)                                  \
 	((type *)(bumpCopyArray_((b), (buffer), (count), sizeof(type))))
 
+// Copies the first count elements of an array
+// into a fresh allocation with room for new_count elements.
+// The old allocation is left where it is until the bump is cleared.
+#define bumpGrowArray(type, b, buffer, count, new_count)                       \
+	((type *)(bumpGrowArray_((b), (buffer), (count), (new_count),          \
+				 sizeof(type))))
+
 arrayBuilder bumpStartArrayBuilder(bump *b, usize element_size);
 void arrayBuilderPush(arrayBuilder *ab, void *element);
+void *arrayBuilderExtend(arrayBuilder *ab, usize count);
+void arrayBuilderPushArray(arrayBuilder *ab, void *elements, usize count);
 void *bumpFinishArrayBuilder(bump *b, arrayBuilder *ab);
 
 // ----------------------------------------------------------------------------
@@ -91,8 +109,10 @@ typedef struct stringBuilder {
 } stringBuilder;
 
 stringBuilder stringBuilderCreate(bump *b);
-void stringBuilderPrintf(stringBuilder *sb, const char *fmt, ...);
-void stringBuilderPrintfV(stringBuilder *sb, const char *fmt, va_list ap);
+void stringBuilderPrintf(stringBuilder *sb, const char *fmt, ...)
+	__attribute__((format(printf, 2, 3)));
+void stringBuilderPrintfV(stringBuilder *sb, const char *fmt, va_list ap)
+	__attribute__((format(printf, 2, 0)));
 char *stringBuilderFinish(stringBuilder sb);
 
 // ----------------------------------------------------------------------------
@@ -104,20 +124,39 @@ typedef struct memory {
 } memory;
 
 bump allocateFromOs(usize size);
+void freeToOs(bump b);
 memory memoryCreate(void);
 
 // ----------------------------------------------------------------------------
 // test.c
 
-typedef char *(*transformer)(char *, memory *);
+typedef char *(*transformer)(char *, usize, memory *);
 void runTests(const char *dir_name, transformer t, bump *b);
+void runDeepNestingTest(void);
+
+// ----------------------------------------------------------------------------
+// bench.c
+
+void runBenchmarks(void);
 
 // ----------------------------------------------------------------------------
 // project.c
 
+// Offsets of every newline in a file, in order.
+// Line n (0-indexed) starts just after newline n - 1.
+typedef struct lineTable {
+	u32 *newlines;
+	usize count;
+} lineTable;
+
 typedef struct projectSpec {
 	char **file_names;
 	char **file_contents;
+	usize *file_lengths;
+
+	// filled in once each file has been lexed
+	lineTable *file_lines;
+
 	u16 num_files;
 } projectSpec;
 
@@ -145,17 +184,28 @@ typedef struct diagnosticsStorage {
 	u32 *message_starts;
 	bump all_messages;
 	u16 count;
+
+	// Worker threads each fill in storage of their own for a single file,
+	// which records that file instead of asking which one is current.
+	bool single_file;
+	u16 file;
 } diagnosticsStorage;
 
 diagnosticsStorage diagnosticsStorageCreate(bump *b);
+diagnosticsStorage diagnosticsStorageCreateForFile(bump *b, u16 file);
 void diagnosticsStorageRecord(diagnosticsStorage *diagnostics,
 			      severity severity, span span, const char *fmt,
-			      ...);
+			      ...) __attribute__((format(printf, 4, 5)));
 void diagnosticsStorageRecordV(diagnosticsStorage *diagnostics,
 			       severity severity, span span, const char *fmt,
-			       va_list ap);
+			       va_list ap)
+	__attribute__((format(printf, 4, 0)));
 void diagnosticsStorageShow(diagnosticsStorage diagnostics, stringBuilder *sb);
 void diagnosticsStorageDebug(diagnosticsStorage diagnostics, stringBuilder *sb);
+bool diagnosticsStorageEqual(diagnosticsStorage a, diagnosticsStorage b);
+void diagnosticsStorageApplyEdit(diagnosticsStorage *diagnostics,
+				 u16 old_count, span replaced, i64 delta,
+				 bump *temp);
 
 // ----------------------------------------------------------------------------
 // lex.c
@@ -200,41 +250,157 @@ typedef struct identifierId {
 	u32 raw;
 } identifierId;
 
+typedef struct tokenLongSpan {
+	u32 token;
+	u32 length;
+} tokenLongSpan;
+
 typedef struct tokenBuffer {
 	tokenKind *kinds;
-	span *spans;
+	u32 *span_starts;
+	u8 *span_lengths;
+	tokenLongSpan *long_spans;
 	identifierId *identifier_ids;
+	u64 *identifier_hashes;
+
+	// values of number tokens, sorted by token index
+	u32 *literal_tokens;
+	u64 *literal_values;
+
+	lineTable lines;
+
+	// for each newline, how many identifiers come before it,
+	// so relex() can find an edited line’s identifiers without counting
+	u32 *newline_identifier_counts;
+
+	// Identifiers are first interned within their own file,
+	// and until that file is merged into a project-wide interner
+	// identifier_ids holds these file-local IDs.
+	// Each local ID records where it first appeared
+	// and the hash of its bytes.
+	span *local_identifier_spans;
+	u64 *local_identifier_hashes;
+
 	usize count;
+	usize long_span_count;
+	usize identifier_count;
+	usize literal_count;
+	usize local_identifier_count;
 } tokenBuffer;
 
-tokenBuffer lex(char *input, diagnosticsStorage *diagnostics, memory *m);
+tokenBuffer lex(char *input, usize length, diagnosticsStorage *diagnostics,
+		memory *m);
+tokenBuffer lexParallel(char *input, usize length, u32 worker_count,
+			diagnosticsStorage *diagnostics, memory *m);
+tokenBuffer relex(tokenBuffer old, char *new_content, usize length,
+		  span edited, u32 inserted_length,
+		  diagnosticsStorage *diagnostics, memory *m);
 char *tokenBufferIdentifierText(tokenBuffer buf, u32 token_id);
+span tokenBufferSpan(tokenBuffer buf, usize token);
+usize tokenBufferFirstLiteral(tokenBuffer buf, usize token);
+u64 tokenBufferLiteralValue(tokenBuffer buf, usize token);
+u32 lineTableLine(lineTable lines, u32 offset);
+u32 lineTableLineStart(lineTable lines, u32 line);
+u32 lineTableLineEnd(lineTable lines, u32 line, usize length);
+usize tokenBufferSpanBytes(tokenBuffer buf);
 const char *tokenKindShow(tokenKind kind);
 const char *tokenKindDebug(tokenKind kind);
 void tokenBufferDebug(tokenBuffer buf, stringBuilder *sb);
 void tokenBufferDebugPrint(tokenBuffer buf, bump *b);
+bool tokenBuffersEqual(tokenBuffer a, tokenBuffer b);
 
-char *lexTests(char *input, memory *m);
+char *lexTests(char *input, usize length, memory *m);
 
 // ----------------------------------------------------------------------------
 // intern.c
 
+// where an identifier’s bytes live in the interner’s string pool
+typedef struct internedString {
+	u32 offset;
+	u32 length;
+} internedString;
+
+// How many slots a lookup of each interned identifier has to look at
+// before it finds the identifier, which grows as collisions cluster.
+typedef struct internerProbeStats {
+	usize slot_count;
+	usize total_probe_length;
+	usize max_probe_length;
+} internerProbeStats;
+
+// Identifier bytes are stored back-to-back in a single pool,
+// each followed by a null terminator,
+// and are found through a table indexed by identifier ID.
+// There are no pointers, so an interner can be copied around as-is.
 typedef struct interner {
-	char **contents;
+	char *strings;
+	internedString *identifiers;
+	usize count;
+	usize string_bytes;
+	internerProbeStats probes;
 } interner;
 
+void internFile(tokenBuffer *buf, char *content, memory *m);
+
+// An interner which files can be added to one at a time,
+// so that each can be compiled and thrown away before the next is lexed.
+// Its arrays grow as identifiers are added,
+// each in memory of its own reserved from the OS,
+// which means they never move and nothing has to be known up front.
+typedef struct growableInterner {
+	bump string_memory;
+	bump identifier_memory;
+	bump hash_memory;
+	bump slot_memory;
+	bump used_memory;
+
+	arrayBuilder strings;
+	arrayBuilder identifiers;
+	arrayBuilder hashes;
+
+	// whether each identifier has been inserted during this run,
+	// so that the cache can leave out those nothing uses any more
+	arrayBuilder used;
+	usize used_count;
+
+	// identifier ID + 1, or 0 if the slot is empty
+	u32 *slots;
+	usize slot_count;
+	bumpMark slots_mark;
+
+	usize count;
+	usize string_bytes;
+
+	// bumped each time the cache drops identifiers and renumbers the rest,
+	// so anything that stored the old IDs can tell they’ve changed
+	u64 generation;
+} growableInterner;
+
+growableInterner *growableInternerCreate(bump *b);
+void growableInternerDestroy(growableInterner *gi);
+void growableInternerAddFile(growableInterner *gi, tokenBuffer *buf,
+			     char *content, u32 worker_count, memory *m);
+void growableInternerCheckParallel(tokenBuffer buf, char *content, memory *m);
+identifierId growableInternerInsert(growableInterner *gi, char *text,
+				    u32 length, u64 hash);
+interner growableInternerView(growableInterner *gi);
+internerProbeStats growableInternerProbeStats(growableInterner *gi);
+bool growableInternerLoad(growableInterner *gi, const char *path);
+void growableInternerSave(growableInterner *gi, const char *path, bump *b);
+
 interner intern(tokenBuffer *bufs, char **contents, usize buf_count, memory *m);
 char *internerLookup(interner i, identifierId id);
+u32 internerLookupLength(interner i, identifierId id);
 
 // ----------------------------------------------------------------------------
 // parse.c
 
 typedef struct astExpression {
-	u16 index;
+	u32 index;
 } astExpression;
 
 typedef struct astStatement {
-	u16 index;
+	u32 index;
 } astStatement;
 
 typedef enum astExpressionKind {
@@ -290,7 +456,7 @@ typedef struct astIndex {
 
 typedef struct astArrayLiteral {
 	astExpression start;
-	u16 count;
+	u32 count;
 } astArrayLiteral;
 
 typedef union astExpressionData {
@@ -340,7 +506,7 @@ typedef struct astWhile {
 
 typedef struct astBlock {
 	astStatement start;
-	u16 count;
+	u32 count;
 } astBlock;
 
 typedef union astStatementData {
@@ -368,13 +534,47 @@ typedef struct astRoot {
 	astExpressionKind *expression_kinds;
 	span *expression_spans;
 
-	u16 function_count;
-	u16 statement_count;
-	u16 expression_count;
+	u32 function_count;
+	u32 statement_count;
+	u32 expression_count;
 } astRoot;
 
-astRoot parse(tokenBuffer tokens, char *content,
-	      diagnosticsStorage *diagnostics, memory *m);
+// What parseIncremental() remembers about each top-level range of tokens,
+// which is a function along with any stray tokens after it.
+// The token and node *_starts arrays have an extra entry at the end,
+// so a range’s tokens and nodes are those from its start up to the next one’s.
+typedef struct astRangeTable {
+	u64 *fingerprints;
+	u32 *token_starts;
+	u32 *span_starts;
+	u32 *lengths;
+	u32 *function_starts;
+	u32 *statement_starts;
+	u32 *expression_starts;
+
+	// Ranges with diagnostics are always parsed again.
+	bool *reusable;
+
+	u32 count;
+
+	// The next incremental parse carries on in the AST’s own arrays,
+	// so it needs to know how much room they have.
+	u32 function_capacity;
+	u32 statement_capacity;
+	u32 expression_capacity;
+} astRangeTable;
+
+astRoot parse(tokenBuffer tokens, diagnosticsStorage *diagnostics, memory *m);
+astRoot parseParallel(tokenBuffer tokens, u32 worker_count,
+		      diagnosticsStorage *diagnostics, memory *m);
+// The edit is the one made since the previous parse,
+// given as relex() takes it.
+// The previous AST’s arrays are taken over by the new one,
+// so it can’t be used afterwards.
+astRoot parseIncremental(tokenBuffer tokens, astRoot previous,
+			 astRangeTable previous_ranges, span edited,
+			 u32 inserted_length, astRangeTable *ranges,
+			 diagnosticsStorage *diagnostics, memory *m);
 
 astStatementData astGetStatement(astRoot ast, astStatement statement);
 astStatementKind astGetStatementKind(astRoot ast, astStatement statement);
@@ -383,27 +583,50 @@ astExpressionData astGetExpression(astRoot ast, astExpression expression);
 astExpressionKind astGetExpressionKind(astRoot ast, astExpression expression);
 span astGetExpressionSpan(astRoot ast, astExpression expression);
 
-astExpression astExpressionMake(u16 index);
-astStatement astStatementMake(u16 index);
+astExpression astExpressionMake(u32 index);
+astStatement astStatementMake(u32 index);
 
 void astDebug(astRoot ast, interner interner, stringBuilder *sb);
 void astDebugPrint(astRoot ast, interner interner, bump *b);
 
-char *parseTests(char *input, memory *m);
+char *parseTests(char *input, usize length, memory *m);
+
+// ----------------------------------------------------------------------------
+// ast_cache.c
+
+// A file’s tokens and AST as loaded from the AST cache,
+// whose arrays point into the mapped image.
+// Its tokens refer to IDs in the growable interner
+// and have no file-local identifiers.
+typedef struct cachedAst {
+	tokenBuffer tokens;
+	astRoot ast;
+	void *image;
+	usize image_size;
+} cachedAst;
+
+bool astCacheLoad(cachedAst *cached, const char *dir, const char *name,
+		  char *content, usize length, growableInterner *identifiers,
+		  bump *b);
+void astCacheSave(const char *dir, const char *name, char *content,
+		  usize length, tokenBuffer tokens, astRoot ast,
+		  growableInterner *identifiers, bump *b);
+void astCacheUnmap(cachedAst cached);
+char *astCacheTests(char *input, usize length, memory *m);
 
 // ----------------------------------------------------------------------------
 // lower.c
 
 typedef struct hirNode {
-	u16 index;
+	u32 index;
 } hirNode;
 
 typedef struct hirLocal {
-	u16 index;
+	u32 index;
 } hirLocal;
 
 typedef struct hirType {
-	u16 index;
+	u32 index;
 } hirType;
 
 typedef enum hirNodeKind {
@@ -451,7 +674,7 @@ typedef struct hirIndex {
 
 typedef struct hirArrayLiteral {
 	hirNode start;
-	u16 count;
+	u32 count;
 } hirArrayLiteral;
 
 typedef struct hirAssign {
@@ -476,7 +699,7 @@ typedef struct hirReturn {
 
 typedef struct hirBlock {
 	hirNode start;
-	u16 count;
+	u32 count;
 } hirBlock;
 
 typedef union hirNodeData {
@@ -518,7 +741,7 @@ typedef union hirTypeData {
 typedef struct hirFunction {
 	identifierId name;
 	hirLocal locals_start;
-	u16 locals_count;
+	u32 locals_count;
 	hirNode body;
 } hirFunction;
 
@@ -537,10 +760,10 @@ typedef struct hirRoot {
 	hirTypeData *types;
 	hirTypeKind *type_kinds;
 
-	u16 function_count;
-	u16 node_count;
-	u16 local_count;
-	u16 type_count;
+	u32 function_count;
+	u32 node_count;
+	u32 local_count;
+	u32 type_count;
 
 	hirLocal current_function_locals_start;
 } hirRoot;
@@ -560,15 +783,62 @@ hirTypeKind hirGetTypeKind(hirRoot hir, hirType type);
 u32 hirTypeSize(hirRoot hir, hirType type);
 u32 hirTypeAlign(hirRoot hir, hirType type);
 
-hirNode hirNodeMake(u16 index);
-hirLocal hirLocalMake(u16 index);
-hirType hirTypeMake(u16 index);
+hirNode hirNodeMake(u32 index);
+hirLocal hirLocalMake(u32 index);
+hirType hirTypeMake(u32 index);
 
 void hirTypeShow(hirRoot hir, hirType type, stringBuilder *sb);
 void hirDebug(hirRoot hir, interner interner, stringBuilder *sb);
 void hirDebugPrint(hirRoot hir, interner interner, bump *b);
 
-char *lowerTests(char *input, memory *m);
+char *lowerTests(char *input, usize length, memory *m);
+
+// ----------------------------------------------------------------------------
+// span_index.c
+
+#define SPAN_INDEX_NONE ((u32)-1)
+
+// Finds the innermost node whose span contains an offset in O(log n),
+// for nodes whose spans nest the way a syntax tree’s do.
+// Entries are sorted by where their spans start,
+// and each refers to the innermost entry enclosing it (its parent)
+// and to a further ancestor used to skip ahead while searching.
+typedef struct spanIndex {
+	u32 *starts;
+	u32 *ends;
+	u32 *nodes;
+	u32 *parents;
+	u32 *jumps;
+	u32 count;
+} spanIndex;
+
+// Functions are found by the spans of their bodies,
+// so an offset in a function’s “func” keyword or name
+// isn’t in any function.
+typedef struct astSpanIndex {
+	spanIndex functions;
+	spanIndex statements;
+	spanIndex expressions;
+} astSpanIndex;
+
+typedef struct hirSpanIndex {
+	spanIndex functions;
+	spanIndex nodes;
+} hirSpanIndex;
+
+spanIndex spanIndexBuild(span *spans, u32 count, memory *m);
+bool spanIndexFind(spanIndex index, u32 offset, u32 *node);
+
+astSpanIndex astSpanIndexBuild(astRoot ast, memory *m);
+bool astFunctionAt(astSpanIndex index, u32 offset, u32 *function);
+bool astStatementAt(astSpanIndex index, u32 offset, astStatement *statement);
+bool astExpressionAt(astSpanIndex index, u32 offset, astExpression *expression);
+void astSpanIndexCheck(astRoot ast, usize length, memory *m);
+
+hirSpanIndex hirSpanIndexBuild(hirRoot hir, memory *m);
+bool hirFunctionAt(hirSpanIndex index, u32 offset, u32 *function);
+bool hirNodeAt(hirSpanIndex index, u32 offset, hirNode *node);
+void hirSpanIndexCheck(hirRoot hir, usize length, memory *m);
 
 // ----------------------------------------------------------------------------
 // codegen.c
@@ -1,8 +1,15 @@
 #include "minic.h"
 
 enum {
-	MAX_EXPRESSION_COUNT = 63 * 1024,
-	MAX_STATEMENT_COUNT = 63 * 1024,
+	// Arrays which turn out to be too small grow to at least this size.
+	MIN_GROWN_CAPACITY = 16,
+
+	MIN_STACK_CAPACITY = 64,
+
+	// Syntax nested deeper than this is parsed off the work stack
+	// instead of by recursing, so that no file can overflow the C stack,
+	// while everyday code keeps the speed of plain recursive descent.
+	MAX_RECURSION_DEPTH = 128,
 };
 
 typedef struct fullExpression {
@@ -17,25 +24,136 @@ typedef struct fullStatement {
 	astStatementKind kind;
 } fullStatement;
 
+// What’s left to do for a piece of syntax.
+// Syntax is parsed with an explicit stack of these
+// rather than by recursion, so that deeply nested code
+// can’t overflow the C stack.
+typedef enum parseStep {
+	STEP_EXPRESSION,
+	STEP_EXPRESSION_LHS,
+	STEP_BINARY_OPERATOR,
+	STEP_BINARY_OPERATION,
+	STEP_ADDRESS_OF,
+	STEP_DEREFERENCE,
+	STEP_PARENTHESIZED,
+	STEP_INDEX,
+	STEP_ARRAY_ELEMENT,
+
+	STEP_STATEMENT,
+	STEP_BLOCK,
+	STEP_NOT_BLOCK,
+	STEP_BLOCK_STATEMENT,
+	STEP_RETURN,
+	STEP_ASSIGN_LHS,
+	STEP_ASSIGN_RHS,
+	STEP_IF_CONDITION,
+	STEP_IF_TRUE_BRANCH,
+	STEP_IF_FALSE_BRANCH,
+	STEP_WHILE_CONDITION,
+	STEP_WHILE_BODY,
+	STEP_LOCAL_DEFINITION,
+} parseStep;
+
+typedef struct parseWork {
+	const char *error_name;
+
+	// where the syntax being parsed starts
+	u32 start;
+
+	// nodes parsed so far, a variable name,
+	// or where an array literal’s or block’s contents start
+	// on the expression or statement stack
+	u32 a;
+	u32 b;
+
+	parseStep step;
+	u8 binding_power;
+	astBinaryOperator op;
+} parseWork;
+
 typedef struct parser {
 	tokenBuffer tokens;
 	usize cursor;
-	char *content;
+	// the first number token at or after the cursor,
+	// so literal values are found without searching for each one
+	usize literal;
 	astRoot ast;
 	diagnosticsStorage *diagnostics;
+
+	// The AST’s arrays are allocated straight into general memory
+	// and are moved to larger allocations if they fill up.
+	// Temporary memory is no good for this,
+	// since it’s cleared as soon as parsing is done.
+	bump *general;
+	u32 function_capacity;
+	u32 statement_capacity;
+	u32 expression_capacity;
+
+	// The work stack and the stacks of pending nodes
+	// are kept in temporary memory
+	// and are moved to larger allocations if they fill up.
+	bump *temp;
+	u32 depth;
+	parseWork *work;
+	u32 work_count;
+	u32 work_capacity;
+	fullExpression *expression_stack;
+	u32 expression_stack_count;
+	u32 expression_stack_capacity;
+	fullStatement *statement_stack;
+	u32 statement_stack_count;
+	u32 statement_stack_capacity;
 } parser;
 
+// Indices are 32-bit, and -1 is reserved to mean “none”.
+static u32 grownCapacity(u32 capacity)
+{
+	assert(capacity <= (u32)-1 / 2);
+	if (capacity < MIN_GROWN_CAPACITY / 2)
+		return MIN_GROWN_CAPACITY;
+	return capacity * 2;
+}
+
+static void growExpressions(parser *p, u32 capacity)
+{
+	u32 count = p->ast.expression_count;
+	p->ast.expressions = bumpGrowArray(astExpressionData, p->general,
+					   p->ast.expressions, count, capacity);
+	p->ast.expression_kinds =
+		bumpGrowArray(astExpressionKind, p->general,
+			      p->ast.expression_kinds, count, capacity);
+	p->ast.expression_spans = bumpGrowArray(
+		span, p->general, p->ast.expression_spans, count, capacity);
+	p->expression_capacity = capacity;
+}
+
+static void growStatements(parser *p, u32 capacity)
+{
+	u32 count = p->ast.statement_count;
+	p->ast.statements = bumpGrowArray(astStatementData, p->general,
+					  p->ast.statements, count, capacity);
+	p->ast.statement_kinds =
+		bumpGrowArray(astStatementKind, p->general,
+			      p->ast.statement_kinds, count, capacity);
+	p->ast.statement_spans = bumpGrowArray(
+		span, p->general, p->ast.statement_spans, count, capacity);
+	p->statement_capacity = capacity;
+}
+
+static void growFunctions(parser *p, u32 capacity)
+{
+	u32 count = p->ast.function_count;
+	p->ast.functions = bumpGrowArray(astFunction, p->general,
+					 p->ast.functions, count, capacity);
+	p->function_capacity = capacity;
+}
+
 static astExpression allocateExpression(parser *p, fullExpression expression)
 {
-	if (p->ast.expression_count >= MAX_EXPRESSION_COUNT) {
-		diagnosticsStorageRecord(p->diagnostics, DIAG_ERROR,
-					 expression.span,
-					 "reached limit of %u expressions",
-					 MAX_EXPRESSION_COUNT);
-		internalError("ran out of expression slots");
-	}
+	u32 i = p->ast.expression_count;
+	if (i == p->expression_capacity)
+		growExpressions(p, grownCapacity(i));
 
-	u16 i = p->ast.expression_count;
 	p->ast.expression_count++;
 	p->ast.expressions[i] = expression.data;
 	p->ast.expression_kinds[i] = expression.kind;
@@ -45,14 +163,10 @@ static astExpression allocateExpression(parser *p, fullExpression expression)
 
 static astStatement allocateStatement(parser *p, fullStatement statement)
 {
-	if (p->ast.statement_count >= MAX_STATEMENT_COUNT) {
-		diagnosticsStorageRecord(
-			p->diagnostics, DIAG_ERROR, statement.span,
-			"reached limit of %u statements", MAX_STATEMENT_COUNT);
-		internalError("ran out of statement slots");
-	}
+	u32 i = p->ast.statement_count;
+	if (i == p->statement_capacity)
+		growStatements(p, grownCapacity(i));
 
-	u16 i = p->ast.statement_count;
 	p->ast.statement_count++;
 	p->ast.statements[i] = statement.data;
 	p->ast.statement_kinds[i] = statement.kind;
@@ -60,6 +174,16 @@ static astStatement allocateStatement(parser *p, fullStatement statement)
 	return astStatementMake(i);
 }
 
+static void pushFunction(parser *p, astFunction function)
+{
+	u32 i = p->ast.function_count;
+	if (i == p->function_capacity)
+		growFunctions(p, grownCapacity(i));
+
+	p->ast.function_count++;
+	p->ast.functions[i] = function;
+}
+
 static bool atEof(parser *p)
 {
 	// cursor should never go more than one past the end
@@ -83,7 +207,34 @@ static tokenKind current(parser *p)
 static span currentSpan(parser *p)
 {
 	assert(!atEof(p));
-	return p->tokens.spans[p->cursor];
+	return tokenBufferSpan(p->tokens, p->cursor);
+}
+
+static span previousSpan(parser *p)
+{
+	assert(p->cursor > 0);
+	return tokenBufferSpan(p->tokens, p->cursor - 1);
+}
+
+// The cursor only moves forwards, one token at a time,
+// except when we jump ahead to a new range.
+static void seek(parser *p, usize token)
+{
+	p->cursor = token;
+	p->literal = tokenBufferFirstLiteral(p->tokens, token);
+}
+
+static u64 currentLiteralValue(parser *p)
+{
+	assert(current(p) == TOK_NUMBER);
+
+	tokenBuffer tokens = p->tokens;
+	while (tokens.literal_tokens[p->literal] < p->cursor)
+		p->literal++;
+
+	assert(p->literal < tokens.literal_count);
+	assert(tokens.literal_tokens[p->literal] == p->cursor);
+	return tokens.literal_values[p->literal];
 }
 
 static bool at(parser *p, tokenKind kind)
@@ -184,51 +335,721 @@ static identifierId expectIdentifier(parser *p, const char *name)
 	return id;
 }
 
-static fullExpression expression(parser *p, const char *error_name, memory *m);
+// Pending expressions and statements are kept on stacks
+// until whatever they’re part of is finished,
+// so that a node’s children are allocated before it
+// and the elements of an array literal or block end up next to each other.
+static void pushExpression(parser *p, fullExpression expression)
+{
+	if (p->expression_stack_count == p->expression_stack_capacity) {
+		u32 capacity = p->expression_stack_capacity * 2;
+		p->expression_stack = bumpGrowArray(
+			fullExpression, p->temp, p->expression_stack,
+			p->expression_stack_count, capacity);
+		p->expression_stack_capacity = capacity;
+	}
+
+	p->expression_stack[p->expression_stack_count++] = expression;
+}
+
+static fullExpression popExpression(parser *p)
+{
+	assert(p->expression_stack_count > 0);
+	return p->expression_stack[--p->expression_stack_count];
+}
+
+static void pushStatement(parser *p, fullStatement statement)
+{
+	if (p->statement_stack_count == p->statement_stack_capacity) {
+		u32 capacity = p->statement_stack_capacity * 2;
+		p->statement_stack = bumpGrowArray(
+			fullStatement, p->temp, p->statement_stack,
+			p->statement_stack_count, capacity);
+		p->statement_stack_capacity = capacity;
+	}
+
+	p->statement_stack[p->statement_stack_count++] = statement;
+}
+
+static fullStatement popStatement(parser *p)
+{
+	assert(p->statement_stack_count > 0);
+	return p->statement_stack[--p->statement_stack_count];
+}
+
+static void pushWork(parser *p, parseWork work)
+{
+	if (p->work_count == p->work_capacity) {
+		u32 capacity = p->work_capacity * 2;
+		p->work = bumpGrowArray(parseWork, p->temp, p->work,
+					p->work_count, capacity);
+		p->work_capacity = capacity;
+	}
+
+	p->work[p->work_count++] = work;
+}
+
+static void pushExpressionWork(parser *p, u8 min_binding_power,
+			       const char *error_name)
+{
+	pushWork(p, (parseWork){
+			    .step = STEP_EXPRESSION,
+			    .binding_power = min_binding_power,
+			    .error_name = error_name,
+		    });
+}
+
+static void pushNamedWork(parser *p, parseStep step,
+			      const char *error_name)
+{
+	pushWork(p, (parseWork){ .step = step, .error_name = error_name });
+}
+
+static u32 startOfSyntax(parser *p)
+{
+	return atEof(p) ? previousSpan(p).end : currentSpan(p).start;
+}
 
-static fullExpression indexExpression(parser *p, fullExpression array,
-				      memory *m)
+// Index expressions can follow any left-hand side,
+// and wrap it each time one is found.
+static void pushExpressionLhs(parser *p, fullExpression e)
 {
+	pushExpression(p, e);
+
+	if (!at(p, TOK_LSQUARE))
+		return;
+
+	expect(p, TOK_LSQUARE, ERROR_RECOVER);
+	pushWork(p, (parseWork){ .step = STEP_INDEX });
+	pushExpressionWork(p, 0, "index expression");
+}
+
+static void finishIndex(parser *p)
+{
+	fullExpression index = popExpression(p);
+	fullExpression array = popExpression(p);
+	expect(p, TOK_RSQUARE, ERROR_RECOVER);
+
 	fullExpression e;
 	memset(&e, 0, sizeof(e));
 	e.kind = AST_EXPR_INDEX;
 	e.span = array.span;
+	e.data.index.index = allocateExpression(p, index);
+	e.data.index.array = allocateExpression(p, array);
+	e.span.end = previousSpan(p).end;
 
-	assert(at(p, TOK_LSQUARE));
-	expect(p, TOK_LSQUARE, ERROR_RECOVER);
-	astExpression index =
-		allocateExpression(p, expression(p, "index expression", m));
-	expect(p, TOK_RSQUARE, ERROR_RECOVER);
+	pushExpressionLhs(p, e);
+}
 
-	e.data.index.array = allocateExpression(p, array);
-	e.data.index.index = index;
+static fullExpression finishArrayLiteral(parser *p, u32 start, u32 base)
+{
+	u32 count = p->expression_stack_count - base;
+	astExpression first = astExpressionMake(-1);
+
+	for (u32 i = 0; i < count; i++) {
+		astExpression this =
+			allocateExpression(p, p->expression_stack[base + i]);
+		if (first.index == (u32)-1)
+			first = this;
+	}
 
-	e.span.end = p->tokens.spans[p->cursor - 1].end;
+	p->expression_stack_count = base;
 
+	fullExpression e;
+	memset(&e, 0, sizeof(e));
+	e.kind = AST_EXPR_ARRAY_LITERAL;
+	e.span = (span){ .start = start, .end = previousSpan(p).end };
+	e.data.array_literal.start = first;
+	e.data.array_literal.count = count;
 	return e;
 }
 
-static fullExpression expressionLhs(parser *p, const char *error_name,
-				    memory *m)
+static void nextArrayElement(parser *p, parseWork work)
+{
+	if (!at(p, TOK_RSQUARE) && !atEof(p) && !atRecovery(p)) {
+		pushWork(p, (parseWork){
+				    .step = STEP_ARRAY_ELEMENT,
+				    .start = work.start,
+				    .a = work.a,
+			    });
+		pushExpressionWork(p, 0, "array element");
+		return;
+	}
+
+	expect(p, TOK_RSQUARE, ERROR_RECOVER);
+
+	// The elements are everything pushed since the array started.
+	fullExpression e = finishArrayLiteral(p, work.start, work.a);
+	pushExpressionLhs(p, e);
+}
+
+static void expressionLhs(parser *p, const char *error_name)
 {
 	fullExpression e;
 	memset(&e, 0, sizeof(e));
 	e.kind = -1;
-	e.span = (span){ .start = atEof(p) ? p->tokens.spans[p->cursor - 1].end
-					   : currentSpan(p).start };
+	e.span = (span){ .start = startOfSyntax(p) };
 
 	switch (current(p)) {
 	case TOK_NUMBER: {
-		span span = currentSpan(p);
+		u64 value = currentLiteralValue(p);
 		expect(p, TOK_NUMBER, ERROR_RECOVER);
 
-		char *start = (char *)p->content + span.start;
-		char *end = NULL;
-		u64 value = strtoll(start, &end, 10);
+		e.kind = AST_EXPR_INT_LITERAL;
+		e.data.int_literal.value = value;
+		break;
+	}
+
+	case TOK_IDENTIFIER: {
+		identifierId name = expectIdentifier(p, "variable name");
+		e.kind = AST_EXPR_VARIABLE;
+		e.data.variable.name = name;
+		break;
+	}
+
+	case TOK_AMPERSAND:
+		expect(p, TOK_AMPERSAND, ERROR_RECOVER);
+		pushWork(p, (parseWork){ .step = STEP_ADDRESS_OF,
+					 .start = e.span.start });
+		pushNamedWork(p, STEP_EXPRESSION_LHS, "expression");
+		return;
+
+	case TOK_STAR:
+		expect(p, TOK_STAR, ERROR_RECOVER);
+		pushWork(p, (parseWork){ .step = STEP_DEREFERENCE,
+					 .start = e.span.start });
+		pushNamedWork(p, STEP_EXPRESSION_LHS, "expression");
+		return;
+
+	case TOK_LPAREN:
+		expect(p, TOK_LPAREN, ERROR_RECOVER);
+		pushWork(p, (parseWork){ .step = STEP_PARENTHESIZED });
+		pushExpressionWork(p, 0, "parenthesized expression");
+		return;
+
+	case TOK_LSQUARE:
+		expect(p, TOK_LSQUARE, ERROR_RECOVER);
+		nextArrayElement(p, (parseWork){
+					    .start = e.span.start,
+					    .a = p->expression_stack_count,
+				    });
+		return;
+
+	// We don’t want to skip past these.
+	case TOK_RPAREN:
+	case TOK_RSQUARE:
+	case TOK_COMMA:
+	case TOK_EQUAL:
+		error(p, ERROR_EAT_NONE, error_name);
+		e.kind = AST_EXPR_MISSING;
+		break;
+
+	default:
+		error(p, ERROR_RECOVER, error_name);
+		e.kind = AST_EXPR_MISSING;
+		break;
+	}
+
+	assert(e.kind != (astExpressionKind)-1);
+	e.span.end = previousSpan(p).end;
+	pushExpressionLhs(p, e);
+}
+
+// Wraps the expression on top of the stack in a unary operator.
+static void finishUnary(parser *p, parseWork work, astExpressionKind kind)
+{
+	astExpression value = allocateExpression(p, popExpression(p));
+
+	fullExpression e;
+	memset(&e, 0, sizeof(e));
+	e.kind = kind;
+	e.span = (span){ .start = work.start, .end = previousSpan(p).end };
+	if (kind == AST_EXPR_ADDRESS_OF)
+		e.data.address_of.value = value;
+	else
+		e.data.dereference.value = value;
+	pushExpressionLhs(p, e);
+}
+
+static void finishParenthesized(parser *p)
+{
+	fullExpression e = popExpression(p);
+	expect(p, TOK_RPAREN, ERROR_RECOVER);
+	e.span.end = previousSpan(p).end;
+	pushExpressionLhs(p, e);
+}
+
+// Reads the binary operator at the cursor, if there is one,
+// without moving past it.
+static bool atBinaryOperator(parser *p, u8 *binding_power,
+			     astBinaryOperator *op)
+{
+	if (atEof(p))
+		return false;
+
+	switch (current(p)) {
+	case TOK_PLUS:
+		*binding_power = 2;
+		*op = AST_BINOP_ADD;
+		return true;
+	case TOK_DASH:
+		*binding_power = 2;
+		*op = AST_BINOP_SUBTRACT;
+		return true;
+	case TOK_STAR:
+		*binding_power = 3;
+		*op = AST_BINOP_MULTIPLY;
+		return true;
+	case TOK_SLASH:
+		*binding_power = 3;
+		*op = AST_BINOP_DIVIDE;
+		return true;
+	case TOK_EQUAL_EQUAL:
+		*binding_power = 1;
+		*op = AST_BINOP_EQUAL;
+		return true;
+	case TOK_BANG_EQUAL:
+		*binding_power = 1;
+		*op = AST_BINOP_NOT_EQUAL;
+		return true;
+	case TOK_LANGLE:
+		*binding_power = 1;
+		*op = AST_BINOP_LESS_THAN;
+		return true;
+	case TOK_LANGLE_EQUAL:
+		*binding_power = 1;
+		*op = AST_BINOP_LESS_THAN_EQUAL;
+		return true;
+	case TOK_RANGLE:
+		*binding_power = 1;
+		*op = AST_BINOP_GREATER_THAN;
+		return true;
+	case TOK_RANGLE_EQUAL:
+		*binding_power = 1;
+		*op = AST_BINOP_GREATER_THAN_EQUAL;
+		return true;
+	default:
+		return false;
+	}
+}
+
+static fullExpression binaryOperation(parser *p, fullExpression lhs,
+				      fullExpression rhs, astBinaryOperator op)
+{
+	astExpression allocd_lhs = allocateExpression(p, lhs);
+	astExpression allocd_rhs = allocateExpression(p, rhs);
+
+	span span = {
+		.start = astGetExpressionSpan(p->ast, allocd_lhs).start,
+		.end = previousSpan(p).end,
+	};
+
+	astBinaryOperation binary_operation;
+	memset(&binary_operation, 0, sizeof(binary_operation));
+	binary_operation.lhs = allocd_lhs;
+	binary_operation.rhs = allocd_rhs;
+	binary_operation.op = op;
+
+	fullExpression new_lhs;
+	memset(&new_lhs, 0, sizeof(new_lhs));
+	new_lhs.data.binary_operation = binary_operation;
+	new_lhs.kind = AST_EXPR_BINARY_OPERATION;
+	new_lhs.span = span;
+	return new_lhs;
+}
+
+// Looks for an operator after the expression on top of the stack
+// which binds at least as tightly as work.binding_power.
+static void binaryOperator(parser *p, parseWork work)
+{
+	u8 binding_power = 0;
+	astBinaryOperator op = -1;
+	if (!atBinaryOperator(p, &binding_power, &op))
+		return;
+	assert(binding_power != 0);
+	assert(op != (astBinaryOperator)-1);
+
+	if (binding_power < work.binding_power)
+		return;
+
+	// skip past operator token
+	addToken(p);
+
+	pushWork(p, (parseWork){
+			    .step = STEP_BINARY_OPERATION,
+			    .binding_power = work.binding_power,
+			    .op = op,
+		    });
+	pushExpressionWork(p, binding_power + 1, "operand");
+}
+
+static void finishBinaryOperation(parser *p, parseWork work)
+{
+	fullExpression rhs = popExpression(p);
+	fullExpression lhs = popExpression(p);
+	pushExpression(p, binaryOperation(p, lhs, rhs, work.op));
+	binaryOperator(p, work);
+}
+
+static void finishStatement(parser *p, fullStatement s)
+{
+	assert(s.kind != (astStatementKind)-1);
+	s.span.end = previousSpan(p).end;
+	pushStatement(p, s);
+}
+
+static fullStatement statementAt(u32 start, astStatementKind kind)
+{
+	fullStatement s;
+	memset(&s, 0, sizeof(s));
+	s.kind = kind;
+	s.span = (span){ .start = start };
+	return s;
+}
+
+static fullStatement finishBlock(parser *p, u32 start, u32 base)
+{
+	u32 count = p->statement_stack_count - base;
+	astStatement first = astStatementMake(-1);
+
+	for (u32 i = 0; i < count; i++) {
+		astStatement this =
+			allocateStatement(p, p->statement_stack[base + i]);
+		if (first.index == (u32)-1)
+			first = this;
+	}
 
-		usize num_bytes_converted = end - start;
-		usize token_length = span.end - span.start;
-		assert(num_bytes_converted == token_length);
+	p->statement_stack_count = base;
+
+	fullStatement s = statementAt(start, AST_STMT_BLOCK);
+	s.data.block.start = first;
+	s.data.block.count = count;
+	return s;
+}
+
+static void nextBlockStatement(parser *p, parseWork work)
+{
+	if (!at(p, TOK_RBRACE) && !atEof(p) && !atItemFirst(p)) {
+		pushWork(p, work);
+		pushNamedWork(p, STEP_STATEMENT, "statement");
+		return;
+	}
+
+	expect(p, TOK_RBRACE, ERROR_RECOVER);
+
+	// The block’s statements are everything pushed since it started.
+	finishStatement(p, finishBlock(p, work.start, work.a));
+}
+
+static void blockStatement(parser *p, const char *error_name)
+{
+	u32 start = startOfSyntax(p);
+
+	if (current(p) != TOK_LBRACE) {
+		// We expected a block, but we didn’t get one.
+		// Let’s parse a statement, just so we can get the span --
+		// we don’t actually keep the parsed statement.
+		pushWork(p, (parseWork){ .step = STEP_NOT_BLOCK,
+					 .start = start });
+		pushNamedWork(p, STEP_STATEMENT, error_name);
+		return;
+	}
+
+	expect(p, TOK_LBRACE, ERROR_RECOVER);
+	nextBlockStatement(p, (parseWork){
+				      .step = STEP_BLOCK_STATEMENT,
+				      .start = start,
+				      .a = p->statement_stack_count,
+			      });
+}
+
+static void finishNotBlock(parser *p, parseWork work)
+{
+	fullStatement erroneousStatement = popStatement(p);
+
+	// Only bother the user about this not being a block
+	// if we have a working statement in the first place!
+	if (erroneousStatement.kind != AST_STMT_MISSING)
+		diagnosticsStorageRecord(
+			p->diagnostics, DIAG_ERROR, erroneousStatement.span,
+			"expected block but found a single statement");
+
+	pushStatement(p, statementAt(work.start, AST_STMT_MISSING));
+}
+
+static void statement(parser *p, const char *error_name)
+{
+	u32 start = startOfSyntax(p);
+
+	switch (current(p)) {
+	case TOK_RETURN:
+		expect(p, TOK_RETURN, ERROR_RECOVER);
+		pushWork(p, (parseWork){ .step = STEP_RETURN, .start = start });
+		pushExpressionWork(p, 0, "return value");
+		break;
+
+	case TOK_SET:
+		expect(p, TOK_SET, ERROR_RECOVER);
+		pushWork(p, (parseWork){ .step = STEP_ASSIGN_LHS,
+					 .start = start });
+		pushExpressionWork(p, 0, "left-hand side of assignment");
+		break;
+
+	case TOK_IF:
+		expect(p, TOK_IF, ERROR_RECOVER);
+		pushWork(p, (parseWork){ .step = STEP_IF_CONDITION,
+					 .start = start });
+		pushExpressionWork(p, 0, "if statement condition");
+		break;
+
+	case TOK_ELSE: {
+		span span = currentSpan(p);
+		expect(p, TOK_ELSE, ERROR_RECOVER);
+		diagnosticsStorageRecord(p->diagnostics, DIAG_ERROR, span,
+					 "unmatched “else”");
+		finishStatement(p, statementAt(start, AST_STMT_MISSING));
+		break;
+	}
+
+	case TOK_WHILE:
+		expect(p, TOK_WHILE, ERROR_RECOVER);
+		pushWork(p, (parseWork){ .step = STEP_WHILE_CONDITION,
+					 .start = start });
+		pushExpressionWork(p, 0, "while loop condition");
+		break;
+
+	case TOK_LBRACE:
+		blockStatement(p, error_name);
+		break;
+
+	case TOK_IDENTIFIER: {
+		identifierId name = expectIdentifier(p, "variable name");
+		expect(p, TOK_COLON_EQUAL, ERROR_RECOVER);
+		pushWork(p, (parseWork){
+				    .step = STEP_LOCAL_DEFINITION,
+				    .start = start,
+				    .a = name.raw,
+			    });
+		pushExpressionWork(p, 0, "variable value");
+		break;
+	}
+
+	default:
+		error(p, ERROR_RECOVER, error_name);
+		finishStatement(p, statementAt(start, AST_STMT_MISSING));
+		break;
+	}
+}
+
+static void runStep(parser *p, parseWork work)
+{
+	switch (work.step) {
+	case STEP_EXPRESSION: {
+		pushWork(p, (parseWork){
+				    .step = STEP_BINARY_OPERATOR,
+				    .binding_power = work.binding_power,
+			    });
+
+		// Most left-hand sides are a single token,
+		// in which case we can look for an operator straight away.
+		u32 work_count = p->work_count;
+		expressionLhs(p, work.error_name);
+		if (p->work_count == work_count) {
+			p->work_count--;
+			binaryOperator(p, work);
+		}
+		break;
+	}
+
+	case STEP_EXPRESSION_LHS:
+		expressionLhs(p, work.error_name);
+		break;
+
+	case STEP_BINARY_OPERATOR:
+		binaryOperator(p, work);
+		break;
+
+	case STEP_BINARY_OPERATION:
+		finishBinaryOperation(p, work);
+		break;
+
+	case STEP_ADDRESS_OF:
+		finishUnary(p, work, AST_EXPR_ADDRESS_OF);
+		break;
+
+	case STEP_DEREFERENCE:
+		finishUnary(p, work, AST_EXPR_DEREFERENCE);
+		break;
+
+	case STEP_PARENTHESIZED:
+		finishParenthesized(p);
+		break;
+
+	case STEP_INDEX:
+		finishIndex(p);
+		break;
+
+	case STEP_ARRAY_ELEMENT:
+		if (!at(p, TOK_RSQUARE) && !atEof(p) && !atRecovery(p))
+			expect(p, TOK_COMMA, ERROR_EAT_NONE);
+		nextArrayElement(p, work);
+		break;
+
+	case STEP_STATEMENT:
+		statement(p, work.error_name);
+		break;
+
+	case STEP_BLOCK:
+		blockStatement(p, work.error_name);
+		break;
+
+	case STEP_NOT_BLOCK:
+		finishNotBlock(p, work);
+		break;
+
+	case STEP_BLOCK_STATEMENT:
+		nextBlockStatement(p, work);
+		break;
+
+	case STEP_RETURN: {
+		fullStatement s = statementAt(work.start, AST_STMT_RETURN);
+		s.data.retrn.value = allocateExpression(p, popExpression(p));
+		finishStatement(p, s);
+		break;
+	}
+
+	case STEP_ASSIGN_LHS: {
+		astExpression lhs = allocateExpression(p, popExpression(p));
+		expect(p, TOK_EQUAL, ERROR_RECOVER);
+		pushWork(p, (parseWork){
+				    .step = STEP_ASSIGN_RHS,
+				    .start = work.start,
+				    .a = lhs.index,
+			    });
+		pushExpressionWork(p, 0, "right-hand side of assignment");
+		break;
+	}
+
+	case STEP_ASSIGN_RHS: {
+		fullStatement s = statementAt(work.start, AST_STMT_ASSIGN);
+		s.data.assign.lhs = astExpressionMake(work.a);
+		s.data.assign.rhs = allocateExpression(p, popExpression(p));
+		finishStatement(p, s);
+		break;
+	}
+
+	case STEP_IF_CONDITION: {
+		astExpression condition =
+			allocateExpression(p, popExpression(p));
+		pushWork(p, (parseWork){
+				    .step = STEP_IF_TRUE_BRANCH,
+				    .start = work.start,
+				    .a = condition.index,
+			    });
+		pushNamedWork(p, STEP_BLOCK, "if statement true branch");
+		break;
+	}
+
+	case STEP_IF_TRUE_BRANCH: {
+		astStatement true_block = allocateStatement(p, popStatement(p));
+		if (at(p, TOK_ELSE)) {
+			expect(p, TOK_ELSE, ERROR_RECOVER);
+			pushWork(p, (parseWork){
+					    .step = STEP_IF_FALSE_BRANCH,
+					    .start = work.start,
+					    .a = work.a,
+					    .b = true_block.index,
+				    });
+			pushNamedWork(p, STEP_BLOCK,
+					  "if statement false branch");
+			break;
+		}
+
+		fullStatement s = statementAt(work.start, AST_STMT_IF);
+		s.data.if_.condition = astExpressionMake(work.a);
+		s.data.if_.true_block = true_block;
+		s.data.if_.false_block = astStatementMake(-1);
+		finishStatement(p, s);
+		break;
+	}
+
+	case STEP_IF_FALSE_BRANCH: {
+		fullStatement s = statementAt(work.start, AST_STMT_IF);
+		s.data.if_.condition = astExpressionMake(work.a);
+		s.data.if_.true_block = astStatementMake(work.b);
+		s.data.if_.false_block = allocateStatement(p, popStatement(p));
+		finishStatement(p, s);
+		break;
+	}
+
+	case STEP_WHILE_CONDITION: {
+		astExpression condition =
+			allocateExpression(p, popExpression(p));
+		pushWork(p, (parseWork){
+				    .step = STEP_WHILE_BODY,
+				    .start = work.start,
+				    .a = condition.index,
+			    });
+		pushNamedWork(p, STEP_BLOCK, "while loop body");
+		break;
+	}
+
+	case STEP_WHILE_BODY: {
+		fullStatement s = statementAt(work.start, AST_STMT_WHILE);
+		s.data.while_.condition = astExpressionMake(work.a);
+		s.data.while_.true_block =
+			allocateStatement(p, popStatement(p));
+		finishStatement(p, s);
+		break;
+	}
+
+	case STEP_LOCAL_DEFINITION: {
+		fullStatement s =
+			statementAt(work.start, AST_STMT_LOCAL_DEFINITION);
+		s.data.local_definition.name = (identifierId){ .raw = work.a };
+		s.data.local_definition.value =
+			allocateExpression(p, popExpression(p));
+		finishStatement(p, s);
+		break;
+	}
+	}
+}
+
+// Runs one piece of work, and everything it pushes in turn,
+// leaving whatever it parsed on top of the expression or statement stack.
+static void runWork(parser *p, parseWork work)
+{
+	u32 base = p->work_count;
+	pushWork(p, work);
+
+	while (p->work_count > base)
+		runStep(p, p->work[--p->work_count]);
+}
+
+// Below here is the same grammar again, as plain recursive descent.
+// Each function hands off to the work stack once nesting gets too deep.
+
+static fullExpression recursiveExpression(parser *p, u8 min_binding_power,
+					  const char *error_name);
+
+static fullExpression recursiveExpressionLhs(parser *p, const char *error_name)
+{
+	if (p->depth == MAX_RECURSION_DEPTH) {
+		runWork(p, (parseWork){ .step = STEP_EXPRESSION_LHS,
+					.error_name = error_name });
+		return popExpression(p);
+	}
+	p->depth++;
+
+	fullExpression e;
+	memset(&e, 0, sizeof(e));
+	e.kind = -1;
+	e.span = (span){ .start = startOfSyntax(p) };
+
+	switch (current(p)) {
+	case TOK_NUMBER: {
+		u64 value = currentLiteralValue(p);
+		expect(p, TOK_NUMBER, ERROR_RECOVER);
 
 		e.kind = AST_EXPR_INT_LITERAL;
 		e.data.int_literal.value = value;
@@ -245,7 +1066,7 @@ static fullExpression expressionLhs(parser *p, const char *error_name,
 	case TOK_AMPERSAND: {
 		expect(p, TOK_AMPERSAND, ERROR_RECOVER);
 		astExpression value = allocateExpression(
-			p, expressionLhs(p, "expression", m));
+			p, recursiveExpressionLhs(p, "expression"));
 		e.kind = AST_EXPR_ADDRESS_OF;
 		e.data.address_of.value = value;
 		break;
@@ -254,55 +1075,29 @@ static fullExpression expressionLhs(parser *p, const char *error_name,
 	case TOK_STAR: {
 		expect(p, TOK_STAR, ERROR_RECOVER);
 		astExpression value = allocateExpression(
-			p, expressionLhs(p, "expression", m));
+			p, recursiveExpressionLhs(p, "expression"));
 		e.kind = AST_EXPR_DEREFERENCE;
 		e.data.dereference.value = value;
 		break;
 	}
 
-	case TOK_LPAREN: {
+	case TOK_LPAREN:
 		expect(p, TOK_LPAREN, ERROR_RECOVER);
-		fullExpression inner =
-			expression(p, "parenthesized expression", m);
+		e = recursiveExpression(p, 0, "parenthesized expression");
 		expect(p, TOK_RPAREN, ERROR_RECOVER);
-		e = inner;
 		break;
-	}
 
 	case TOK_LSQUARE: {
 		expect(p, TOK_LSQUARE, ERROR_RECOVER);
-
-		bumpMark mark = bumpCreateMark(&m->temp);
-		arrayBuilder expressions_builder =
-			bumpStartArrayBuilder(&m->temp, sizeof(fullExpression));
-		u16 count = 0;
-
+		u32 base = p->expression_stack_count;
 		while (!at(p, TOK_RSQUARE) && !atEof(p) && !atRecovery(p)) {
-			fullExpression expr = expression(p, "array element", m);
+			pushExpression(p, recursiveExpression(p, 0,
+							      "array element"));
 			if (!at(p, TOK_RSQUARE) && !atEof(p) && !atRecovery(p))
 				expect(p, TOK_COMMA, ERROR_EAT_NONE);
-			arrayBuilderPush(&expressions_builder, &expr);
-			count++;
 		}
 		expect(p, TOK_RSQUARE, ERROR_RECOVER);
-
-		fullExpression *expressions =
-			bumpFinishArrayBuilder(&m->temp, &expressions_builder);
-
-		astExpression start = astExpressionMake(-1);
-
-		for (u16 i = 0; i < count; i++) {
-			astExpression this =
-				allocateExpression(p, expressions[i]);
-			if (start.index == (u16)-1)
-				start = this;
-		}
-
-		bumpClearToMark(&m->temp, mark);
-
-		e.kind = AST_EXPR_ARRAY_LITERAL;
-		e.data.array_literal.start = start;
-		e.data.array_literal.count = count;
+		e = finishArrayLiteral(p, e.span.start, base);
 		break;
 	}
 
@@ -322,207 +1117,106 @@ static fullExpression expressionLhs(parser *p, const char *error_name,
 	}
 
 	assert(e.kind != (astExpressionKind)-1);
-	e.span.end = p->tokens.spans[p->cursor - 1].end;
+	e.span.end = previousSpan(p).end;
 
-	for (;;) {
-		switch (current(p)) {
-		case TOK_LSQUARE:
-			e = indexExpression(p, e, m);
-			break;
+	while (at(p, TOK_LSQUARE)) {
+		expect(p, TOK_LSQUARE, ERROR_RECOVER);
+		astExpression index = allocateExpression(
+			p, recursiveExpression(p, 0, "index expression"));
+		expect(p, TOK_RSQUARE, ERROR_RECOVER);
 
-		default:
-			return e;
-		}
+		fullExpression array = e;
+		memset(&e, 0, sizeof(e));
+		e.kind = AST_EXPR_INDEX;
+		e.span = array.span;
+		e.data.index.index = index;
+		e.data.index.array = allocateExpression(p, array);
+		e.span.end = previousSpan(p).end;
 	}
+
+	p->depth--;
+	return e;
 }
 
-static fullExpression expressionBindingPower(parser *p, u8 min_binding_power,
-					     const char *error_name, memory *m)
+static fullExpression recursiveExpression(parser *p, u8 min_binding_power,
+					  const char *error_name)
 {
-	fullExpression lhs = expressionLhs(p, error_name, m);
+	fullExpression lhs = recursiveExpressionLhs(p, error_name);
 
 	for (;;) {
-		if (atEof(p))
-			return lhs;
-
 		u8 binding_power = 0;
 		astBinaryOperator op = -1;
-		switch (current(p)) {
-		case TOK_PLUS:
-			binding_power = 2;
-			op = AST_BINOP_ADD;
-			break;
-		case TOK_DASH:
-			binding_power = 2;
-			op = AST_BINOP_SUBTRACT;
-			break;
-		case TOK_STAR:
-			binding_power = 3;
-			op = AST_BINOP_MULTIPLY;
-			break;
-		case TOK_SLASH:
-			binding_power = 3;
-			op = AST_BINOP_DIVIDE;
-			break;
-		case TOK_EQUAL_EQUAL:
-			binding_power = 1;
-			op = AST_BINOP_EQUAL;
-			break;
-		case TOK_BANG_EQUAL:
-			binding_power = 1;
-			op = AST_BINOP_NOT_EQUAL;
-			break;
-		case TOK_LANGLE:
-			binding_power = 1;
-			op = AST_BINOP_LESS_THAN;
-			break;
-		case TOK_LANGLE_EQUAL:
-			binding_power = 1;
-			op = AST_BINOP_LESS_THAN_EQUAL;
-			break;
-		case TOK_RANGLE:
-			binding_power = 1;
-			op = AST_BINOP_GREATER_THAN;
-			break;
-		case TOK_RANGLE_EQUAL:
-			binding_power = 1;
-			op = AST_BINOP_GREATER_THAN_EQUAL;
-			break;
-		default:
+		if (!atBinaryOperator(p, &binding_power, &op))
 			return lhs;
-		}
 		assert(binding_power != 0);
 		assert(op != (astBinaryOperator)-1);
 
-		if (binding_power < min_binding_power)
-			return lhs;
-
-		// skip past operator token
-		addToken(p);
-
-		fullExpression rhs = expressionBindingPower(
-			p, binding_power + 1, "operand", m);
-
-		astExpression allocd_lhs = allocateExpression(p, lhs);
-		astExpression allocd_rhs = allocateExpression(p, rhs);
-
-		span span = {
-			.start = astGetExpressionSpan(p->ast, allocd_lhs).start,
-			.end = p->tokens.spans[p->cursor - 1].end,
-		};
-
-		astBinaryOperation binary_operation;
-		memset(&binary_operation, 0, sizeof(binary_operation));
-		binary_operation.lhs = allocd_lhs;
-		binary_operation.rhs = allocd_rhs;
-		binary_operation.op = op;
-
-		fullExpression new_lhs;
-		memset(&new_lhs, 0, sizeof(new_lhs));
-		new_lhs.data.binary_operation = binary_operation;
-		new_lhs.kind = AST_EXPR_BINARY_OPERATION;
-		new_lhs.span = span;
-
-		lhs = new_lhs;
-	}
-}
-
-static fullExpression expression(parser *p, const char *error_name, memory *m)
-{
-	return expressionBindingPower(p, 0, error_name, m);
-}
-
-static fullStatement statement(parser *p, const char *error_name, memory *m);
-
-static fullStatement blockStatement(parser *p, const char *error_name,
-				    memory *m)
-{
-	fullStatement s;
-	memset(&s, 0, sizeof(s));
-	s.kind = -1;
-	s.span = (span){ .start = atEof(p) ? p->tokens.spans[p->cursor - 1].end
-					   : currentSpan(p).start };
-
-	if (current(p) != TOK_LBRACE) {
-		// We expected a block, but we didn’t get one.
-		// Let’s parse a statement, just so we can get the span --
-		// we don’t actually keep the parsed statement.
-
-		fullStatement erroneousStatement = statement(p, error_name, m);
-
-		// Only bother the user about this not being a block
-		// if we have a working statement in the first place!
-		if (erroneousStatement.kind != AST_STMT_MISSING)
-			diagnosticsStorageRecord(
-				p->diagnostics, DIAG_ERROR,
-				erroneousStatement.span,
-				"expected block but found a single statement");
-
-		s.kind = AST_STMT_MISSING;
-		return s;
-	}
-
-	expect(p, TOK_LBRACE, ERROR_RECOVER);
+		if (binding_power < min_binding_power)
+			return lhs;
 
-	bumpMark mark = bumpCreateMark(&m->temp);
-	arrayBuilder statements_builder =
-		bumpStartArrayBuilder(&m->temp, sizeof(fullStatement));
-	u16 count = 0;
+		// skip past operator token
+		addToken(p);
 
-	while (!at(p, TOK_RBRACE) && !atEof(p) && !atItemFirst(p)) {
-		fullStatement stmt = statement(p, "statement", m);
-		arrayBuilderPush(&statements_builder, &stmt);
-		count++;
+		fullExpression rhs =
+			recursiveExpression(p, binding_power + 1, "operand");
+		lhs = binaryOperation(p, lhs, rhs, op);
 	}
-	expect(p, TOK_RBRACE, ERROR_RECOVER);
+}
 
-	fullStatement *statements =
-		bumpFinishArrayBuilder(&m->temp, &statements_builder);
+static fullStatement recursiveStatement(parser *p, const char *error_name);
 
-	astStatement start = astStatementMake(-1);
+static fullStatement recursiveBlock(parser *p, const char *error_name)
+{
+	u32 start = startOfSyntax(p);
 
-	for (u16 i = 0; i < count; i++) {
-		astStatement this = allocateStatement(p, statements[i]);
-		if (start.index == (u16)-1)
-			start = this;
+	if (current(p) != TOK_LBRACE) {
+		// We expected a block, but we didn’t get one.
+		// Let’s parse a statement, just so we can get the span --
+		// we don’t actually keep the parsed statement.
+		pushStatement(p, recursiveStatement(p, error_name));
+		finishNotBlock(p, (parseWork){ .start = start });
+		return popStatement(p);
 	}
 
-	bumpClearToMark(&m->temp, mark);
-
-	s.kind = AST_STMT_BLOCK;
-	s.data.block.start = start;
-	s.data.block.count = count;
+	expect(p, TOK_LBRACE, ERROR_RECOVER);
+	u32 base = p->statement_stack_count;
+	while (!at(p, TOK_RBRACE) && !atEof(p) && !atItemFirst(p))
+		pushStatement(p, recursiveStatement(p, "statement"));
+	expect(p, TOK_RBRACE, ERROR_RECOVER);
 
-	assert(s.kind != (astStatementKind)-1);
-	s.span.end = p->tokens.spans[p->cursor - 1].end;
+	fullStatement s = finishBlock(p, start, base);
+	s.span.end = previousSpan(p).end;
 	return s;
 }
 
-static fullStatement statement(parser *p, const char *error_name, memory *m)
+static fullStatement recursiveStatement(parser *p, const char *error_name)
 {
-	fullStatement s;
-	memset(&s, 0, sizeof(s));
-	s.kind = -1;
-	s.span = (span){ .start = atEof(p) ? p->tokens.spans[p->cursor - 1].end
-					   : currentSpan(p).start };
+	if (p->depth == MAX_RECURSION_DEPTH) {
+		runWork(p, (parseWork){ .step = STEP_STATEMENT,
+					.error_name = error_name });
+		return popStatement(p);
+	}
+	p->depth++;
+
+	fullStatement s = statementAt(startOfSyntax(p), -1);
 
 	switch (current(p)) {
-	case TOK_RETURN: {
+	case TOK_RETURN:
 		expect(p, TOK_RETURN, ERROR_RECOVER);
-		astExpression value =
-			allocateExpression(p, expression(p, "return value", m));
 		s.kind = AST_STMT_RETURN;
-		s.data.retrn.value = value;
+		s.data.retrn.value = allocateExpression(
+			p, recursiveExpression(p, 0, "return value"));
 		break;
-	}
 
 	case TOK_SET: {
 		expect(p, TOK_SET, ERROR_RECOVER);
 		astExpression lhs = allocateExpression(
-			p, expression(p, "left-hand side of assignment", m));
+			p, recursiveExpression(p, 0,
+					       "left-hand side of assignment"));
 		expect(p, TOK_EQUAL, ERROR_RECOVER);
 		astExpression rhs = allocateExpression(
-			p, expression(p, "right-hand side of assignment", m));
+			p, recursiveExpression(
+				   p, 0, "right-hand side of assignment"));
 		s.kind = AST_STMT_ASSIGN;
 		s.data.assign.lhs = lhs;
 		s.data.assign.rhs = rhs;
@@ -532,15 +1226,15 @@ static fullStatement statement(parser *p, const char *error_name, memory *m)
 	case TOK_IF: {
 		expect(p, TOK_IF, ERROR_RECOVER);
 		astExpression condition = allocateExpression(
-			p, expression(p, "if statement condition", m));
+			p, recursiveExpression(p, 0, "if statement condition"));
 		astStatement true_block = allocateStatement(
-			p, blockStatement(p, "if statement true branch", m));
+			p, recursiveBlock(p, "if statement true branch"));
 		astStatement false_block = astStatementMake(-1);
 		if (at(p, TOK_ELSE)) {
 			expect(p, TOK_ELSE, ERROR_RECOVER);
 			false_block = allocateStatement(
-				p, blockStatement(
-					   p, "if statement false branch", m));
+				p,
+				recursiveBlock(p, "if statement false branch"));
 		}
 		s.kind = AST_STMT_IF;
 		s.data.if_.condition = condition;
@@ -561,9 +1255,9 @@ static fullStatement statement(parser *p, const char *error_name, memory *m)
 	case TOK_WHILE: {
 		expect(p, TOK_WHILE, ERROR_RECOVER);
 		astExpression condition = allocateExpression(
-			p, expression(p, "while loop condition", m));
+			p, recursiveExpression(p, 0, "while loop condition"));
 		astStatement body = allocateStatement(
-			p, blockStatement(p, "while loop body", m));
+			p, recursiveBlock(p, "while loop body"));
 		s.kind = AST_STMT_WHILE;
 		s.data.while_.condition = condition;
 		s.data.while_.true_block = body;
@@ -571,13 +1265,14 @@ static fullStatement statement(parser *p, const char *error_name, memory *m)
 	}
 
 	case TOK_LBRACE:
-		return blockStatement(p, error_name, m);
+		s = recursiveBlock(p, error_name);
+		break;
 
 	case TOK_IDENTIFIER: {
 		identifierId name = expectIdentifier(p, "variable name");
 		expect(p, TOK_COLON_EQUAL, ERROR_RECOVER);
 		astExpression value = allocateExpression(
-			p, expression(p, "variable value", m));
+			p, recursiveExpression(p, 0, "variable value"));
 		s.kind = AST_STMT_LOCAL_DEFINITION;
 		s.data.local_definition.name = name;
 		s.data.local_definition.value = value;
@@ -591,18 +1286,22 @@ static fullStatement statement(parser *p, const char *error_name, memory *m)
 	}
 
 	assert(s.kind != (astStatementKind)-1);
-	s.span.end = p->tokens.spans[p->cursor - 1].end;
+	s.span.end = previousSpan(p).end;
+	p->depth--;
 	return s;
 }
 
-static astFunction function(parser *p, memory *m)
+static astFunction function(parser *p)
 {
 	assert(at(p, TOK_FUNC));
 	expect(p, TOK_FUNC, ERROR_RECOVER);
 
 	identifierId name = expectIdentifier(p, "function name");
 	astStatement body =
-		allocateStatement(p, statement(p, "function body", m));
+		allocateStatement(p, recursiveStatement(p, "function body"));
+	assert(p->depth == 0);
+	assert(p->expression_stack_count == 0);
+	assert(p->statement_stack_count == 0);
 
 	astFunction function;
 	memset(&function, 0, sizeof(function));
@@ -611,71 +1310,915 @@ static astFunction function(parser *p, memory *m)
 	return function;
 }
 
-astRoot parse(tokenBuffer tokens, char *content,
-	      diagnosticsStorage *diagnostics, memory *m)
+static parser parserCreate(tokenBuffer tokens, usize token_count,
+			   diagnosticsStorage *diagnostics, memory *m)
 {
-	bumpMark mark = bumpCreateMark(&m->temp);
-
-	arrayBuilder functions =
-		bumpStartArrayBuilder(&m->general, sizeof(astFunction));
-
 	parser p = {
 		.tokens = tokens,
 		.cursor = 0,
-		.content = content,
-		.ast = {
-			.functions = NULL,
-			.statements = bumpAllocateArray(astStatementData, &m->temp, MAX_STATEMENT_COUNT),
-			.statement_kinds = bumpAllocateArray(astStatementKind, &m->temp, MAX_STATEMENT_COUNT),
-			.statement_spans = bumpAllocateArray(span, &m->temp, MAX_STATEMENT_COUNT),
-			.expressions = bumpAllocateArray(astExpressionData, &m->temp, MAX_EXPRESSION_COUNT),
-			.expression_kinds = bumpAllocateArray(astExpressionKind, &m->temp, MAX_EXPRESSION_COUNT),
-			.expression_spans = bumpAllocateArray(span, &m->temp, MAX_EXPRESSION_COUNT),
-			.function_count = 0,
-			.statement_count = 0,
-			.expression_count = 0,
-		},
 		.diagnostics = diagnostics,
+		.general = &m->general,
 	};
 
-	while (!atEof(&p)) {
-		switch (current(&p)) {
-		case TOK_FUNC: {
-			astFunction f = function(&p, m);
-			arrayBuilderPush(&functions, &f);
-			p.ast.function_count++;
+	// Nearly every expression and statement consumes a token of its own,
+	// and in practice there’s about one expression for every two tokens
+	// and one statement for every four or five.
+	// Sizing the arrays from the token count means they almost never
+	// have to grow, but they still can: error recovery produces nodes
+	// without consuming anything.
+	growExpressions(&p, token_count / 4 * 3 + 1);
+	growStatements(&p, token_count / 2 + 1);
+	growFunctions(&p, token_count / 16 + 1);
+
+	return p;
+}
+
+// Parses top-level items up to the token at end,
+// which must be either the end of the buffer or a “func” token,
+// since that’s where the parser would stop anyway.
+static void parseItems(parser *p, usize end, memory *m)
+{
+	bumpMark mark = bumpCreateMark(&m->temp);
+	p->temp = &m->temp;
+	p->work = bumpAllocateArray(parseWork, &m->temp, MIN_STACK_CAPACITY);
+	p->work_capacity = MIN_STACK_CAPACITY;
+	p->expression_stack = bumpAllocateArray(fullExpression, &m->temp,
+						MIN_STACK_CAPACITY);
+	p->expression_stack_capacity = MIN_STACK_CAPACITY;
+	p->statement_stack = bumpAllocateArray(fullStatement, &m->temp,
+					       MIN_STACK_CAPACITY);
+	p->statement_stack_capacity = MIN_STACK_CAPACITY;
+
+	while (p->cursor < end) {
+		switch (current(p)) {
+		case TOK_FUNC:
+			pushFunction(p, function(p));
 			break;
-		}
 		default:
-			error(&p, ERROR_EAT_ALL, "function");
+			error(p, ERROR_EAT_ALL, "function");
 			break;
 		}
 	}
 
-	p.ast.functions = bumpFinishArrayBuilder(&m->general, &functions);
-
-	p.ast.statements =
-		bumpCopyArray(astStatementData, &m->general, p.ast.statements,
-			      p.ast.statement_count);
-	p.ast.statement_kinds =
-		bumpCopyArray(astStatementKind, &m->general,
-			      p.ast.statement_kinds, p.ast.statement_count);
-	p.ast.statement_spans =
-		bumpCopyArray(span, &m->general, p.ast.statement_spans,
-			      p.ast.statement_count);
-
-	p.ast.expressions =
-		bumpCopyArray(astExpressionData, &m->general, p.ast.expressions,
-			      p.ast.expression_count);
-	p.ast.expression_kinds =
-		bumpCopyArray(astExpressionKind, &m->general,
-			      p.ast.expression_kinds, p.ast.expression_count);
-	p.ast.expression_spans =
-		bumpCopyArray(span, &m->general, p.ast.expression_spans,
-			      p.ast.expression_count);
+	bumpClearToMark(&m->temp, mark);
+}
+
+static astRoot parseRange(tokenBuffer tokens, usize start, usize end,
+			  diagnosticsStorage *diagnostics, memory *m)
+{
+	parser p = parserCreate(tokens, end - start, diagnostics, m);
+	seek(&p, start);
+	parseItems(&p, end, m);
+	return p.ast;
+}
+
+astRoot parse(tokenBuffer tokens, diagnosticsStorage *diagnostics, memory *m)
+{
+	return parseRange(tokens, 0, tokens.count, diagnostics, m);
+}
+
+// Ranges with fewer tokens than this aren’t worth starting a thread for.
+enum { MIN_PARALLEL_PARSE_RANGE_TOKENS = 64 * 1024 };
+
+typedef struct parseJob {
+	tokenBuffer tokens;
+	usize start;
+	usize end;
+	u16 file;
+	memory m;
+	diagnosticsStorage diagnostics;
+	astRoot ast;
+} parseJob;
+
+static void *parseJobRun(void *arg)
+{
+	parseJob *job = arg;
+	job->diagnostics =
+		diagnosticsStorageCreateForFile(&job->m.general, job->file);
+	job->ast = parseRange(job->tokens, job->start, job->end,
+			      &job->diagnostics, &job->m);
+	return NULL;
+}
+
+// Splits the tokens into at most range_count ranges
+// which each start at a “func” token (apart from the first).
+// Nothing inside a function ever consumes a “func” token,
+// so each one starts a top-level item no matter what came before it,
+// and parsing the ranges separately produces the same nodes
+// as parsing the whole buffer at once.
+static usize splitAtFunctions(tokenBuffer tokens, usize range_count,
+			      parseJob *jobs)
+{
+	usize count = 0;
+	usize start = 0;
+
+	for (usize i = 0; i < range_count && start < tokens.count; i++) {
+		usize end = tokens.count * (i + 1) / range_count;
+		if (end <= start)
+			end = start + 1;
+
+		// The last range always runs to the end of the buffer.
+		if (i == range_count - 1)
+			end = tokens.count;
+
+		while (end < tokens.count && tokens.kinds[end] != TOK_FUNC)
+			end++;
+
+		jobs[count] = (parseJob){
+			.tokens = tokens,
+			.start = start,
+			.end = end,
+			.file = currentFile(),
+		};
+		count++;
+		start = end;
+	}
+
+	return count;
+}
+
+static astExpression rebaseExpression(astExpression expression, u32 offset)
+{
+	if (expression.index == (u32)-1)
+		return expression;
+	return astExpressionMake(expression.index + offset);
+}
+
+static astStatement rebaseStatement(astStatement statement, u32 offset)
+{
+	if (statement.index == (u32)-1)
+		return statement;
+	return astStatementMake(statement.index + offset);
+}
+
+static astExpressionData rebaseExpressionData(astExpressionData data,
+					      astExpressionKind kind,
+					      u32 expression_offset)
+{
+	switch (kind) {
+	case AST_EXPR_MISSING:
+	case AST_EXPR_INT_LITERAL:
+	case AST_EXPR_VARIABLE:
+		break;
+
+	case AST_EXPR_BINARY_OPERATION:
+		data.binary_operation.lhs = rebaseExpression(
+			data.binary_operation.lhs, expression_offset);
+		data.binary_operation.rhs = rebaseExpression(
+			data.binary_operation.rhs, expression_offset);
+		break;
+
+	case AST_EXPR_ADDRESS_OF:
+		data.address_of.value = rebaseExpression(data.address_of.value,
+							 expression_offset);
+		break;
+
+	case AST_EXPR_DEREFERENCE:
+		data.dereference.value = rebaseExpression(
+			data.dereference.value, expression_offset);
+		break;
+
+	case AST_EXPR_INDEX:
+		data.index.array =
+			rebaseExpression(data.index.array, expression_offset);
+		data.index.index =
+			rebaseExpression(data.index.index, expression_offset);
+		break;
+
+	case AST_EXPR_ARRAY_LITERAL:
+		data.array_literal.start = rebaseExpression(
+			data.array_literal.start, expression_offset);
+		break;
+	}
+
+	return data;
+}
+
+static astStatementData rebaseStatementData(astStatementData data,
+					    astStatementKind kind,
+					    u32 statement_offset,
+					    u32 expression_offset)
+{
+	switch (kind) {
+	case AST_STMT_MISSING:
+		break;
+
+	case AST_STMT_RETURN:
+		data.retrn.value =
+			rebaseExpression(data.retrn.value, expression_offset);
+		break;
+
+	case AST_STMT_LOCAL_DEFINITION:
+		data.local_definition.value = rebaseExpression(
+			data.local_definition.value, expression_offset);
+		break;
+
+	case AST_STMT_ASSIGN:
+		data.assign.lhs =
+			rebaseExpression(data.assign.lhs, expression_offset);
+		data.assign.rhs =
+			rebaseExpression(data.assign.rhs, expression_offset);
+		break;
+
+	case AST_STMT_IF:
+		data.if_.condition =
+			rebaseExpression(data.if_.condition, expression_offset);
+		data.if_.true_block =
+			rebaseStatement(data.if_.true_block, statement_offset);
+		data.if_.false_block =
+			rebaseStatement(data.if_.false_block, statement_offset);
+		break;
+
+	case AST_STMT_WHILE:
+		data.while_.condition = rebaseExpression(data.while_.condition,
+							 expression_offset);
+		data.while_.true_block = rebaseStatement(
+			data.while_.true_block, statement_offset);
+		break;
+
+	case AST_STMT_BLOCK:
+		data.block.start =
+			rebaseStatement(data.block.start, statement_offset);
+		break;
+	}
+
+	return data;
+}
+
+// Each range’s nodes are numbered from zero,
+// so concatenating them means shifting every handle
+// by the number of nodes in the ranges before it.
+static astRoot stitchAsts(parseJob *jobs, usize job_count,
+			  diagnosticsStorage *diagnostics, memory *m)
+{
+	astRoot ast = { 0 };
+	for (usize i = 0; i < job_count; i++) {
+		ast.function_count += jobs[i].ast.function_count;
+		ast.statement_count += jobs[i].ast.statement_count;
+		ast.expression_count += jobs[i].ast.expression_count;
+	}
+
+	ast.functions =
+		bumpAllocateArray(astFunction, &m->general, ast.function_count);
+	ast.statements = bumpAllocateArray(astStatementData, &m->general,
+					   ast.statement_count);
+	ast.statement_kinds = bumpAllocateArray(astStatementKind, &m->general,
+						ast.statement_count);
+	ast.statement_spans =
+		bumpAllocateArray(span, &m->general, ast.statement_count);
+	ast.expressions = bumpAllocateArray(astExpressionData, &m->general,
+					    ast.expression_count);
+	ast.expression_kinds = bumpAllocateArray(
+		astExpressionKind, &m->general, ast.expression_count);
+	ast.expression_spans =
+		bumpAllocateArray(span, &m->general, ast.expression_count);
+
+	u32 function_offset = 0;
+	u32 statement_offset = 0;
+	u32 expression_offset = 0;
+
+	for (usize i = 0; i < job_count; i++) {
+		parseJob *job = &jobs[i];
+		astRoot range = job->ast;
+
+		memcpy(ast.statement_kinds + statement_offset,
+		       range.statement_kinds,
+		       range.statement_count * sizeof(astStatementKind));
+		memcpy(ast.statement_spans + statement_offset,
+		       range.statement_spans,
+		       range.statement_count * sizeof(span));
+		memcpy(ast.expression_kinds + expression_offset,
+		       range.expression_kinds,
+		       range.expression_count * sizeof(astExpressionKind));
+		memcpy(ast.expression_spans + expression_offset,
+		       range.expression_spans,
+		       range.expression_count * sizeof(span));
+
+		for (u32 j = 0; j < range.function_count; j++) {
+			astFunction function = range.functions[j];
+			function.body = rebaseStatement(function.body,
+							statement_offset);
+			ast.functions[function_offset + j] = function;
+		}
+
+		for (u32 j = 0; j < range.statement_count; j++)
+			ast.statements[statement_offset + j] =
+				rebaseStatementData(range.statements[j],
+						    range.statement_kinds[j],
+						    statement_offset,
+						    expression_offset);
+
+		for (u32 j = 0; j < range.expression_count; j++)
+			ast.expressions[expression_offset + j] =
+				rebaseExpressionData(range.expressions[j],
+						     range.expression_kinds[j],
+						     expression_offset);
+
+		// Spans are already relative to the start of the file.
+		diagnosticsStorage range_diagnostics = job->diagnostics;
+		for (u16 j = 0; j < range_diagnostics.count; j++) {
+			u32 message_start = range_diagnostics.message_starts[j];
+			char *message = (char *)(range_diagnostics.all_messages
+							 .top +
+						 message_start);
+			diagnosticsStorageRecord(
+				diagnostics, range_diagnostics.severities[j],
+				range_diagnostics.spans[j], "%s", message);
+		}
+
+		function_offset += range.function_count;
+		statement_offset += range.statement_count;
+		expression_offset += range.expression_count;
+	}
+
+	return ast;
+}
+
+static astRoot parseRanges(tokenBuffer tokens, usize range_count,
+			   diagnosticsStorage *diagnostics, memory *m)
+{
+	bumpMark mark = bumpCreateMark(&m->temp);
+	parseJob *jobs = bumpAllocateArray(parseJob, &m->temp, range_count);
+	usize job_count = splitAtFunctions(tokens, range_count, jobs);
+
+	if (job_count <= 1) {
+		bumpClearToMark(&m->temp, mark);
+		return parse(tokens, diagnostics, m);
+	}
+
+	// Each job gets its own memory since bumps can’t be shared
+	// between threads. This is generously sized, but since it’s
+	// only touched as the parser needs it, most is never committed.
+	for (usize i = 0; i < job_count; i++) {
+		usize size = (jobs[i].end - jobs[i].start) * 256 + 1024 * 1024;
+		jobs[i].m = (memory){
+			.temp = allocateFromOs(size),
+			.general = allocateFromOs(size),
+		};
+	}
+
+	pthread_t *threads =
+		bumpAllocateArray(pthread_t, &m->temp, job_count);
+
+	// The current thread takes care of the first range itself.
+	for (usize i = 1; i < job_count; i++)
+		pthread_create(&threads[i], NULL, parseJobRun, &jobs[i]);
+	parseJobRun(&jobs[0]);
+	for (usize i = 1; i < job_count; i++)
+		pthread_join(threads[i], NULL);
+
+	astRoot ast = stitchAsts(jobs, job_count, diagnostics, m);
+
+	for (usize i = 0; i < job_count; i++) {
+		freeToOs(jobs[i].m.temp);
+		freeToOs(jobs[i].m.general);
+	}
 
 	bumpClearToMark(&m->temp, mark);
+	return ast;
+}
+
+astRoot parseParallel(tokenBuffer tokens, u32 worker_count,
+		      diagnosticsStorage *diagnostics, memory *m)
+{
+	usize range_count = tokens.count / MIN_PARALLEL_PARSE_RANGE_TOKENS;
+	if (range_count > worker_count)
+		range_count = worker_count;
+
+	if (range_count <= 1)
+		return parse(tokens, diagnostics, m);
+
+	return parseRanges(tokens, range_count, diagnostics, m);
+}
+
+// Capacity for at least needed nodes,
+// which is more than doubling gives when a lot are added at once.
+static u32 reservedCapacity(u32 capacity, u32 needed)
+{
+	u32 grown = grownCapacity(capacity);
+	return needed > grown ? needed : grown;
+}
+
+static void reserveNodes(parser *p, u32 function_count, u32 statement_count,
+			 u32 expression_count)
+{
+	u32 functions = p->ast.function_count + function_count;
+	if (functions > p->function_capacity)
+		growFunctions(p, reservedCapacity(p->function_capacity,
+						  functions));
+
+	u32 statements = p->ast.statement_count + statement_count;
+	if (statements > p->statement_capacity)
+		growStatements(p, reservedCapacity(p->statement_capacity,
+						   statements));
+
+	u32 expressions = p->ast.expression_count + expression_count;
+	if (expressions > p->expression_capacity)
+		growExpressions(p, reservedCapacity(p->expression_capacity,
+						    expressions));
+}
+
+static u64 fingerprintMix(u64 fingerprint, u64 value)
+{
+	fingerprint = (fingerprint ^ value) * 0x9e3779b97f4a7c15;
+	return fingerprint ^ (fingerprint >> 32);
+}
+
+// How far rangeFingerprint() has got through the tables of literal values
+// and long spans, which are sorted by token index.
+// Ranges are fingerprinted in order,
+// so each table is only searched once, for the first range.
+typedef struct fingerprintCursor {
+	usize literal;
+	usize long_span;
+} fingerprintCursor;
+
+// Finds the first long span belonging to the token or one after it.
+static usize firstLongSpan(tokenBuffer tokens, usize token)
+{
+	usize low = 0;
+	usize high = tokens.long_span_count;
+	while (low < high) {
+		usize middle = low + (high - low) / 2;
+		if (tokens.long_spans[middle].token < token)
+			low = middle + 1;
+		else
+			high = middle;
+	}
+	return low;
+}
+
+// Covers everything the parser reads while parsing tokens [start, end),
+// so that two ranges with the same fingerprint parse to the same nodes
+// once their spans are moved to where each range starts.
+static u64 rangeFingerprint(tokenBuffer tokens, usize start, usize end,
+			    fingerprintCursor *cursor)
+{
+	u32 base = tokens.span_starts[start];
+	u64 fingerprint = fingerprintMix(0, end - start);
+
+	for (usize i = start; i < end; i++) {
+		u64 token = (u64)tokens.kinds[i] << 56;
+		token |= (u64)tokens.span_lengths[i] << 32;
+		token |= tokens.span_starts[i] - base;
+		fingerprint = fingerprintMix(fingerprint, token);
+
+		if (tokens.kinds[i] == TOK_IDENTIFIER)
+			fingerprint = fingerprintMix(
+				fingerprint, tokens.identifier_ids[i].raw);
+	}
+
+	for (; cursor->literal < tokens.literal_count &&
+	       tokens.literal_tokens[cursor->literal] < end;
+	     cursor->literal++)
+		fingerprint = fingerprintMix(
+			fingerprint, tokens.literal_values[cursor->literal]);
+
+	for (; cursor->long_span < tokens.long_span_count &&
+	       tokens.long_spans[cursor->long_span].token < end;
+	     cursor->long_span++) {
+		tokenLongSpan long_span = tokens.long_spans[cursor->long_span];
+		fingerprint = fingerprintMix(fingerprint, long_span.length);
+	}
+
+	// Whatever comes after the range decides where statements
+	// left unfinished at its end are taken to start.
+	u64 next = end == tokens.count ? (u64)-1
+				       : tokens.span_starts[end] - base;
+	return fingerprintMix(fingerprint, next);
+}
+
+// From the start of the range’s first token
+// to the start of the next range, or the end of its last token.
+static u32 rangeLength(tokenBuffer tokens, usize start, usize end)
+{
+	u32 range_end = end == tokens.count
+				? tokenBufferSpan(tokens, end - 1).end
+				: tokens.span_starts[end];
+	return range_end - tokens.span_starts[start];
+}
+
+// Every range but the first starts at a “func” token,
+// so a new range begins at the start of tokens [start, end)
+// and at each “func” after it.
+static u32 *findRangeStarts(tokenBuffer tokens, usize start, usize end,
+			    u32 *count, bump *b)
+{
+	arrayBuilder builder = bumpStartArrayBuilder(b, sizeof(u32));
+	*count = 0;
+	for (u32 i = start; i < end; i++) {
+		if (i == start || tokens.kinds[i] == TOK_FUNC) {
+			arrayBuilderPush(&builder, &i);
+			(*count)++;
+		}
+	}
+
+	return bumpFinishArrayBuilder(b, &builder);
+}
+
+typedef struct rangeLookup {
+	u32 *slots;
+	u32 mask;
+} rangeLookup;
+
+// Maps fingerprints to the previous parse’s reusable ranges
+// from first up to end.
+static rangeLookup rangeLookupCreate(astRangeTable ranges, u32 first,
+				     u32 end, bump *b)
+{
+	u32 slot_count = 16;
+	while (slot_count < (end - first) * 2)
+		slot_count *= 2;
+
+	rangeLookup lookup = {
+		.slots = bumpAllocateArray(u32, b, slot_count),
+		.mask = slot_count - 1,
+	};
+	memset(lookup.slots, -1, slot_count * sizeof(u32));
+
+	for (u32 i = first; i < end; i++) {
+		if (!ranges.reusable[i])
+			continue;
+
+		u32 slot = ranges.fingerprints[i] & lookup.mask;
+		while (lookup.slots[slot] != (u32)-1)
+			slot = (slot + 1) & lookup.mask;
+		lookup.slots[slot] = i;
+	}
+
+	return lookup;
+}
+
+// Two different ranges could still end up with the same fingerprint,
+// so their token counts and lengths have to match as well.
+static u32 rangeLookupFind(rangeLookup lookup, astRangeTable ranges,
+			   u64 fingerprint, u32 token_count, u32 length)
+{
+	u32 slot = fingerprint & lookup.mask;
+	for (;;) {
+		u32 i = lookup.slots[slot];
+		if (i == (u32)-1)
+			return i;
+		if (ranges.fingerprints[i] == fingerprint &&
+		    ranges.token_starts[i + 1] - ranges.token_starts[i] ==
+			    token_count &&
+		    ranges.lengths[i] == length)
+			return i;
+		slot = (slot + 1) & lookup.mask;
+	}
+}
+
+// The previous parse’s nodes from the first range that isn’t kept onwards.
+// The new parse writes its nodes over these,
+// so any it might reuse are copied aside first.
+typedef struct previousNodes {
+	astRoot ast;
+	u32 function_base;
+	u32 statement_base;
+	u32 expression_base;
+} previousNodes;
+
+static previousNodes previousNodesCopy(astRoot previous,
+				       astRangeTable previous_ranges,
+				       u32 first, bump *b)
+{
+	previousNodes nodes = {
+		.function_base = previous_ranges.function_starts[first],
+		.statement_base = previous_ranges.statement_starts[first],
+		.expression_base = previous_ranges.expression_starts[first],
+	};
+	astRoot *copy = &nodes.ast;
+	copy->function_count = previous.function_count - nodes.function_base;
+	copy->statement_count =
+		previous.statement_count - nodes.statement_base;
+	copy->expression_count =
+		previous.expression_count - nodes.expression_base;
+
+	copy->functions =
+		bumpCopyArray(astFunction, b,
+			      previous.functions + nodes.function_base,
+			      copy->function_count);
+	copy->statements =
+		bumpCopyArray(astStatementData, b,
+			      previous.statements + nodes.statement_base,
+			      copy->statement_count);
+	copy->statement_kinds =
+		bumpCopyArray(astStatementKind, b,
+			      previous.statement_kinds + nodes.statement_base,
+			      copy->statement_count);
+	copy->statement_spans =
+		bumpCopyArray(span, b,
+			      previous.statement_spans + nodes.statement_base,
+			      copy->statement_count);
+	copy->expressions =
+		bumpCopyArray(astExpressionData, b,
+			      previous.expressions + nodes.expression_base,
+			      copy->expression_count);
+	copy->expression_kinds = bumpCopyArray(
+		astExpressionKind, b,
+		previous.expression_kinds + nodes.expression_base,
+		copy->expression_count);
+	copy->expression_spans =
+		bumpCopyArray(span, b,
+			      previous.expression_spans + nodes.expression_base,
+			      copy->expression_count);
+	return nodes;
+}
+
+// Copies the nodes of one of the previous parse’s ranges,
+// shifting handles and spans to where they are in the new parse.
+// Offsets wrap around when things move backwards,
+// which still gives the right result with 32-bit handles.
+static void reuseRange(parser *p, previousNodes previous,
+		       astRangeTable previous_ranges, u32 index,
+		       u32 span_start)
+{
+	u32 function_start = previous_ranges.function_starts[index];
+	u32 statement_start = previous_ranges.statement_starts[index];
+	u32 expression_start = previous_ranges.expression_starts[index];
+	u32 function_count =
+		previous_ranges.function_starts[index + 1] - function_start;
+	u32 statement_count =
+		previous_ranges.statement_starts[index + 1] - statement_start;
+	u32 expression_count = previous_ranges.expression_starts[index + 1] -
+			       expression_start;
+
+	reserveNodes(p, function_count, statement_count, expression_count);
+
+	u32 statement_offset = p->ast.statement_count - statement_start;
+	u32 expression_offset = p->ast.expression_count - expression_start;
+	u32 span_offset = span_start - previous_ranges.span_starts[index];
+
+	astFunction *functions =
+		previous.ast.functions + (function_start - previous.function_base);
+	for (u32 i = 0; i < function_count; i++) {
+		astFunction function = functions[i];
+		function.body =
+			rebaseStatement(function.body, statement_offset);
+		p->ast.functions[p->ast.function_count++] = function;
+	}
+
+	for (u32 i = 0; i < statement_count; i++) {
+		u32 j = statement_start - previous.statement_base + i;
+		u32 k = p->ast.statement_count++;
+		astStatementKind kind = previous.ast.statement_kinds[j];
+		span s = previous.ast.statement_spans[j];
+		p->ast.statements[k] = rebaseStatementData(
+			previous.ast.statements[j], kind, statement_offset,
+			expression_offset);
+		p->ast.statement_kinds[k] = kind;
+		p->ast.statement_spans[k] = (span){
+			.start = s.start + span_offset,
+			.end = s.end + span_offset,
+		};
+	}
+
+	for (u32 i = 0; i < expression_count; i++) {
+		u32 j = expression_start - previous.expression_base + i;
+		u32 k = p->ast.expression_count++;
+		astExpressionKind kind = previous.ast.expression_kinds[j];
+		span s = previous.ast.expression_spans[j];
+		p->ast.expressions[k] = rebaseExpressionData(
+			previous.ast.expressions[j], kind, expression_offset);
+		p->ast.expression_kinds[k] = kind;
+		p->ast.expression_spans[k] = (span){
+			.start = s.start + span_offset,
+			.end = s.end + span_offset,
+		};
+	}
+}
 
+// Diagnostics aren’t kept with the nodes,
+// so only ranges which parsed cleanly can be reused.
+static bool parseRangeAgain(parser *p, usize start, usize end, memory *m)
+{
+	u16 diagnostic_count = p->diagnostics->count;
+	seek(p, start);
+	parseItems(p, end, m);
+	return p->diagnostics->count == diagnostic_count;
+}
+
+// Tokens on lines before the one the edit starts on are lexed as before.
+// Of the ranges which end there, along with the “func” token after them,
+// the leading run which parsed cleanly keep their nodes where they are.
+static u32 keptRangeCount(tokenBuffer tokens, astRangeTable previous_ranges,
+			  u32 edit_start)
+{
+	u32 line = lineTableLine(tokens.lines, edit_start);
+	u32 line_start = lineTableLineStart(tokens.lines, line);
+
+	u32 kept = 0;
+	while (kept + 1 < previous_ranges.count &&
+	       previous_ranges.reusable[kept] &&
+	       previous_ranges.span_starts[kept + 1] < line_start)
+		kept++;
+	return kept;
+}
+
+// Tokens on lines after the one the edit ends on are lexed as before,
+// only moved along, so the ranges starting there
+// are matched up with the previous ones by position.
+// Returns the first of the previous ranges that are.
+static u32 firstShiftedRange(tokenBuffer tokens,
+			     astRangeTable previous_ranges, span edited,
+			     u32 inserted_length)
+{
+	u32 line = lineTableLine(tokens.lines, edited.start + inserted_length);
+	if (line == tokens.lines.count)
+		return previous_ranges.count;
+
+	// where the next line starts in the previous content
+	u32 next_line_start = lineTableLineStart(tokens.lines, line + 1) -
+			      inserted_length + (edited.end - edited.start);
+
+	u32 low = 0;
+	u32 high = previous_ranges.count;
+	while (low < high) {
+		u32 middle = low + (high - low) / 2;
+		if (previous_ranges.span_starts[middle] < next_line_start)
+			low = middle + 1;
+		else
+			high = middle;
+	}
+	return low;
+}
+
+static astRangeTable rangeTableCreate(u32 count, bump *b)
+{
+	return (astRangeTable){
+		.fingerprints = bumpAllocateArray(u64, b, count),
+		.token_starts = bumpAllocateArray(u32, b, count + 1),
+		.span_starts = bumpAllocateArray(u32, b, count),
+		.lengths = bumpAllocateArray(u32, b, count),
+		.function_starts = bumpAllocateArray(u32, b, count + 1),
+		.statement_starts = bumpAllocateArray(u32, b, count + 1),
+		.expression_starts = bumpAllocateArray(u32, b, count + 1),
+		.reusable = bumpAllocateArray(bool, b, count),
+		.count = count,
+	};
+}
+
+static void rangeTableStart(astRangeTable *ranges, u32 i, parser *p,
+			    usize token)
+{
+	ranges->token_starts[i] = token;
+	ranges->span_starts[i] = p->tokens.span_starts[token];
+	ranges->function_starts[i] = p->ast.function_count;
+	ranges->statement_starts[i] = p->ast.statement_count;
+	ranges->expression_starts[i] = p->ast.expression_count;
+}
+
+// The ranges kept in place have the same entries as before.
+static void rangeTableKeep(astRangeTable *ranges, astRangeTable previous,
+			   u32 kept)
+{
+	memcpy(ranges->fingerprints, previous.fingerprints, kept * sizeof(u64));
+	memcpy(ranges->token_starts, previous.token_starts, kept * sizeof(u32));
+	memcpy(ranges->span_starts, previous.span_starts, kept * sizeof(u32));
+	memcpy(ranges->lengths, previous.lengths, kept * sizeof(u32));
+	memcpy(ranges->function_starts, previous.function_starts,
+	       kept * sizeof(u32));
+	memcpy(ranges->statement_starts, previous.statement_starts,
+	       kept * sizeof(u32));
+	memcpy(ranges->expression_starts, previous.expression_starts,
+	       kept * sizeof(u32));
+	memcpy(ranges->reusable, previous.reusable, kept * sizeof(bool));
+}
+
+// Ranges before the edit keep their nodes in place
+// and the new parse carries on from them in the same arrays,
+// so nothing before the edit is copied or fingerprinted again.
+// Ranges after it are copied with their spans and handles shifted,
+// and only those in between are fingerprinted,
+// in case they match any of the previous ones.
+astRoot parseIncremental(tokenBuffer tokens, astRoot previous,
+			 astRangeTable previous_ranges, span edited,
+			 u32 inserted_length, astRangeTable *ranges,
+			 diagnosticsStorage *diagnostics, memory *m)
+{
+	bumpMark mark = bumpCreateMark(&m->temp);
+	u32 previous_count = previous_ranges.count;
+
+	parser p = { 0 };
+	previousNodes nodes = { 0 };
+	u32 kept = 0;
+	u32 shifted = previous_count;
+	usize middle_start = 0;
+	usize middle_end = tokens.count;
+
+	// Offsets wrap around when things move backwards.
+	u32 span_shift = inserted_length - (edited.end - edited.start);
+	u32 token_shift = 0;
+
+	if (previous_count == 0) {
+		p = parserCreate(tokens, tokens.count, diagnostics, m);
+	} else {
+		kept = keptRangeCount(tokens, previous_ranges, edited.start);
+		shifted = firstShiftedRange(tokens, previous_ranges, edited,
+					    inserted_length);
+		token_shift = tokens.count -
+			      previous_ranges.token_starts[previous_count];
+
+		// Only a range starting at a “func” can follow edited ones,
+		// which the first range might not.
+		if (shifted == 0 && token_shift != 0 &&
+		    tokens.kinds[token_shift] != TOK_FUNC)
+			shifted = 1;
+
+		middle_start = previous_ranges.token_starts[kept];
+		if (shifted < previous_count)
+			middle_end = previous_ranges.token_starts[shifted] +
+				     token_shift;
+
+		nodes = previousNodesCopy(previous, previous_ranges, kept,
+					  &m->temp);
+		p = (parser){
+			.tokens = tokens,
+			.diagnostics = diagnostics,
+			.general = &m->general,
+			.ast = previous,
+			.function_capacity = previous_ranges.function_capacity,
+			.statement_capacity =
+				previous_ranges.statement_capacity,
+			.expression_capacity =
+				previous_ranges.expression_capacity,
+		};
+		p.ast.function_count = nodes.function_base;
+		p.ast.statement_count = nodes.statement_base;
+		p.ast.expression_count = nodes.expression_base;
+	}
+
+	u32 middle_count = 0;
+	u32 *middle_starts = findRangeStarts(tokens, middle_start, middle_end,
+					     &middle_count, &m->temp);
+	u32 count = kept + middle_count + (previous_count - shifted);
+	*ranges = rangeTableCreate(count, &m->general);
+
+	if (kept > 0)
+		rangeTableKeep(ranges, previous_ranges, kept);
+
+	rangeLookup lookup =
+		rangeLookupCreate(previous_ranges, kept, shifted, &m->temp);
+	fingerprintCursor cursor = {
+		.literal = tokenBufferFirstLiteral(tokens, middle_start),
+		.long_span = firstLongSpan(tokens, middle_start),
+	};
+	u32 i = kept;
+
+	for (u32 j = 0; j < middle_count; j++, i++) {
+		usize start = middle_starts[j];
+		usize end = j + 1 < middle_count ? middle_starts[j + 1]
+						 : middle_end;
+		rangeTableStart(ranges, i, &p, start);
+
+		u64 fingerprint =
+			rangeFingerprint(tokens, start, end, &cursor);
+		u32 length = rangeLength(tokens, start, end);
+		ranges->fingerprints[i] = fingerprint;
+		ranges->lengths[i] = length;
+
+		u32 previous_index = rangeLookupFind(
+			lookup, previous_ranges, fingerprint, end - start,
+			length);
+		if (previous_index != (u32)-1) {
+			reuseRange(&p, nodes, previous_ranges, previous_index,
+				   tokens.span_starts[start]);
+			ranges->reusable[i] = true;
+			continue;
+		}
+
+		ranges->reusable[i] = parseRangeAgain(&p, start, end, m);
+	}
+
+	for (u32 j = shifted; j < previous_count; j++, i++) {
+		usize start = previous_ranges.token_starts[j] + token_shift;
+		usize end = previous_ranges.token_starts[j + 1] + token_shift;
+		u32 span_start = previous_ranges.span_starts[j] + span_shift;
+		assert(tokens.span_starts[start] == span_start);
+		rangeTableStart(ranges, i, &p, start);
+
+		// The tokens are the same, so their fingerprint is too.
+		ranges->fingerprints[i] = previous_ranges.fingerprints[j];
+		ranges->lengths[i] = previous_ranges.lengths[j];
+
+		if (previous_ranges.reusable[j]) {
+			reuseRange(&p, nodes, previous_ranges, j, span_start);
+			ranges->reusable[i] = true;
+			continue;
+		}
+
+		ranges->reusable[i] = parseRangeAgain(&p, start, end, m);
+	}
+
+	ranges->token_starts[count] = tokens.count;
+	ranges->function_starts[count] = p.ast.function_count;
+	ranges->statement_starts[count] = p.ast.statement_count;
+	ranges->expression_starts[count] = p.ast.expression_count;
+	ranges->function_capacity = p.function_capacity;
+	ranges->statement_capacity = p.statement_capacity;
+	ranges->expression_capacity = p.expression_capacity;
+
+	bumpClearToMark(&m->temp, mark);
 	return p.ast;
 }
 
@@ -715,12 +2258,12 @@ span astGetExpressionSpan(astRoot ast, astExpression expression)
 	return ast.expression_spans[expression.index];
 }
 
-astExpression astExpressionMake(u16 index)
+astExpression astExpressionMake(u32 index)
 {
 	return (astExpression){ .index = index };
 }
 
-astStatement astStatementMake(u16 index)
+astStatement astStatementMake(u32 index)
 {
 	return (astStatement){ .index = index };
 }
@@ -749,7 +2292,8 @@ static void debugExpression(ctx *c, astExpression expression)
 	case AST_EXPR_INT_LITERAL: {
 		astIntLiteral int_literal =
 			astGetExpression(c->ast, expression).int_literal;
-		stringBuilderPrintf(c->sb, "%llu", int_literal.value);
+		stringBuilderPrintf(c->sb, "%llu",
+				    (unsigned long long)int_literal.value);
 		break;
 	}
 
@@ -855,7 +2399,7 @@ static void debugExpression(ctx *c, astExpression expression)
 
 		stringBuilderPrintf(c->sb, "[");
 		c->indentation++;
-		for (u16 i = 0; i < array_literal.count; i++) {
+		for (u32 i = 0; i < array_literal.count; i++) {
 			astExpression e = astExpressionMake(
 				array_literal.start.index + i);
 			newline(c);
@@ -917,7 +2461,7 @@ static void debugStatement(ctx *c, astStatement statement)
 		stringBuilderPrintf(c->sb, " ");
 		debugStatement(c, if_.true_block);
 
-		if (if_.false_block.index == (u16)-1)
+		if (if_.false_block.index == (u32)-1)
 			break;
 
 		stringBuilderPrintf(c->sb, " else ");
@@ -942,7 +2486,7 @@ static void debugStatement(ctx *c, astStatement statement)
 		}
 		stringBuilderPrintf(c->sb, "{");
 		c->indentation++;
-		for (u16 i = 0; i < block.count; i++) {
+		for (u32 i = 0; i < block.count; i++) {
 			astStatement s =
 				astStatementMake(block.start.index + i);
 			newline(c);
@@ -986,7 +2530,7 @@ void astDebug(astRoot ast, interner interner, stringBuilder *sb)
 	};
 
 	bool first = true;
-	for (u16 i = 0; i < ast.function_count; i++) {
+	for (u32 i = 0; i < ast.function_count; i++) {
 		if (first)
 			first = false;
 		else
@@ -1006,12 +2550,189 @@ void astDebugPrint(astRoot ast, interner interner, bump *b)
 	bumpClearToMark(b, mark);
 }
 
-char *parseTests(char *input, memory *m)
+static bool astsEqual(astRoot a, astRoot b, interner interner, bump *temp)
+{
+	if (a.function_count != b.function_count ||
+	    a.statement_count != b.statement_count ||
+	    a.expression_count != b.expression_count)
+		return false;
+
+	if (memcmp(a.statement_spans, b.statement_spans,
+		   a.statement_count * sizeof(span)) != 0 ||
+	    memcmp(a.expression_spans, b.expression_spans,
+		   a.expression_count * sizeof(span)) != 0)
+		return false;
+
+	bumpMark mark = bumpCreateMark(temp);
+	stringBuilder a_sb = stringBuilderCreate(temp);
+	astDebug(a, interner, &a_sb);
+	char *a_debug = stringBuilderFinish(a_sb);
+	stringBuilder b_sb = stringBuilderCreate(temp);
+	astDebug(b, interner, &b_sb);
+	char *b_debug = stringBuilderFinish(b_sb);
+	bool equal = strcmp(a_debug, b_debug) == 0;
+	bumpClearToMark(temp, mark);
+	return equal;
+}
+
+// Parses an edited copy of the input incrementally
+// from the original’s AST and from scratch, and compares the two.
+static void checkEdit(char *input, usize length, span edited,
+		      const char *insertion, memory *m)
+{
+	bumpMark general_mark = bumpCreateMark(&m->general);
+	bumpMark temp_mark = bumpCreateMark(&m->temp);
+
+	char *new_content = bumpPrintf(&m->temp, "%.*s%s%.*s",
+				       (int)edited.start, input, insertion,
+				       (int)(length - edited.end),
+				       input + edited.end);
+	usize new_length = length - (edited.end - edited.start) +
+			   strlen(insertion);
+
+	// Both versions are interned together
+	// so that their identifiers get the same IDs.
+	diagnosticsStorage diagnostics = diagnosticsStorageCreate(&m->temp);
+	tokenBuffer bufs[2] = {
+		lex(input, length, &diagnostics, m),
+		lex(new_content, new_length, &diagnostics, m),
+	};
+	char *contents[2] = { input, new_content };
+	internFile(&bufs[0], input, m);
+	internFile(&bufs[1], new_content, m);
+	interner interner = intern(bufs, contents, 2, m);
+
+	astRoot none = { 0 };
+	astRangeTable no_ranges = { 0 };
+	astRangeTable old_ranges = { 0 };
+	astRoot old = parseIncremental(bufs[0], none, no_ranges, edited, 0,
+				       &old_ranges, &diagnostics, m);
+
+	diagnosticsStorage incremental_diagnostics =
+		diagnosticsStorageCreate(&m->temp);
+	astRangeTable new_ranges = { 0 };
+	astRoot incremental = parseIncremental(
+		bufs[1], old, old_ranges, edited, strlen(insertion),
+		&new_ranges, &incremental_diagnostics, m);
+
+	diagnosticsStorage expected_diagnostics =
+		diagnosticsStorageCreate(&m->temp);
+	astRoot expected = parse(bufs[1], &expected_diagnostics, m);
+
+	assert(astsEqual(incremental, expected, interner, &m->temp));
+	assert(diagnosticsStorageEqual(incremental_diagnostics,
+				       expected_diagnostics));
+
+	bumpClearToMark(&m->temp, temp_mark);
+	bumpClearToMark(&m->general, general_mark);
+}
+
+// Finds the span between the braces of the middle function’s body,
+// which is empty if the closing brace is missing.
+static bool middleFunctionBody(tokenBuffer buf, span *body)
+{
+	usize function_count = 0;
+	for (usize i = 0; i < buf.count; i++)
+		if (buf.kinds[i] == TOK_FUNC)
+			function_count++;
+	if (function_count == 0)
+		return false;
+
+	usize middle = function_count / 2;
+	usize start = 0;
+	for (usize function = 0; start < buf.count; start++)
+		if (buf.kinds[start] == TOK_FUNC && function++ == middle)
+			break;
+
+	usize end = start + 1;
+	while (end < buf.count && buf.kinds[end] != TOK_FUNC)
+		end++;
+
+	usize lbrace = start;
+	while (lbrace < end && buf.kinds[lbrace] != TOK_LBRACE)
+		lbrace++;
+	if (lbrace == end)
+		return false;
+
+	usize rbrace = end - 1;
+	while (rbrace > lbrace && buf.kinds[rbrace] != TOK_RBRACE)
+		rbrace--;
+
+	body->start = tokenBufferSpan(buf, lbrace).end;
+	body->end = rbrace == lbrace ? body->start
+				     : tokenBufferSpan(buf, rbrace).start;
+	return true;
+}
+
+// Every other way of parsing the file must give the same AST
+// and diagnostics as parsing it serially.
+static void checkParse(tokenBuffer buf, char *input, usize length,
+		       interner interner, memory *m)
+{
+	bumpMark general_mark = bumpCreateMark(&m->general);
+	bumpMark temp_mark = bumpCreateMark(&m->temp);
+
+	diagnosticsStorage serial_diagnostics =
+		diagnosticsStorageCreate(&m->temp);
+	astRoot serial = parse(buf, &serial_diagnostics, m);
+
+	// Real inputs are only split into ranges for separate threads
+	// once they’re far larger than any test, so we ask for them directly.
+	diagnosticsStorage parallel_diagnostics =
+		diagnosticsStorageCreate(&m->temp);
+	astRoot parallel = parseRanges(buf, 8, &parallel_diagnostics, m);
+	assert(astsEqual(parallel, serial, interner, &m->temp));
+	assert(diagnosticsStorageEqual(parallel_diagnostics,
+				       serial_diagnostics));
+
+	// Parsing incrementally with nothing to reuse,
+	// and then again after empty edits at the end and at the start,
+	// so that nearly every range is kept in place and then shifted.
+	diagnosticsStorage scratch_diagnostics =
+		diagnosticsStorageCreate(&m->temp);
+	span end = { .start = length, .end = length };
+	span start = { 0 };
+	astRangeTable none = { 0 };
+	astRangeTable cold_ranges = { 0 };
+	astRoot cold = parseIncremental(buf, serial, none, end, 0,
+					&cold_ranges, &scratch_diagnostics, m);
+	assert(astsEqual(cold, serial, interner, &m->temp));
+	astRangeTable kept_ranges = { 0 };
+	astRoot kept = parseIncremental(buf, cold, cold_ranges, end, 0,
+					&kept_ranges, &scratch_diagnostics, m);
+	assert(astsEqual(kept, serial, interner, &m->temp));
+	astRangeTable shifted_ranges = { 0 };
+	astRoot shifted =
+		parseIncremental(buf, kept, kept_ranges, start, 0,
+				 &shifted_ranges, &scratch_diagnostics, m);
+	assert(astsEqual(shifted, serial, interner, &m->temp));
+
+	// Growing and then emptying the body of the middle function
+	// moves the functions after it forwards and then backwards
+	// while the ones before it stay put.
+	span body = { 0 };
+	if (middleFunctionBody(buf, &body)) {
+		checkEdit(input, length,
+			  (span){ .start = body.start, .end = body.start },
+			  "\n\tedited := 1", m);
+		if (body.end > body.start)
+			checkEdit(input, length, body, "", m);
+	}
+
+	astSpanIndexCheck(serial, length, m);
+
+	bumpClearToMark(&m->temp, temp_mark);
+	bumpClearToMark(&m->general, general_mark);
+}
+
+char *parseTests(char *input, usize length, memory *m)
 {
 	diagnosticsStorage diagnostics = diagnosticsStorageCreate(&m->general);
-	tokenBuffer buf = lex(input, &diagnostics, m);
+	tokenBuffer buf = lex(input, length, &diagnostics, m);
+	internFile(&buf, input, m);
 	interner interner = intern(&buf, &input, 1, m);
-	astRoot ast = parse(buf, input, &diagnostics, m);
+	astRoot ast = parse(buf, &diagnostics, m);
+	checkParse(buf, input, length, interner, m);
 	stringBuilder sb = stringBuilderCreate(&m->temp);
 	astDebug(ast, interner, &sb);
 	diagnosticsStorageDebug(diagnostics, &sb);
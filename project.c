@@ -6,14 +6,15 @@ projectSpec projectDiscover(memory *m)
 {
 	u16 num_files = 0;
 
-	// We have two “auxiliary arrays” which store information about each
-	// file -- a pointer to the name of the file, and a pointer to the
-	// contents of the file. We allocate these aux arrays in temporary
-	// memory for now since allocations are occurring in general memory
-	// while the aux arrays are being populated.
+	// We have three “auxiliary arrays” which store information about each
+	// file -- a pointer to the name of the file, a pointer to the
+	// contents of the file, and the length of those contents. We allocate
+	// these aux arrays in temporary memory for now since allocations are
+	// occurring in general memory while the aux arrays are being populated.
 	bumpMark mark = bumpCreateMark(&m->temp);
 	char **file_names = bumpAllocateArray(char *, &m->temp, MAX_FILES);
 	char **file_contents = bumpAllocateArray(char *, &m->temp, MAX_FILES);
+	usize *file_lengths = bumpAllocateArray(usize, &m->temp, MAX_FILES);
 
 	DIR *d = opendir(".");
 
@@ -44,18 +45,22 @@ projectSpec projectDiscover(memory *m)
 					   entry->d_namlen +
 						   1); // for null terminator
 
-		// Read file content into general memory.
-		char *content =
-			bumpAllocateArray(char, &m->general,
-					  size + 1); // for null terminator
-		usize bytes_read = read(fd, content, size);
-		assert(bytes_read == size);
-		content[size] = 0;
+		// Map file content straight from the page cache
+		// rather than copying it into general memory.
+		// mmap refuses zero-length mappings,
+		// so empty files get an empty string instead.
+		char *content = "";
+		if (size != 0) {
+			content = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd,
+				       0);
+			assert(content != MAP_FAILED);
+		}
 		close(fd);
 
 		// Store pointers into general memory in aux arrays.
 		file_names[num_files] = name;
 		file_contents[num_files] = content;
+		file_lengths[num_files] = size;
 		num_files++;
 	}
 
@@ -64,12 +69,21 @@ projectSpec projectDiscover(memory *m)
 	file_names = bumpCopyArray(char *, &m->general, file_names, num_files);
 	file_contents =
 		bumpCopyArray(char *, &m->general, file_contents, num_files);
+	file_lengths =
+		bumpCopyArray(usize, &m->general, file_lengths, num_files);
 	bumpClearToMark(&m->temp, mark);
 
+	// Line tables are only known once the files have been lexed.
+	lineTable *file_lines =
+		bumpAllocateArray(lineTable, &m->general, num_files);
+	memset(file_lines, 0, num_files * sizeof(lineTable));
+
 	return (projectSpec){
 		.num_files = num_files,
 		.file_names = file_names,
 		.file_contents = file_contents,
+		.file_lengths = file_lengths,
+		.file_lines = file_lines,
 	};
 }
 
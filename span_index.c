@@ -0,0 +1,323 @@
+#include "minic.h"
+
+// Spans in the AST and HIR nest properly:
+// every node’s span lies within its parent’s.
+// Sorting the spans by start, outermost first among equal starts,
+// puts each node after everything which encloses it,
+// so the last span starting at or before an offset
+// is the innermost node containing that offset
+// or a descendant of one of its enclosing nodes.
+// From there we climb towards the root
+// until we reach a span which hasn’t ended yet.
+//
+// Climbing one parent at a time would take as long as the tree is deep,
+// so each entry also has a jump pointer to one of its ancestors,
+// chosen so that any ancestor can be reached in O(log n) steps
+// (as in Myers’ “An applicative random-access stack”).
+// Ends only grow as we climb, since each span lies within the next,
+// which is what lets us jump past every ancestor that has already ended.
+
+typedef struct sortEntry {
+	// start in the upper half, inverted end in the lower half,
+	// so that of two spans starting at once the longer sorts first
+	u64 key;
+	u32 node;
+} sortEntry;
+
+static u64 sortKey(span s)
+{
+	return (u64)s.start << 32 | (u32)~s.end;
+}
+
+// A bottom-up merge sort, which is stable,
+// so nodes with identical spans stay in the order they were allocated.
+static sortEntry *sortEntries(sortEntry *entries, usize count, bump *b)
+{
+	sortEntry *scratch = bumpAllocateArray(sortEntry, b, count);
+
+	for (usize width = 1; width < count; width *= 2) {
+		for (usize low = 0; low < count; low += 2 * width) {
+			usize middle = low + width;
+			usize high = middle + width;
+			if (middle > count)
+				middle = count;
+			if (high > count)
+				high = count;
+
+			usize i = low;
+			usize j = middle;
+			usize k = low;
+			while (i < middle && j < high) {
+				if (entries[j].key < entries[i].key)
+					scratch[k++] = entries[j++];
+				else
+					scratch[k++] = entries[i++];
+			}
+			while (i < middle)
+				scratch[k++] = entries[i++];
+			while (j < high)
+				scratch[k++] = entries[j++];
+		}
+
+		sortEntry *sorted = scratch;
+		scratch = entries;
+		entries = sorted;
+	}
+
+	return entries;
+}
+
+spanIndex spanIndexBuild(span *spans, u32 count, memory *m)
+{
+	spanIndex index = {
+		.starts = bumpAllocateArray(u32, &m->general, count),
+		.ends = bumpAllocateArray(u32, &m->general, count),
+		.nodes = bumpAllocateArray(u32, &m->general, count),
+		.parents = bumpAllocateArray(u32, &m->general, count),
+		.jumps = bumpAllocateArray(u32, &m->general, count),
+		.count = count,
+	};
+
+	bumpMark mark = bumpCreateMark(&m->temp);
+
+	sortEntry *entries = bumpAllocateArray(sortEntry, &m->temp, count);
+	for (u32 i = 0; i < count; i++)
+		entries[i] = (sortEntry){ .key = sortKey(spans[i]), .node = i };
+	entries = sortEntries(entries, count, &m->temp);
+
+	// entries whose spans might still enclose the current one,
+	// innermost on top
+	u32 *enclosing = bumpAllocateArray(u32, &m->temp, count);
+	u32 enclosing_count = 0;
+	u32 *depths = bumpAllocateArray(u32, &m->temp, count);
+
+	for (u32 i = 0; i < count; i++) {
+		span s = spans[entries[i].node];
+		index.starts[i] = s.start;
+		index.ends[i] = s.end;
+		index.nodes[i] = entries[i].node;
+
+		while (enclosing_count > 0 &&
+		       index.ends[enclosing[enclosing_count - 1]] <= s.start)
+			enclosing_count--;
+
+		if (enclosing_count == 0) {
+			index.parents[i] = SPAN_INDEX_NONE;
+			index.jumps[i] = i;
+			depths[i] = 0;
+		} else {
+			u32 parent = enclosing[enclosing_count - 1];
+			u32 jump = index.jumps[parent];
+			u32 jump_jump = index.jumps[jump];
+			index.parents[i] = parent;
+			depths[i] = depths[parent] + 1;
+
+			if (depths[parent] - depths[jump] ==
+			    depths[jump] - depths[jump_jump])
+				index.jumps[i] = jump_jump;
+			else
+				index.jumps[i] = parent;
+		}
+
+		enclosing[enclosing_count++] = i;
+	}
+
+	bumpClearToMark(&m->temp, mark);
+	return index;
+}
+
+// Finds the index of the first entry which starts after the given offset.
+static u32 firstStartAfter(spanIndex index, u32 offset)
+{
+	u32 low = 0;
+	u32 high = index.count;
+	while (low < high) {
+		u32 middle = low + (high - low) / 2;
+		if (index.starts[middle] <= offset)
+			low = middle + 1;
+		else
+			high = middle;
+	}
+	return low;
+}
+
+bool spanIndexFind(spanIndex index, u32 offset, u32 *node)
+{
+	u32 i = firstStartAfter(index, offset);
+	if (i == 0)
+		return false;
+	i--;
+
+	while (index.ends[i] <= offset) {
+		if (index.parents[i] == SPAN_INDEX_NONE)
+			return false;
+
+		u32 jump = index.jumps[i];
+		if (index.ends[jump] <= offset)
+			i = jump;
+		else
+			i = index.parents[i];
+	}
+
+	*node = index.nodes[i];
+	return true;
+}
+
+static span *astFunctionSpans(astRoot ast, bump *b)
+{
+	span *spans = bumpAllocateArray(span, b, ast.function_count);
+	for (u32 i = 0; i < ast.function_count; i++)
+		spans[i] = astGetStatementSpan(ast, ast.functions[i].body);
+	return spans;
+}
+
+astSpanIndex astSpanIndexBuild(astRoot ast, memory *m)
+{
+	bumpMark mark = bumpCreateMark(&m->temp);
+	span *function_spans = astFunctionSpans(ast, &m->temp);
+
+	astSpanIndex index = {
+		.functions = spanIndexBuild(function_spans, ast.function_count,
+					    m),
+		.statements = spanIndexBuild(ast.statement_spans,
+					     ast.statement_count, m),
+		.expressions = spanIndexBuild(ast.expression_spans,
+					      ast.expression_count, m),
+	};
+
+	bumpClearToMark(&m->temp, mark);
+	return index;
+}
+
+bool astFunctionAt(astSpanIndex index, u32 offset, u32 *function)
+{
+	return spanIndexFind(index.functions, offset, function);
+}
+
+bool astStatementAt(astSpanIndex index, u32 offset, astStatement *statement)
+{
+	u32 i = 0;
+	if (!spanIndexFind(index.statements, offset, &i))
+		return false;
+	*statement = astStatementMake(i);
+	return true;
+}
+
+bool astExpressionAt(astSpanIndex index, u32 offset, astExpression *expression)
+{
+	u32 i = 0;
+	if (!spanIndexFind(index.expressions, offset, &i))
+		return false;
+	*expression = astExpressionMake(i);
+	return true;
+}
+
+static span *hirFunctionSpans(hirRoot hir, bump *b)
+{
+	span *spans = bumpAllocateArray(span, b, hir.function_count);
+	for (u32 i = 0; i < hir.function_count; i++)
+		spans[i] = hirGetNodeSpan(hir, hir.functions[i].body);
+	return spans;
+}
+
+hirSpanIndex hirSpanIndexBuild(hirRoot hir, memory *m)
+{
+	bumpMark mark = bumpCreateMark(&m->temp);
+	span *function_spans = hirFunctionSpans(hir, &m->temp);
+
+	hirSpanIndex index = {
+		.functions = spanIndexBuild(function_spans, hir.function_count,
+					    m),
+		.nodes = spanIndexBuild(hir.node_spans, hir.node_count, m),
+	};
+
+	bumpClearToMark(&m->temp, mark);
+	return index;
+}
+
+bool hirFunctionAt(hirSpanIndex index, u32 offset, u32 *function)
+{
+	return spanIndexFind(index.functions, offset, function);
+}
+
+bool hirNodeAt(hirSpanIndex index, u32 offset, hirNode *node)
+{
+	u32 i = 0;
+	if (!spanIndexFind(index.nodes, offset, &i))
+		return false;
+	*node = hirNodeMake(i);
+	return true;
+}
+
+// Finds the same node as spanIndexFind by looking at every span,
+// for checking the index against.
+// Of the spans containing the offset, the innermost starts last
+// and, of those starting together, ends first.
+// Nodes with identical spans are found as the last one allocated,
+// since that’s the one the index sorts after the others.
+static bool spanIndexFindLinear(span *spans, u32 count, u32 offset, u32 *node)
+{
+	bool found = false;
+	for (u32 i = 0; i < count; i++) {
+		span s = spans[i];
+		if (offset < s.start || offset >= s.end)
+			continue;
+
+		if (found) {
+			span best = spans[*node];
+			if (s.start < best.start ||
+			    (s.start == best.start && s.end > best.end))
+				continue;
+		}
+
+		*node = i;
+		found = true;
+	}
+	return found;
+}
+
+// Looking nodes up by offset must find the same ones
+// as checking every span, at every offset in the file.
+static void spanIndexCheck(spanIndex index, span *spans, u32 count,
+			   usize length)
+{
+	for (u32 offset = 0; offset <= length; offset++) {
+		u32 expected = 0;
+		bool found = spanIndexFindLinear(spans, count, offset,
+						 &expected);
+		u32 node = 0;
+		assert(spanIndexFind(index, offset, &node) == found);
+		assert(!found || node == expected);
+	}
+}
+
+void astSpanIndexCheck(astRoot ast, usize length, memory *m)
+{
+	bumpMark general_mark = bumpCreateMark(&m->general);
+	bumpMark temp_mark = bumpCreateMark(&m->temp);
+
+	astSpanIndex index = astSpanIndexBuild(ast, m);
+	spanIndexCheck(index.functions, astFunctionSpans(ast, &m->temp),
+		       ast.function_count, length);
+	spanIndexCheck(index.statements, ast.statement_spans,
+		       ast.statement_count, length);
+	spanIndexCheck(index.expressions, ast.expression_spans,
+		       ast.expression_count, length);
+
+	bumpClearToMark(&m->temp, temp_mark);
+	bumpClearToMark(&m->general, general_mark);
+}
+
+void hirSpanIndexCheck(hirRoot hir, usize length, memory *m)
+{
+	bumpMark general_mark = bumpCreateMark(&m->general);
+	bumpMark temp_mark = bumpCreateMark(&m->temp);
+
+	hirSpanIndex index = hirSpanIndexBuild(hir, m);
+	spanIndexCheck(index.functions, hirFunctionSpans(hir, &m->temp),
+		       hir.function_count, length);
+	spanIndexCheck(index.nodes, hir.node_spans, hir.node_count, length);
+
+	bumpClearToMark(&m->temp, temp_mark);
+	bumpClearToMark(&m->general, general_mark);
+}
@@ -1,19 +1,57 @@
 #include "minic.h"
 
-static char *readFile(char *name, bump *b)
+static char *readFile(char *name, usize *size, bump *b)
 {
 	int fd = open(name, O_RDONLY);
 	struct stat s;
 	fstat(fd, &s);
+	*size = s.st_size;
+
+	char *content = bumpAllocateArray(char, b, *size);
+	usize bytes_read = read(fd, content, *size);
+	assert(bytes_read == *size);
+
+	close(fd);
+	return content;
+}
+
+// Source code under test isn’t NUL-terminated,
+// and ends right before an inaccessible page,
+// so that reading even one byte past the end crashes.
+typedef struct guardedFile {
+	char *content;
+	usize size;
+	u8 *mapping;
+	usize mapping_size;
+} guardedFile;
+
+static guardedFile readFileGuarded(char *name)
+{
+	int fd = open(name, O_RDONLY);
+	struct stat s;
+	fstat(fd, &s);
+
+	usize page_size = sysconf(_SC_PAGESIZE);
 	usize size = s.st_size;
+	usize readable_size = (size + page_size - 1) & ~(page_size - 1);
 
-	char *content = bumpAllocateArray(char, b, size + 1);
-	usize bytes_read = read(fd, content, size);
+	guardedFile file = {
+		.size = size,
+		.mapping_size = readable_size + page_size,
+	};
+	file.mapping = mmap(NULL, file.mapping_size, PROT_READ | PROT_WRITE,
+			    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	assert(file.mapping != MAP_FAILED);
+	int result = mprotect(file.mapping + readable_size, page_size,
+			      PROT_NONE);
+	assert(result == 0);
+
+	file.content = (char *)file.mapping + readable_size - size;
+	usize bytes_read = read(fd, file.content, size);
 	assert(bytes_read == size);
-	content[size] = 0;
 
 	close(fd);
-	return content;
+	return file;
 }
 
 static bool exists(char *name)
@@ -26,7 +64,7 @@ void runTests(const char *dir_name, transformer t, bump *b)
 {
 	bumpMark mark = bumpCreateMark(b);
 
-	bump transformer_general = bumpCreateSubBump(b, 256 * 1024);
+	bump transformer_general = bumpCreateSubBump(b, 4 * 1024 * 1024);
 	bump transformer_temp = bumpCreateSubBump(b, 8 * 1024 * 1024);
 	bumpMark transformer_general_top = bumpCreateMark(&transformer_general);
 	bumpMark transformer_temp_top = bumpCreateMark(&transformer_temp);
@@ -58,20 +96,27 @@ void runTests(const char *dir_name, transformer t, bump *b)
 		char *expected_path = bumpPrintf(b, "%s.expected", path);
 		char *actual_path = bumpPrintf(b, "%s.actual", path);
 
-		char *source_code = readFile(path, b);
+		guardedFile source = readFileGuarded(path);
+		char *source_code = source.content;
+		usize source_length = source.size;
 
-		char *dir_name_unconstified = bumpPrintf(b, dir_name);
+		char *dir_name_unconstified = bumpPrintf(b, "%s", dir_name);
+		lineTable lines = { 0 };
 		setCurrentProject((projectSpec){
 			.num_files = 1,
 			.file_names = &dir_name_unconstified,
 			.file_contents = &source_code,
+			.file_lengths = &source_length,
+			.file_lines = &lines,
 		});
 		setCurrentFile(0);
 
 		bumpClearToMark(&transformer_memory.general,
 				transformer_general_top);
 		bumpClearToMark(&transformer_memory.temp, transformer_temp_top);
-		char *actual = t(source_code, &transformer_memory);
+		char *actual =
+			t(source_code, source_length, &transformer_memory);
+		usize actual_length = strlen(actual);
 
 		if (!exists(expected_path)) {
 			printf("\033[35mwarning:\033[0;1;97m “expected” file "
@@ -80,13 +125,15 @@ void runTests(const char *dir_name, transformer t, bump *b)
 			       expected_path);
 			int fd = open(expected_path,
 				      O_WRONLY | O_CREAT | O_TRUNC, 0666);
-			write(fd, actual, strlen(actual));
+			write(fd, actual, actual_length);
 			close(fd);
 		}
 
-		char *expected = readFile(expected_path, b);
+		usize expected_length = 0;
+		char *expected = readFile(expected_path, &expected_length, b);
 
-		if (strcmp(expected, actual) == 0) {
+		if (expected_length == actual_length &&
+		    memcmp(expected, actual, actual_length) == 0) {
 			printf("\033[32mtest passed:\033[0;1;97m %s\033[0m\n",
 			       path);
 			if (exists(actual_path)) {
@@ -98,7 +145,7 @@ void runTests(const char *dir_name, transformer t, bump *b)
 		} else {
 			int fd = open(actual_path, O_WRONLY | O_CREAT | O_TRUNC,
 				      0666);
-			write(fd, actual, strlen(actual));
+			write(fd, actual, actual_length);
 			close(fd);
 
 			printf("\033[31mtest failed:\033[0;1;97m %s\033[0m\n",
@@ -110,8 +157,73 @@ void runTests(const char *dir_name, transformer t, bump *b)
 			system(command);
 		}
 
+		munmap(source.mapping, source.mapping_size);
 		bumpClearToMark(b, local_mark);
 	}
 
 	bumpClearToMark(b, mark);
 }
+
+// The deep_nesting goldens stay shallow enough to read;
+// this builds the same shape of file nested far deeper
+// and only checks that every stage gets through it.
+#define DEEP_NESTING_DEPTH 20000
+
+void runDeepNestingTest(void)
+{
+	memory m = {
+		.general = allocateFromOs(256 * 1024 * 1024),
+		.temp = allocateFromOs(256 * 1024 * 1024),
+	};
+
+	u32 depth = DEEP_NESTING_DEPTH;
+	stringBuilder sb = stringBuilderCreate(&m.general);
+	stringBuilderPrintf(&sb, "func main {\n\tx := 1\n\tset x = ");
+	for (u32 i = 0; i < depth; i++)
+		stringBuilderPrintf(&sb, "(");
+	stringBuilderPrintf(&sb, "x");
+	for (u32 i = 0; i < depth; i++)
+		stringBuilderPrintf(&sb, " + 1)");
+	stringBuilderPrintf(&sb, "\n\t");
+	for (u32 i = 0; i < depth; i++)
+		stringBuilderPrintf(&sb, "{ ");
+	stringBuilderPrintf(&sb, "set x = x - 1");
+	for (u32 i = 0; i < depth; i++)
+		stringBuilderPrintf(&sb, " }");
+	stringBuilderPrintf(&sb, "\n\treturn x\n}\n");
+	char *source = stringBuilderFinish(sb);
+	usize length = strlen(source);
+
+	char *name = "deep_nesting";
+	lineTable lines = { 0 };
+	setCurrentProject((projectSpec){
+		.num_files = 1,
+		.file_names = &name,
+		.file_contents = &source,
+		.file_lengths = &length,
+		.file_lines = &lines,
+	});
+	setCurrentFile(0);
+
+	diagnosticsStorage diagnostics = diagnosticsStorageCreate(&m.general);
+	tokenBuffer tokens = lex(source, length, &diagnostics, &m);
+	internFile(&tokens, source, &m);
+	interner interner = intern(&tokens, &source, 1, &m);
+	astRoot ast = parse(tokens, &diagnostics, &m);
+	hirRoot hir = lower(ast, &diagnostics, &m);
+	stringBuilder assembly = stringBuilderCreate(&m.general);
+	codegen(hir, interner, &assembly, &diagnostics, &m);
+	stringBuilderFinish(assembly);
+
+	// Each level adds one block, or one parenthesized “+ 1”,
+	// on top of what the shallowest version of the file needs.
+	assert(diagnostics.count == 0);
+	assert(ast.statement_count == depth + 5);
+	assert(ast.expression_count == 2 * depth + 8);
+	assert(hir.node_count == 3 * depth + 14);
+	printf("\033[32mtest passed:\033[0;1;97m %s (%u levels)\033[0m\n",
+	       name, depth);
+
+	freeToOs(m.general);
+	freeToOs(m.temp);
+}
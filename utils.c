@@ -75,3 +75,68 @@ u64 fxhash(u8 *ptr, usize len)
 		hash = (rotl(hash, 5) ^ ptr[i]) * 0x517cc1b727220a95;
 	return hash;
 }
+
+// Loads go through memcpy since identifiers start at arbitrary offsets;
+// compilers turn these into single unaligned loads.
+static u64 read64(u8 *ptr)
+{
+	u64 value = 0;
+	memcpy(&value, ptr, sizeof(value));
+	return value;
+}
+
+static u64 read32(u8 *ptr)
+{
+	u32 value = 0;
+	memcpy(&value, ptr, sizeof(value));
+	return value;
+}
+
+// multiplies to 128 bits and folds the halves back together
+static u64 wymix(u64 a, u64 b)
+{
+	__uint128_t product = (__uint128_t)a * b;
+	return (u64)product ^ (u64)(product >> 64);
+}
+
+u64 wyhash(u8 *ptr, usize len)
+{
+	const u64 p0 = 0xa0761d6478bd642f;
+	const u64 p1 = 0xe7037ed1a0b428db;
+
+	u64 seed = p0;
+	u64 a = 0;
+	u64 b = 0;
+
+	// Short inputs are covered by two loads which overlap
+	// when the length isn’t a multiple of the load size,
+	// so we never read past the end
+	// (source files aren’t null-terminated).
+	if (len <= 16) {
+		if (len >= 8) {
+			a = read64(ptr);
+			b = read64(ptr + len - 8);
+		} else if (len >= 4) {
+			a = read32(ptr);
+			b = read32(ptr + len - 4);
+		} else if (len > 0) {
+			a = (u64)ptr[0] << 16 | (u64)ptr[len / 2] << 8 |
+			    ptr[len - 1];
+		}
+	} else {
+		usize remaining = len;
+		for (; remaining > 16; remaining -= 16, ptr += 16)
+			seed = wymix(read64(ptr) ^ p1, read64(ptr + 8) ^ seed);
+		a = read64(ptr + remaining - 16);
+		b = read64(ptr + remaining - 8);
+	}
+
+	return wymix(p1 ^ len, wymix(a ^ p1, b ^ seed));
+}
+
+u64 nowNanoseconds(void)
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (u64)t.tv_sec * 1000000000 + (u64)t.tv_nsec;
+}